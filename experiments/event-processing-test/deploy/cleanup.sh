@@ -1,11 +1,14 @@
 #!/bin/bash
 
-rm -f /tmp/client_$1_1000
-rm -f /tmp/client_$1_1001
-rm -f /tmp/client_$1_1002
-rm -f /tmp/validate_$1
-rm -f /tmp/filter_$2_$5
-rm -f /tmp/filter_$3_$5
-rm -f /tmp/filter_$4_$5
-rm -f /tmp/trace_$1
-rm -f /tmp/visited_*_$1
\ No newline at end of file
+# 1 = seed
+# 2.. = node addrs
+# last = port
+seed=$1
+port=${@: -1}
+rm -f /tmp/client_${seed}_*
+rm -f /tmp/validate_$seed
+for addr in "${@:2:$#-2}"; do
+  rm -f /tmp/filter_${addr}_$port
+done
+rm -f /tmp/trace_$seed
+rm -f /tmp/visited_*_$seed
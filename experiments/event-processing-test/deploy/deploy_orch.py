@@ -34,6 +34,17 @@ def enumerate_ranges(range_list):
   return (True, sorted(list(set(to_ret))))
 
 
+# whether orchs run in namespaces of their own, with node dirs that go away
+# with them
+def private_namespace(conf):
+  return conf.get('namespace', 'host') == 'private'
+
+
+# how many addrs each cluster takes: a node addr and a proxy addr per node
+def cluster_size(conf):
+  return 2 * conf.get('nodes', 3)
+
+
 def validate_config(conf, p):
   print('validating...')
   if not conf:
@@ -46,6 +57,11 @@ def validate_config(conf, p):
     if field not in conf or not conf[field]:
       return (False, 'missing field {}'.format(field))
 
+  for field in ['nodes', 'clients']:
+    if field in conf and (not isinstance(conf[field], int) or conf[field] < 1):
+      return (False, '{} should be a positive int'.format(field))
+  n = cluster_size(conf)
+
   status, addrs = enumerate_ranges(conf['addr_range'])
   if status == False:
     return (False, 'unable to parse range {}'.format(addrs))
@@ -56,10 +72,28 @@ def validate_config(conf, p):
     return (False, 'unable to parse range {}'.format(ports))
 
   num_full_addrs = len(addrs) * len(ports)
-  if num_full_addrs < 6 * p:
+  if private_namespace(conf):
+    # every orch has its own network and node dirs, so they can all use the
+    # first n addrs and the first port
+    if len(addrs) < n:
+      return (False, 'too few addrs ({}), minimum is {}'.format(len(addrs), n))
+    addrs = addrs[:n]
+    ports = ports[:1] * p
+  elif conf.get('transport', 'tcp') == 'unix':
+    # nothing is bound to the addrs or ports, they only keep clusters' node
+    # dirs apart. so every cluster gets the same n addrs and its own port,
+    # made up past the end of listen_ports if there aren't enough
+    if len(addrs) < n:
+      return (False, 'too few addrs ({}), minimum is {}'.format(len(addrs), n))
+    addrs = addrs[:n]
+    ports += range(ports[-1] + 1, ports[-1] + 1 + p - len(ports))
+    if ports[-1] > 65535:
+      return (False, 'too many parallel clusters ({}) for ports from {}'.format(
+          p, ports[0]))
+  elif num_full_addrs < n * p:
     return (False,
             'too few addrs ({}) for {} parallel clusters, minimum is {}'.format(
-                num_full_addrs, p, 6 * p))
+                num_full_addrs, p, n * p))
   del conf['addr_range']
   conf['addrs'] = addrs
   del conf['listen_ports']
@@ -75,7 +109,8 @@ def manage_orch(conf,
                 enable_stderr,
                 mode='rand',
                 input_file='/tmp/replay_orch_{seed}',
-                my_vis=None):
+                my_vis=None,
+                backend='ptrace'):
   '''
   Manages an orch instance. Runs in a separate process in case we need to
   communicate with the instance.
@@ -86,14 +121,13 @@ def manage_orch(conf,
   print('attempting to start orch {} with seed {}'.format(os.getpid(), seed))
 
   format_nodes = {
-      'addr0': node_addrs[0],
-      'addr1': node_addrs[1],
-      'addr2': node_addrs[2],
       'addrs': ' '.join(node_addrs),
       'o_addrs': '{o_addrs}',
       'addr': '{addr}',
       'port': port,
   }
+  for i, addr in enumerate(node_addrs):
+    format_nodes['addr{}'.format(i)] = addr
 
   # start by cleaning up seed just in case
   my_clean_cmd = [
@@ -103,9 +137,11 @@ def manage_orch(conf,
   ]
   subprocess.run(my_clean_cmd)
   print('finished cleaning with {}'.format(my_clean_cmd))
-  clean_cmd = shlex.split(conf['clean'].format(**format_nodes))
-  subprocess.run(clean_cmd)
-  print('finished cleaning with {}'.format(clean_cmd))
+  if not private_namespace(conf):
+    # node dirs are shared with other orchs otherwise
+    clean_cmd = shlex.split(conf['clean'].format(**format_nodes))
+    subprocess.run(clean_cmd)
+    print('finished cleaning with {}'.format(clean_cmd))
 
   if mode == 'visited' and my_vis:
     print('writing visited file for {}'.format(seed))
@@ -130,11 +166,13 @@ def manage_orch(conf,
             --listen-port '{port}'
             --replay-file '{input_file}'
             --visited-file '/tmp/visited_{mode}_{seed}'
+            --backend '{backend}'
             '''
   command = command.format(mode=mode,
                            seed=seed,
                            port=port,
                            input_file=input_file,
+                           backend=backend,
                            **conf)
   command = command.format(**format_nodes)
   command += '''
@@ -142,6 +180,37 @@ def manage_orch(conf,
              --new-addrs '{proxy_addrs}'
              '''.format(node_addrs=' '.join(node_addrs),
                         proxy_addrs=' '.join(proxy_addrs))
+  if 'framing' in conf:
+    # how the proxy splits this cluster's traffic into messages
+    command += " --framing '{}'".format(conf['framing'])
+  if 'transport' in conf:
+    # whether this cluster's nodes talk over TCP or unix sockets
+    command += " --transport '{}'".format(conf['transport'])
+  if 'namespace' in conf:
+    # whether this cluster gets its own network and node dirs
+    command += " --namespace '{}'".format(conf['namespace'])
+  if 'nodes' in conf:
+    command += " --nodes '{}'".format(conf['nodes'])
+  if 'clients' in conf:
+    command += " --clients '{}'".format(conf['clients'])
+  if 'clock' in conf:
+    # whether nodes read vtime from a shared page or trap on every read
+    command += " --clock '{}'".format(conf['clock'])
+  if 'idle' in conf:
+    # who runs once every node is idle in a poll
+    command += " --idle '{}'".format(conf['idle'])
+  if 'persist' in conf:
+    # how fsync backups of node files are copied
+    command += " --persist '{}'".format(conf['persist'])
+  if 'backups' in conf:
+    # whether fsync backups copy whole files or only what was written
+    command += " --backups '{}'".format(conf['backups'])
+  if 'store' in conf:
+    # whether fsync backups are files or chunks in orch's memory
+    command += " --store '{}'".format(conf['store'])
+  if 'fs' in conf:
+    # whether node files are on disk or memfds in orch
+    command += " --fs '{}'".format(conf['fs'])
   command = shlex.split(command)
   trace_file = '/tmp/trace_{}'.format(seed)
   print('attempting to run {}'.format(' '.join(
@@ -176,20 +245,26 @@ def wait_for_children_to_finish():
       exit(1)
 
 
-def deploy_orchs(conf, mode, seed, parallel, total, enable_stdout,
-                 enable_stderr):
+def deploy_orchs(conf,
+                 mode,
+                 seed,
+                 parallel,
+                 total,
+                 enable_stdout,
+                 enable_stderr,
+                 backend='ptrace'):
   print('deploying...')
   num_rounds = 0
   num_completed = 0
   # iterator magic from: https://stackoverflow.com/a/5389547
-  addr_sets = list(zip(*[iter(conf['addrs'])] * 6))
+  addr_sets = list(zip(*[iter(conf['addrs'])] * cluster_size(conf)))
   free_addrs = deque([
       (port, addr_set) for addr_set in addr_sets for port in conf['ports']
   ])
   first_seed = seed
   child_status = {}
   for _ in range(min(total, parallel)):
-    # take next 6 addrs
+    # take the next cluster's addrs
     port, child_addrs = free_addrs.popleft()
     child_pid = manage_orch(conf=conf,
                             port=port,
@@ -197,7 +272,8 @@ def deploy_orchs(conf, mode, seed, parallel, total, enable_stdout,
                             seed=seed,
                             enable_stdout=enable_stdout,
                             enable_stderr=enable_stderr,
-                            mode=mode)
+                            mode=mode,
+                            backend=backend)
     if child_pid == -1:
       exit(1)
     child_status[child_pid] = (port, seed, child_addrs)
@@ -261,9 +337,10 @@ def deploy_orchs(conf, mode, seed, parallel, total, enable_stdout,
           str(child_seed), *node_addrs,
           str(child_port)
       ])
-      clean_cmd = shlex.split(conf['clean'].format(
-          port=child_port, addrs=' '.join(sorted(child_addrs)[1::2])))
-      res = subprocess.run(clean_cmd)
+      if not private_namespace(conf):
+        clean_cmd = shlex.split(conf['clean'].format(
+            port=child_port, addrs=' '.join(sorted(child_addrs)[1::2])))
+        res = subprocess.run(clean_cmd)
     if exit_status == 0 and not enable_stdout:
       # since run succeeded, clean up replay trace as well
       subprocess.run(['rm', '-f', '/tmp/replay_orch_{}'.format(child_seed)])
@@ -281,7 +358,8 @@ def deploy_orchs(conf, mode, seed, parallel, total, enable_stdout,
                               enable_stdout=enable_stdout,
                               enable_stderr=enable_stderr,
                               mode=mode,
-                              my_vis=my_vis)
+                              my_vis=my_vis,
+                              backend=backend)
       if child_pid == -1:
         exit(1)
       child_status[child_pid] = (port, seed, child_addrs)
@@ -293,8 +371,12 @@ def deploy_orchs(conf, mode, seed, parallel, total, enable_stdout,
       break
 
 
-def replay_orch(conf, input_file, enable_stdout, enable_stderr):
-  addrs = sorted(conf['addrs'][:6])
+def replay_orch(conf,
+                input_file,
+                enable_stdout,
+                enable_stderr,
+                backend='ptrace'):
+  addrs = sorted(conf['addrs'][:cluster_size(conf)])
   port = conf['ports'][0]
 
   child_pid = manage_orch(conf,
@@ -304,7 +386,8 @@ def replay_orch(conf, input_file, enable_stdout, enable_stderr):
                           enable_stdout,
                           enable_stderr,
                           mode='replay',
-                          input_file=input_file)
+                          input_file=input_file,
+                          backend=backend)
   if child_pid == -1:
     print('manage_orch failed')
     exit(1)
@@ -360,6 +443,13 @@ addr_range:   <list of values for last octet available for use>
   parser.add_argument('--input-file',
                       required=False,
                       help='only used for replay. the trace to replay')
+  parser.add_argument('--backend',
+                      choices=['ptrace', 'notif'],
+                      default='ptrace',
+                      help='''
+                      how orchs intercept syscalls. notif answers time and
+                      randomness through seccomp user notifications
+                      ''')
   parser.add_argument('--enable-stderr',
                       action='store_true',
                       help='enables printing of orch stderr')
@@ -388,6 +478,7 @@ addr_range:   <list of values for last octet available for use>
   print('successfully loaded config:', json.dumps(to_print, indent=2))
   if args.mode != 'replay':
     deploy_orchs(conf, args.mode, args.seed, args.parallel, args.total,
-                 args.enable_stdout, args.enable_stderr)
+                 args.enable_stdout, args.enable_stderr, args.backend)
   else:
-    replay_orch(conf, args.input_file, args.enable_stdout, args.enable_stderr)
+    replay_orch(conf, args.input_file, args.enable_stdout, args.enable_stderr,
+                args.backend)
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "extents.h"
+
+// files are split into chunks of this many bytes (the last one can be short)
+const size_t CHUNK_SIZE = 64 << 10;
+
+// a stored copy of a file, as the chunks it's made of
+struct Manifest {
+  uint64_t size;
+  std::vector<uint32_t> chunks;
+
+  Manifest() : size(0), chunks() {}
+};
+
+// Backups kept in the orchestrator's memory, deduplicated by content.
+//
+// Every chunk is stored once, under a hash of its bytes, and counts the
+// manifests holding it, so the versions of a file that share a prefix (as a
+// log being appended to does) share all but its last chunks, and identical
+// files on different nodes share everything. Matching hashes are confirmed
+// byte by byte, so the hash only has to be fast. Shared by every node's
+// Filter::Manager, which may be on different threads (see Tracer).
+class ChunkStore {
+public:
+  ChunkStore();
+
+  // stores the file at path into m, dropping what m held. if changed is given
+  // (and m held this file's last copy), only the chunks with a byte in it (or
+  // whose length changed) are read back. false, leaving m alone, if path
+  // can't be opened
+  bool put_file(const std::string &path, Manifest *m,
+                const ExtentSet *changed = nullptr);
+  // writes m out to path, created or truncated. if changed is given (and path
+  // only differs from m there), only those bytes are written, and path is
+  // sized like m. false if path can't be opened
+  bool get_file(const Manifest &m, const std::string &path,
+                const ExtentSet *changed = nullptr);
+  // m holds nothing afterwards
+  void release(Manifest *m);
+
+  // chunks stored, their bytes, and the bytes put_file didn't have to store
+  // since a chunk already had them
+  size_t num_chunks();
+  uint64_t num_bytes();
+  uint64_t num_deduped();
+
+private:
+  std::mutex lock;
+
+  struct Chunk {
+    uint64_t hash;
+    // 0 while the slot is free
+    uint32_t refs;
+    std::string data;
+  };
+  std::vector<Chunk> chunks;
+  std::vector<uint32_t> free_slots;
+  // hash -> slots of the chunks with it
+  std::unordered_multimap<uint64_t, uint32_t> by_hash;
+  uint64_t bytes;
+  uint64_t deduped;
+
+  // (with lock held) the slot of a chunk holding data, with a reference
+  // taken for the caller
+  uint32_t _intern(uint64_t hash, const char *data, size_t len);
+  // (with lock held) drops a reference to slot
+  void _unref(uint32_t slot);
+};
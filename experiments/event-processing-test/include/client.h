@@ -8,16 +8,15 @@
 #include <syscall.h>
 #include <time.h>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "fdmap.h"
+#include "sysstop.h"
+#include "traceemem.h"
+#include "transport.h"
 
 namespace ClientFilter {
 
-const uint32_t syscalls_intercept[] = {
-    // network-related
-    SYS_socket, SYS_close, SYS_connect, SYS_sendto, SYS_recvfrom,
-};
-
 enum Event {
   EV_DEAD,
   EV_EXIT,
@@ -25,6 +24,9 @@ enum Event {
   EV_SENDTO,
   EV_CLOSE,
   EV_RECVING,
+  // not an event. marks stops in syscalls_intercept that are handled without
+  // the orchestrator
+  EV_INTERNAL,
 };
 
 enum State {
@@ -40,7 +42,7 @@ class ClientManager {
 public:
   ClientManager(int client_idx, std::string seed,
                 std::vector<std::string> command, FdMap &fdmap,
-                bool ignore_stdout);
+                bool ignore_stdout, Transport transport = TR_TCP);
 
   Event to_next_event();
 
@@ -52,6 +54,11 @@ public:
 
   void toggle_client();
 
+  // whether the client is stopped somewhere its run to the next event can't
+  // depend on anything delivered to it first (so not in a recv), meaning it
+  // can be advanced early (see Tracer)
+  bool can_run_ahead() const { return child_state == ST_STOPPED; }
+
 private:
   int my_idx;
   std::string seed;
@@ -61,6 +68,11 @@ private:
 
   // pid of the node (if it's running)
   pid_t child;
+  // bulk access to the client's memory. /proc/pid/mem is only opened on
+  // demand, so attaching before the exec is fine
+  TraceeMemory mem;
+  // the client's registers at the current stop
+  SyscallStop stop;
 
   // whether we should redirect stdout to /dev/null
   bool ignore_stdout;
@@ -70,6 +82,8 @@ private:
 
   // mapping between proxy fds and client fds
   FdMap &fdmap;
+  // what the client's AF_INET stream sockets really are
+  Transport transport;
 
   void start_client();
   void stop_client();
@@ -79,11 +93,54 @@ private:
   std::unordered_set<int> deadfds;
 
   void handle_socket();
+  // (TR_UNIX) names the socket after the AF_INET address it's bound to
+  void handle_bind();
+  // (TR_UNIX) skips tcp options (see unix_sockopt)
+  void handle_sockopt();
 
   // if blocking, yeah just stop it
   void handle_recv();
 
   void increment_vtime(long sec, long nsec);
+
+public:
+  // what happens to one intercepted syscall. at its stop, handle runs (if
+  // set), then unless ev is EV_INTERNAL, the stop goes to the orchestrator as
+  // ev with the child in state. with sockfd_only, only stops on a tracked
+  // sockfd (first argument) go to the orchestrator
+  struct Intercept {
+    uint32_t nr;
+    SyscallRoute route;
+    void (ClientManager::*handle)();
+    Event ev;
+    State state;
+    bool sockfd_only;
+    // for logging
+    const char *name;
+  };
+
+  // everything the client is stopped for. both the seccomp program and the
+  // dispatch in to_next_event come from this
+  static constexpr Intercept syscalls_intercept[] = {
+      // network-related
+      {SYS_socket, SR_TRACE, &ClientManager::handle_socket, EV_INTERNAL,
+       ST_STOPPED, false, "socket"},
+      {SYS_bind, SR_TRACE, &ClientManager::handle_bind, EV_INTERNAL,
+       ST_STOPPED, false, "bind"},
+      {SYS_setsockopt, SR_TRACE, &ClientManager::handle_sockopt, EV_INTERNAL,
+       ST_STOPPED, false, "setsockopt"},
+      {SYS_getsockopt, SR_TRACE, &ClientManager::handle_sockopt, EV_INTERNAL,
+       ST_STOPPED, false, "getsockopt"},
+      {SYS_close, SR_TRACE, nullptr, EV_CLOSE, ST_NETWORK, true, "close"},
+      {SYS_connect, SR_TRACE, nullptr, EV_CONNECT, ST_NETWORK, false,
+       "connect"},
+      {SYS_sendto, SR_TRACE, nullptr, EV_SENDTO, ST_NETWORK, false, "sendto"},
+      {SYS_recvfrom, SR_TRACE, nullptr, EV_RECVING, ST_RECVING, false,
+       "recvfrom"},
+  };
+
+private:
+  static const SyscallIndex intercept_index;
 };
 
 } // namespace ClientFilter
\ No newline at end of file
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// what one of the proxy's fds is for
+enum ConnRole : uint8_t {
+  // not (or no longer) one of the proxy's
+  CR_NONE,
+  // listening for connections meant for a node
+  CR_LISTENER,
+  // accepted from whoever connected to a node
+  CR_INBOUND,
+  // the proxy's own connection to a node
+  CR_OUTBOUND,
+};
+
+enum Status {
+  // an outbound connection whose connect hasn't finished yet
+  CONNECTING,
+  CONNECTED,
+};
+
+// Everything the proxy tracks per fd, as arrays indexed by fd.
+//
+// node is the node a listener stands in for, or, for a connection, the node
+// its held messages are delivered to. Every node's connections are also
+// chained into a list, kept in fd order (the order they're offered to the
+// decider), so they can be walked without any lookups.
+class ConnTable {
+public:
+  ConnTable(size_t num_nodes, size_t num_clients);
+
+  // starts tracking fd, as connected. bumps its generation
+  void add(int fd, ConnRole role, int node);
+  // stops tracking fd. bumps its generation again, so anything still tagged
+  // with the old one can tell
+  void remove(int fd);
+
+  bool is_open(int fd) const { return role(fd) != CR_NONE; }
+  ConnRole role(int fd) const { return in(fd) ? roles[fd] : CR_NONE; }
+  int node(int fd) const { return in(fd) ? nodes[fd] : -1; }
+  uint16_t gen(int fd) const { return in(fd) ? gens[fd] : 0; }
+  Status status(int fd) const { return in(fd) ? statuses[fd] : CONNECTED; }
+  void set_status(int fd, Status status) { statuses.at(fd) = status; }
+
+  // the fd on the other side of the proxy, or -1 if it's gone (or there
+  // never was one)
+  int peer(int fd) const { return in(fd) ? peers[fd] : -1; }
+  void set_peer(int fd, int peer_fd) { peers.at(fd) = peer_fd; }
+
+  // walks node's connections: first(node), then next(fd) until -1
+  int first(int node) const { return heads[slot(node)]; }
+  int next(int fd) const { return next_fd[fd]; }
+
+private:
+  size_t num_nodes;
+
+  std::vector<ConnRole> roles;
+  std::vector<int> nodes;
+  std::vector<int> peers;
+  std::vector<uint16_t> gens;
+  std::vector<Status> statuses;
+  // links in each node's list of connections
+  std::vector<int> next_fd, prev_fd;
+  // node slot -> first connection, or -1
+  std::vector<int> heads;
+
+  bool in(int fd) const { return fd >= 0 && (size_t)fd < roles.size(); }
+  size_t slot(int node) const;
+};
@@ -3,10 +3,11 @@
 #include <fstream>
 #include <list>
 #include <random>
-#include <set>
 #include <sstream>
 #include <vector>
 
+#include "runset.h"
+#include "timerq.h"
 #include "visited.h"
 
 // enum DecideEvent {
@@ -31,6 +32,7 @@ enum DecideEvent {
   REVIVE,
   C_SEND,
   C_CONNECT,
+  SEND_BATCH,
 
   SUCCESS = 20,
   FAILURE = 21,
@@ -38,16 +40,29 @@ enum DecideEvent {
 
 class Decider {
 public:
-  Decider() {}
+  Decider() : batch_delivery(false), idle_timers(nullptr) {}
   ~Decider() {}
 
   virtual void fill_random(void *buf, size_t buf_len) = 0;
 
   // assume that whenever this gets called, we know all subsequent methods
   // called will refer to the returned node
-  virtual int get_next_node(int num_alive_nodes, std::set<int> &nodes,
-                            std::set<int> &clients) = 0;
+  virtual int get_next_node(int num_alive_nodes, RunSet &nodes,
+                            RunSet &clients) = 0;
   virtual bool should_send_msg() = 0;
+  // picks which of the messages waiting for the current node go out this
+  // turn, given how many are waiting on each of its fds. fills batch with the
+  // index of the fd each comes from, in the order they're sent. by default
+  // that's one from every fd should_send_msg says yes to
+  virtual void choose_batch(const std::vector<size_t> &waiting,
+                            std::vector<size_t> *batch);
+  // lets choose_batch send more than one message per fd, in any order across
+  // fds, recorded as a single decision
+  void set_batch_delivery(bool enabled) { batch_delivery = enabled; }
+  // once every node is idle in a poll, has get_next_node run the one timers
+  // has armed earliest, rather than spreading turns by how often each has
+  // polled. timers is kept up to date by the caller
+  void set_idle_timers(const TimerQueue *timers) { idle_timers = timers; }
 
   virtual bool should_fail_on_send() = 0;
   virtual bool should_fail_on_connect() = 0;
@@ -67,6 +82,14 @@ public:
   virtual bool c_should_fail_on_connect() = 0;
 
   virtual void write_metadata() {}
+
+protected:
+  bool batch_delivery;
+  const TimerQueue *idle_timers;
+
+  // the node idle_timers says wakes first, if it's set and every one of
+  // num_nodes is idle, otherwise -1
+  int idle_wakeup(size_t num_nodes) const;
 };
 
 class RRandDecider : public Decider {
@@ -80,9 +103,11 @@ public:
 
   void fill_random(void *buf, size_t buf_len) override;
 
-  int get_next_node(int num_alive_nodes, std::set<int> &nodes,
-                    std::set<int> &clients) override;
+  int get_next_node(int num_alive_nodes, RunSet &nodes,
+                    RunSet &clients) override;
   bool should_send_msg() override;
+  void choose_batch(const std::vector<size_t> &waiting,
+                    std::vector<size_t> *batch) override;
 
   bool should_fail_on_send() override;
   bool should_fail_on_connect() override;
@@ -133,9 +158,11 @@ public:
 
   void fill_random(void *buf, size_t buf_len) override;
 
-  int get_next_node(int num_alive_nodes, std::set<int> &nodes,
-                    std::set<int> &clients) override;
+  int get_next_node(int num_alive_nodes, RunSet &nodes,
+                    RunSet &clients) override;
   bool should_send_msg() override;
+  void choose_batch(const std::vector<size_t> &waiting,
+                    std::vector<size_t> *batch) override;
 
   bool should_fail_on_send() override;
   bool should_fail_on_connect() override;
@@ -167,9 +194,11 @@ public:
 
   void fill_random(void *buf, size_t buf_len) override;
 
-  int get_next_node(int num_alive_nodes, std::set<int> &nodes,
-                    std::set<int> &clients) override;
+  int get_next_node(int num_alive_nodes, RunSet &nodes,
+                    RunSet &clients) override;
   bool should_send_msg() override;
+  void choose_batch(const std::vector<size_t> &waiting,
+                    std::vector<size_t> *batch) override;
 
   bool should_fail_on_send() override;
   bool should_fail_on_connect() override;
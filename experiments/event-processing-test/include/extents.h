@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <map>
+#include <utility>
+#include <vector>
+
+// stands in for a length running to the end of the file, however long it gets
+const uint64_t TO_EOF = UINT64_MAX;
+
+// The byte ranges of a file written since some copy of it was last in sync,
+// merged as they're added, so a file written over and over in the same place
+// (or appended to) stays a handful of ranges.
+class ExtentSet {
+public:
+  ExtentSet();
+
+  // marks len bytes at off (or everything from off on, for TO_EOF)
+  void add(uint64_t off, uint64_t len);
+  void clear() { ranges.clear(); }
+  bool empty() const { return ranges.empty(); }
+  // whether any of the len bytes at off are marked
+  bool overlaps(uint64_t off, uint64_t len) const;
+
+  // fills out with every (offset, length), in order, cut off at size
+  void clipped(uint64_t size,
+               std::vector<std::pair<uint64_t, uint64_t>> *out) const;
+
+private:
+  // start -> end (exclusive, or TO_EOF). never overlapping or touching
+  std::map<uint64_t, uint64_t> ranges;
+};
@@ -6,15 +6,10 @@
 #include <sys/types.h>
 #include <syscall.h>
 
+#include <mutex>
 #include <string>
-#include <unordered_map>
-#include <unordered_set>
 #include <vector>
 
-inline size_t key(int i, int j) { return (size_t)i << 32 | (unsigned int)j; }
-inline int node_from_key(size_t key) { return (int)(key >> 32); }
-inline int fd_from_key(size_t key) { return (int)key; }
-
 // This ensures requests going to the proxy's address go to the node's address.
 // The proxy will be the one establishing connections to the node on behalf of
 // any request.
@@ -24,13 +19,15 @@ class FdMap {
 public:
   FdMap(size_t num_nodes, size_t num_clients);
 
-  int get_last_node();
-
-  void trash_last_node();
+  // node's fd just connected to a proxy from nodeaddr (the fd's own address)
+  void node_connect_fd(int node, int fd, struct sockaddr_in nodeaddr);
 
-  void node_connect_fd(int node, int fd);
+  // whether any node has connected without the proxy accepting it yet
+  bool has_unaccepted();
 
-  void proxy_accept_fd(int proxyfd);
+  // links proxyfd, just accepted from fromaddr, to the nodefd that connected
+  // from there. returns that node, or -1 if no node has (yet)
+  int proxy_accept_fd(int proxyfd, struct sockaddr_in fromaddr);
 
   void proxy_connect_fd(int node, int proxyfd, struct sockaddr_in proxyaddr);
 
@@ -51,28 +48,45 @@ public:
   void clear_nodefds(int node);
 
 private:
-  // -1 if not filled
-  int last_node, last_nodefd;
+  // managers running ahead on their own threads (see Tracer) can get here
+  // while the proxy does
+  std::mutex lock;
+
+  size_t num_nodes;
+
+  // a nodefd that has connected, waiting for the proxy to accept it
+  struct NodeConnect {
+    int node, nodefd;
+    struct sockaddr_in addr;
+  };
+  std::vector<NodeConnect> connecting_nodefds;
+
+  // everything below is indexed by fd (and for nodefds, first by node slot,
+  // see slot()), and grown as bigger fds show up
 
   // node --> (proxyfd, addr)
-  std::unordered_map<int, std::vector<std::pair<int, struct sockaddr_in>>>
+  std::vector<std::vector<std::pair<int, struct sockaddr_in>>>
       nodes_to_connecting_proxyfds;
 
-  std::unordered_map<int, int> connecting_proxyfds;
-  // don't track connecting nodefds since that's implicit in last_node and
-  // last_nodefd
+  // proxyfd --> node it's connecting to, or -1
+  std::vector<int> connecting_proxyfds;
+
+  // (node, nodefd) --> proxyfd, or -1
+  std::vector<std::vector<int>> nodefd_to_proxyfd;
 
-  // (node, nodefd) --> proxyfd
-  // use key(node, nodefd) to get required key
-  std::unordered_map<size_t, int> nodefd_to_proxyfd;
+  // proxyfd --> (node, nodefd), or (-1, -1)
+  std::vector<std::pair<int, int>> proxyfd_to_nodefd;
 
-  // proxyfd --> (node, nodefd)
-  std::unordered_map<int, std::pair<int, int>> proxyfd_to_nodefd;
+  // (node, nodefd) --> whether it's dead
+  std::vector<std::vector<bool>> dead_nodefds;
 
-  // node --> nodefd
-  std::unordered_map<int, std::unordered_set<int>> dead_nodefds;
+  // proxyfd --> whether it's dead
+  std::vector<bool> dead_proxyfds;
 
-  std::unordered_set<int> dead_proxyfds;
+  size_t slot(int node);
+  // the entries for proxyfd / (node, nodefd), growing the tables if needed
+  void grow_proxyfd(int proxyfd);
+  void grow_nodefd(int node, int nodefd);
 
   void print_state();
 };
\ No newline at end of file
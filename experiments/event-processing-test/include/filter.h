@@ -1,53 +1,49 @@
 #pragma once
 
+#include <linux/seccomp.h>
 #include <netinet/ip.h>
 #include <stdint.h>
 #include <string>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/user.h>
 #include <syscall.h>
 #include <time.h>
 
-#include <deque>
 #include <functional>
 #include <list>
-#include <map>
 #include <unordered_map>
 
 #include "fdmap.h"
+#include "chunkstore.h"
+#include "extents.h"
+#include "memfs.h"
+#include "notif.h"
+#include "persist.h"
+#include "sysstop.h"
+#include "timerq.h"
+#include "traceemem.h"
+#include "transport.h"
+#include "vclock.h"
+#include "versions.h"
 
 namespace Filter {
 
-const uint32_t syscalls_intercept[] = {
-    // polling-related
-    SYS_select,
-    SYS_poll,
-    SYS_gettimeofday,
-    SYS_clock_gettime,
-    SYS_getrandom,
-    // filesystem-related
-    SYS_open,
-    SYS_openat,
-    SYS_mknod,
-    SYS_mknodat,
-    SYS_creat,
-    SYS_close,
-    SYS_write, // assume that network doesn't use write
-    SYS_rename,
-    SYS_renameat, // not handled due to scope
-    SYS_syncfs,
-    SYS_fsync,
-    SYS_fdatasync,
-    // network-related
-    SYS_socket,
-    SYS_bind,
-    SYS_getsockname,
-    SYS_getpeername,
-    SYS_accept,
-    SYS_accept4,
-    SYS_connect,
-    SYS_sendto,
-    SYS_recvfrom,
+// fds the manager tracks (sockfds and fds) are moved to TRACKED_FD_BASE or
+// above as soon as they're created, so the seccomp filter can let anything
+// below it through without a stop (see SR_TRACKED_FD)
+const int TRACKED_FD_BASE = 512;
+
+// how far vtime moves for every intercepted syscall
+const long VTIME_STEP_NS = 1000;
+
+// how syscalls are intercepted
+enum Backend {
+  // everything is a ptrace stop
+  BK_PTRACE,
+  // SR_NOTIFY syscalls go through SECCOMP_RET_USER_NOTIF, everything else is
+  // a ptrace stop
+  BK_NOTIF,
 };
 
 enum Event {
@@ -59,6 +55,9 @@ enum Event {
   EV_SENDTO,
   EV_FSYNC,
   EV_WRITE,
+  // not an event. marks stops in syscalls_intercept that are handled without
+  // the orchestrator
+  EV_INTERNAL,
 };
 
 enum State {
@@ -74,7 +73,11 @@ class Manager {
 public:
   Manager(int node_idx, std::vector<std::string> command, sockaddr_in old_addr,
           sockaddr_in new_addr, FdMap &fdmap, std::string prefix,
-          bool ignore_stdout);
+          bool ignore_stdout, Backend backend = BK_PTRACE,
+          bool emulate_at_entry = false, std::string vclock_shim = "",
+          Transport transport = TR_TCP, PersistMode persist_mode = PM_REFLINK,
+          bool dirty_backups = false, ChunkStore *chunks = nullptr,
+          bool mem_files = false);
 
   Event to_next_event();
 
@@ -91,6 +94,17 @@ public:
 
   void toggle_node();
 
+  // whether the node is stopped somewhere its run to the next event can't
+  // depend on anything delivered to it first (so not in a poll), meaning it
+  // can be advanced early (see Tracer)
+  bool can_run_ahead() const { return child_state == ST_STOPPED; }
+
+  // the node's vtime, in ns
+  uint64_t vtime_ns() const { return VClock::to_ns(vtime); }
+  // the vtime (in ns) the poll the node just stopped at (EV_POLLING) times out
+  // at if nothing comes in, or TIMER_NEVER if it has no timeout
+  uint64_t poll_deadline();
+
 private:
   int my_idx;
 
@@ -100,9 +114,35 @@ private:
   // current time for the process. mainly to prevent orchestrator runtime
   // variance from changing child behavior
   struct timespec vtime;
+  // if non-empty, the node gets vtime through a shared page (see vclock.h)
+  // read by this preloaded shim, rather than trapping on every clock read
+  std::string vclock_shim;
+  int vclock_fd;
+  VClockPage *vclock;
 
   // pid of the node (if it's running)
   pid_t child;
+  // bulk access to the node's memory
+  TraceeMemory mem;
+  // the node's registers at the current stop
+  SyscallStop stop;
+
+  // how syscalls are being intercepted
+  Backend backend;
+  // whether time and randomness syscalls stopped by ptrace are completed at
+  // the seccomp stop (one stop), rather than run and then overwritten at the
+  // syscall-exit stop (two stops)
+  bool emulate_at_entry;
+  // seccomp listener if using BK_NOTIF, otherwise -1
+  int notif_fd;
+  // whether the child is in a ptrace stop (as opposed to running or blocked
+  // on a notification)
+  bool in_ptrace_stop;
+  // seccomp stops (and notifications) handled since the node started
+  uint64_t num_traps;
+  // notification that's been turned into an event but not yet answered
+  bool notif_pending;
+  struct seccomp_notif notif_req;
 
   // whether we should redirect stdout to /dev/null
   bool ignore_stdout;
@@ -114,15 +154,56 @@ private:
   FdMap &fdmap;
   // how to redirect addresses
   sockaddr_in old_addr, new_addr;
+  // what the node's AF_INET stream sockets really are
+  Transport transport;
   // socket file descriptors
   // value: is_redirected
   std::unordered_map<int, bool> sockfds;
 
+  // a timerfd of the node's, in the tracked range like sockfds
+  struct VTimer {
+    // our copy of it, through which expirations are delivered
+    int localfd;
+    // whether it's kept in virtual time (it was last armed nonblocking)
+    bool virt;
+    // vtime (ns) it next expires at, or 0 if disarmed
+    uint64_t next_ns;
+    // ns between expirations, or 0 if it only expires once
+    uint64_t interval_ns;
+  };
+  std::unordered_map<int, VTimer> vtimers;
+
   // directory in the file system that should be tracked with fsync
   // TODO (this isn't necessarily needed, but does make our life easier)
   std::string prefix;
   // suffix to append to "properly fsynced" files
   static const std::string suffix;
+  // makes the backups, and copies them back on restore
+  Persister persist;
+  // whether backups (and restores) only copy what's been written since the
+  // backup last matched the file
+  bool dirty_backups;
+  // a file's backup of version, and what the file has had written to it
+  // since the two matched. a file only has one while they still differ in
+  // nothing else (its version hasn't moved on, and it hasn't been unlinked)
+  struct Dirty {
+    int version;
+    ExtentSet extents;
+  };
+  std::unordered_map<std::string, Dirty> dirty;
+  // our copies of the node's fds into files with a Dirty, for finding where
+  // writes without an offset land
+  std::unordered_map<int, int> fd_copies;
+  // if set, backups are kept here (shared with the other nodes) instead of as
+  // files, by the names the files would have had
+  ChunkStore *chunks;
+  std::unordered_map<std::string, Manifest> manifests;
+  // whether the node's regular files in prefix are kept in memfs instead of
+  // on disk, along with the backups unless they're in chunks. only opens,
+  // mknods, renames, unlinks and truncates reach them, and prefix's
+  // directories stay on disk
+  bool mem_files;
+  MemFs memfs;
   // filesystem-related file descriptors
   // value: current path
   std::unordered_map<int, std::string> fds;
@@ -130,51 +211,272 @@ private:
   std::unordered_map<std::string, int> file_vers;
   // latest persisted version of a file
   std::unordered_map<std::string, int> file_pers;
-  // all pending op indexes for a given file
-  // file -> [pending op]
-  std::unordered_map<std::string, std::deque<size_t>> file_pending;
-  // set of files whose latest version is a src of a rename
-  std::unordered_set<std::string> rename_srcs;
-  size_t ops_done;
-  size_t op_count;
-  // rename ops (for happens-before relations)
-  // op idx -> ((src_file, src_version), (dst_file, dst_version))
-  std::map<size_t,
-           std::pair<std::pair<std::string, int>, std::pair<std::string, int>>>
-      pending_ops;
+  // rename ops not yet done to the backups (for happens-before relations)
+  VersionGraph versions;
 
+  // files moved aside for validation, and where to. with mem_files, nothing
+  // is moved, and these are the persisted copies written out to be removed
   std::vector<std::pair<std::string, std::string>> restore_map;
 
   void start_node();
   void stop_node();
 
+  // resumes the child if needed, and waits for either a ptrace stop or a
+  // notification. returns true if it was a notification
+  bool wait_child(int *status);
+  // answers a notification if possible. returns true and fills ev if it needs
+  // to be handled by the orchestrator
+  bool handle_notif(Event *ev);
+  void notif_gettimeofday();
+  void notif_clock_gettime();
+  void notif_socket();
+
   void backup_file(int fd);
-  void restore_files();
+  // where name (a file, or a backup kept as a file) can be opened: itself, or
+  // its memfd with mem_files, made empty first if create and it isn't there
+  std::string file_path(const std::string &name, bool create = false);
+  // (with mem_files) whether path is in memfs, after moving it there if it's
+  // a regular file still on disk
+  bool in_memory(const std::string &path);
+  // backups by name (see get_backup_filename), wherever they're kept. saving
+  // and loading only copy what's in changed, if given, returning false
+  // (having done nothing) if there's no backup to update that way
+  bool backup_exists(const std::string &name);
+  bool save_backup(const std::string &file, const std::string &name,
+                   const ExtentSet *changed = nullptr);
+  bool load_backup(const std::string &name, const std::string &file,
+                   const ExtentSet *changed = nullptr);
+  // like load_backup, but to a path as it's given, even with mem_files
+  bool write_backup(const std::string &name, const std::string &path,
+                    const ExtentSet *changed = nullptr);
+  // renames from to to, or makes to empty if there's no from
+  void move_backup(const std::string &from, const std::string &to);
+  void drop_backup(const std::string &name);
+  // (with mem_files) drops file's backup of version vers once file_pers has
+  // moved past it, unless a pending op still needs it. each backup holds a
+  // memfd, so they'd otherwise pile up until orch runs out of fds
+  void drop_superseded(const std::string &file, int vers);
+  // copies every file's persisted backup back over it. incremental restores
+  // only copy back what's been written since (with dirty_backups), and leave
+  // the files in sync with their backups
+  void restore_files(bool incremental = true);
 
   // should set timeout to 0
   void handle_poll();
   void handle_select();
+  // (at a polling syscall's seccomp stop) fills timeout_ns with how long it
+  // would wait for. false if it would wait forever
+  bool poll_timeout(uint64_t *timeout_ns);
+
+  // sleeps complete at once, moving vtime on instead
+  void handle_nanosleep();
+  void notif_nanosleep();
+  // how far vtime moves for a sleep of req (absolute if abstime)
+  uint64_t sleep_ns(uint64_t req_ptr, bool abstime);
+
+  // nonblocking timerfds are kept in virtual time: arming one doesn't arm
+  // the real timer, and expirations are delivered to it (see fire_vtimers)
+  // once vtime passes them. blocking ones are left to real time, since a
+  // read on one can't be seen to be answered
+  void handle_timerfd_create();
+  void handle_timerfd_settime();
+  void handle_timerfd_gettime();
+  // delivers every expiration of a virtual timerfd vtime has reached
+  void fire_vtimers();
+  // the earliest vtime (in ns) a virtual timerfd next expires at, or
+  // TIMER_NEVER
+  uint64_t next_vtimer();
 
   void handle_gettimeofday();
   void handle_clock_gettime();
+  void write_random(uint64_t addr, size_t len,
+                    std::function<void(void *, size_t)> fill_fn);
+  // (at a seccomp stop) skips the syscall, making it return ret
+  void skip_syscall(long ret);
 
-  void handle_open(bool at);
-  void handle_mknod(int arg);
-  int handle_rename();
+  void handle_open();
+  void handle_mknod();
+  void handle_rename();
+  // the bookkeeping for a rename of src over dst that went through
+  void note_rename(const std::string &src, const std::string &dst);
+  // with dirty_backups, record where writes that aren't EV_WRITEs land
+  void handle_pwrite();
+  void handle_truncate();
+  void handle_unlink();
+  // marks len bytes at off of fd's file (if it has a Dirty) as written.
+  // off can also be where the next write through fd goes
+  static const int64_t AT_POS = -1;
+  static const int64_t AT_END = -2;
+  void note_write(int fd, int64_t off, uint64_t len);
+  void note_write(const std::string &file, uint64_t off, uint64_t len);
   void perform_next_op();
   std::string get_backup_filename(std::string file, int version);
-  std::pair<std::string, int> find_root(std::string file, int version);
 
   void handle_socket(); // only track AF_INET, SOCK_STREAM, IPPROTO_IP addresses
                         // (hard to say if this is actually needed)
   void handle_bind();   // redirect bind to some other addr
   void handle_close();
+  // drops everything tracked for fd, once the node has closed it
+  void forget_fd(int fd);
+  // dup, dup2, dup3 and fcntl(F_DUPFD*) of a tracked fd. a copy of a file is
+  // moved up and tracked like the original, unless the node picked a slot
+  // below TRACKED_FD_BASE (dup2/dup3). copies of sockets and timerfds aren't
+  // tracked: syscalls on them go through as on any untracked fd
+  void handle_dup();
   void handle_getsockname(); // redirect back to original addr
+  void handle_getpeername(); // (TR_UNIX) the address a unix peer stands in for
+  void handle_sockopt();     // (TR_UNIX) skip tcp options (see unix_sockopt)
   void handle_accept();
+  // (at a syscall-exit stop) gives the node addr as the address a syscall
+  // returned into addr_ptr, with its length at addrlen_ptr
+  void write_inet_addr(uint64_t addr_ptr, uint64_t addrlen_ptr,
+                       const sockaddr_in &addr);
+  // (at a syscall-exit stop that returned an fd) moves the fd to the lowest
+  // free tracked slot, and makes the syscall return that instead
+  int relocate_fd(bool cloexec);
+  // the lowest tracked slot the node has nothing open at, for when the fd
+  // can't be placed by the node's kernel (notification ADDFD)
+  int next_tracked_fd();
+  // (at a syscall-exit stop) runs another syscall in the node, then leaves
+  // it at the same stop. returns the injected syscall's result
+  long inject_syscall(long nr, long arg0, long arg1, long arg2);
+  // (at a syscall-exit stop) runs the syscall regs describe (with rip still
+  // just past the syscall instruction) in the node, then leaves it at the
+  // same stop. returns its result
+  long rerun_syscall(struct user_regs_struct regs);
   int handle_connect();
   int handle_sendto();
 
+  // moves vtime on, firing any virtual timerfds it passes
   void increment_vtime(long sec, long nsec);
+  // copy vtime to the shared page / back from it, if there is one
+  void publish_vtime();
+  void collect_vtime();
+
+  // for syscalls we refuse to deal with
+  void handle_unsupported();
+  void notif_getrandom();
+
+public:
+  // what happens to one intercepted syscall. at its stop, handle runs (if
+  // set), then unless ev is EV_INTERNAL, the stop goes to the orchestrator as
+  // ev with the child in state. if it arrives as a notification,
+  // handle_notif runs instead of handle
+  struct Intercept {
+    uint32_t nr;
+    SyscallRoute route;
+    void (Manager::*handle)();
+    Event ev;
+    State state;
+    void (Manager::*handle_notif)();
+  };
+
+  // everything the node is stopped for. both the seccomp program and the
+  // dispatch in to_next_event/handle_notif come from this
+  static constexpr Intercept syscalls_intercept[] = {
+      // polling-related
+      {SYS_select, SR_TRACE, nullptr, EV_POLLING, ST_POLLING, nullptr},
+      {SYS_poll, SR_TRACE, nullptr, EV_POLLING, ST_POLLING, nullptr},
+      {SYS_pselect6, SR_TRACE, nullptr, EV_POLLING, ST_POLLING, nullptr},
+      {SYS_ppoll, SR_TRACE, nullptr, EV_POLLING, ST_POLLING, nullptr},
+      {SYS_epoll_wait, SR_TRACE, nullptr, EV_POLLING, ST_POLLING, nullptr},
+      {SYS_epoll_pwait, SR_TRACE, nullptr, EV_POLLING, ST_POLLING, nullptr},
+      {SYS_epoll_pwait2, SR_TRACE, nullptr, EV_POLLING, ST_POLLING, nullptr},
+      // timer-related
+      {SYS_nanosleep, SR_NOTIFY, &Manager::handle_nanosleep, EV_INTERNAL,
+       ST_STOPPED, &Manager::notif_nanosleep},
+      {SYS_clock_nanosleep, SR_NOTIFY, &Manager::handle_nanosleep,
+       EV_INTERNAL, ST_STOPPED, &Manager::notif_nanosleep},
+      {SYS_timerfd_create, SR_TRACE, &Manager::handle_timerfd_create,
+       EV_INTERNAL, ST_STOPPED, nullptr},
+      {SYS_timerfd_settime, SR_TRACKED_FD, &Manager::handle_timerfd_settime,
+       EV_INTERNAL, ST_STOPPED, nullptr},
+      {SYS_timerfd_gettime, SR_TRACKED_FD, &Manager::handle_timerfd_gettime,
+       EV_INTERNAL, ST_STOPPED, nullptr},
+      {SYS_gettimeofday, SR_NOTIFY, &Manager::handle_gettimeofday, EV_INTERNAL,
+       ST_STOPPED, &Manager::notif_gettimeofday},
+      {SYS_clock_gettime, SR_NOTIFY, &Manager::handle_clock_gettime,
+       EV_INTERNAL, ST_STOPPED, &Manager::notif_clock_gettime},
+      {SYS_getrandom, SR_NOTIFY, nullptr, EV_RANDOM, ST_RANDOM,
+       &Manager::notif_getrandom},
+      // filesystem-related
+      {SYS_open, SR_TRACE, &Manager::handle_open, EV_INTERNAL, ST_STOPPED,
+       nullptr},
+      {SYS_openat, SR_TRACE, &Manager::handle_open, EV_INTERNAL, ST_STOPPED,
+       nullptr},
+      {SYS_mknod, SR_TRACE, &Manager::handle_mknod, EV_INTERNAL, ST_STOPPED,
+       nullptr},
+      {SYS_mknodat, SR_TRACE, &Manager::handle_mknod, EV_INTERNAL, ST_STOPPED,
+       nullptr},
+      // handle like open since pathname in same place and we're not
+      // thinking too deeply about mode right now
+      // TODO think a bit more deeply about mode?
+      {SYS_creat, SR_TRACE, &Manager::handle_open, EV_INTERNAL, ST_STOPPED,
+       nullptr},
+      {SYS_close, SR_TRACKED_FD, &Manager::handle_close, EV_INTERNAL,
+       ST_STOPPED, nullptr},
+      {SYS_dup, SR_TRACKED_FD, &Manager::handle_dup, EV_INTERNAL, ST_STOPPED,
+       nullptr},
+      {SYS_dup2, SR_TRACKED_FD, &Manager::handle_dup, EV_INTERNAL, ST_STOPPED,
+       nullptr},
+      {SYS_dup3, SR_TRACKED_FD, &Manager::handle_dup, EV_INTERNAL, ST_STOPPED,
+       nullptr},
+      // only its F_DUPFD commands do anything
+      {SYS_fcntl, SR_TRACKED_FD, &Manager::handle_dup, EV_INTERNAL,
+       ST_STOPPED, nullptr},
+      // assume that network doesn't use write
+      {SYS_write, SR_TRACKED_FD, nullptr, EV_WRITE, ST_FILES, nullptr},
+      {SYS_pwrite64, SR_TRACKED_FD, &Manager::handle_pwrite, EV_INTERNAL,
+       ST_STOPPED, nullptr},
+      {SYS_writev, SR_TRACKED_FD, &Manager::handle_pwrite, EV_INTERNAL,
+       ST_STOPPED, nullptr},
+      {SYS_pwritev, SR_TRACKED_FD, &Manager::handle_pwrite, EV_INTERNAL,
+       ST_STOPPED, nullptr},
+      {SYS_pwritev2, SR_TRACKED_FD, &Manager::handle_pwrite, EV_INTERNAL,
+       ST_STOPPED, nullptr},
+      {SYS_ftruncate, SR_TRACKED_FD, &Manager::handle_truncate, EV_INTERNAL,
+       ST_STOPPED, nullptr},
+      {SYS_fallocate, SR_TRACKED_FD, &Manager::handle_truncate, EV_INTERNAL,
+       ST_STOPPED, nullptr},
+      {SYS_truncate, SR_TRACE, &Manager::handle_truncate, EV_INTERNAL,
+       ST_STOPPED, nullptr},
+      {SYS_unlink, SR_TRACE, &Manager::handle_unlink, EV_INTERNAL, ST_STOPPED,
+       nullptr},
+      {SYS_unlinkat, SR_TRACE, &Manager::handle_unlink, EV_INTERNAL,
+       ST_STOPPED, nullptr},
+      {SYS_rename, SR_TRACE, &Manager::handle_rename, EV_INTERNAL, ST_STOPPED,
+       nullptr},
+      // TODO if time, handle renameat and syncfs
+      {SYS_renameat, SR_TRACE, &Manager::handle_unsupported, EV_INTERNAL,
+       ST_STOPPED, nullptr},
+      {SYS_syncfs, SR_TRACE, &Manager::handle_unsupported, EV_INTERNAL,
+       ST_STOPPED, nullptr},
+      {SYS_fsync, SR_TRACE, nullptr, EV_FSYNC, ST_FILES, nullptr},
+      {SYS_fdatasync, SR_TRACE, nullptr, EV_FSYNC, ST_FILES, nullptr},
+      // network-related
+      {SYS_socket, SR_NOTIFY, &Manager::handle_socket, EV_INTERNAL, ST_STOPPED,
+       &Manager::notif_socket},
+      {SYS_bind, SR_TRACE, &Manager::handle_bind, EV_INTERNAL, ST_STOPPED,
+       nullptr},
+      {SYS_getsockname, SR_TRACE, &Manager::handle_getsockname, EV_INTERNAL,
+       ST_STOPPED, nullptr},
+      {SYS_getpeername, SR_TRACE, &Manager::handle_getpeername, EV_INTERNAL,
+       ST_STOPPED, nullptr},
+      {SYS_setsockopt, SR_TRACKED_FD, &Manager::handle_sockopt, EV_INTERNAL,
+       ST_STOPPED, nullptr},
+      {SYS_getsockopt, SR_TRACKED_FD, &Manager::handle_sockopt, EV_INTERNAL,
+       ST_STOPPED, nullptr},
+      {SYS_accept, SR_TRACE, &Manager::handle_accept, EV_INTERNAL, ST_STOPPED,
+       nullptr},
+      {SYS_accept4, SR_TRACE, &Manager::handle_accept, EV_INTERNAL, ST_STOPPED,
+       nullptr},
+      {SYS_connect, SR_TRACE, nullptr, EV_CONNECT, ST_NETWORK, nullptr},
+      {SYS_sendto, SR_TRACKED_FD, nullptr, EV_SENDTO, ST_NETWORK, nullptr},
+      {SYS_recvfrom, SR_TRACE, nullptr, EV_INTERNAL, ST_STOPPED, nullptr},
+  };
+
+private:
+  static const SyscallIndex intercept_index;
 };
 
 } // namespace Filter
\ No newline at end of file
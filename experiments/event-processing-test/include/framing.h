@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+
+// how the proxy cuts what arrives on a connection into the messages it holds
+// back and releases one at a time
+enum FrameKind {
+  // whatever one read returns is a message, so how many there are depends on
+  // how the kernel chunked the stream
+  FR_RAW,
+  // every message starts with the length of the rest of it, as a 4 byte big
+  // endian integer
+  FR_LENGTH,
+  // every message ends with a '\n'
+  FR_NEWLINE,
+};
+
+// how far a link's stream has got into the message in progress. each link has
+// its own, so one Framing can be shared by all of them
+struct FrameState {
+  // bytes of it seen so far
+  uint64_t seen;
+  // whatever the framing has worked out about it (e.g. its length)
+  uint64_t expect;
+};
+
+// Finds where messages end in a stream, one piece of it at a time.
+class Framing {
+public:
+  virtual ~Framing() {}
+
+  // whether scan looks at the bytes at all. if not, they don't have to be
+  // read before they're framed
+  virtual bool needs_bytes() const { return true; }
+
+  // takes bytes from data, stopping at the end of the message in progress.
+  // returns how many it took, and sets done if they finished the message
+  virtual size_t scan(FrameState *state, const char *data, size_t len,
+                      bool *done) const = 0;
+};
+
+class RawFraming : public Framing {
+public:
+  bool needs_bytes() const override { return false; }
+  size_t scan(FrameState *state, const char *data, size_t len,
+              bool *done) const override;
+};
+
+class LengthFraming : public Framing {
+public:
+  size_t scan(FrameState *state, const char *data, size_t len,
+              bool *done) const override;
+
+private:
+  static const size_t HEADER_LEN = 4;
+};
+
+class NewlineFraming : public Framing {
+public:
+  size_t scan(FrameState *state, const char *data, size_t len,
+              bool *done) const override;
+};
+
+std::unique_ptr<Framing> make_framing(FrameKind kind);
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+
+// where an orch's network and node dirs live
+enum NamespaceMode {
+  // the host's, shared with every other orch on it
+  NS_HOST,
+  // new user, network and mount namespaces of its own. the network has
+  // nothing but loopback, so the same addresses and port can be used by any
+  // number of orchs at once, and node dirs are private tmpfs mounts that go
+  // away with the orch
+  NS_PRIVATE,
+};
+
+// moves this process (and anything it starts from now on) into new user,
+// network and mount namespaces, mapped to the same uid/gid, with loopback up
+// and mounts no longer shared with the host. needs no privileges, but has to
+// happen before any threads are started. exits if it can't
+void enter_private_namespaces();
+
+// mounts an empty tmpfs on dir (creating it and its parents if needed), seen
+// only inside this mount namespace. exits if it can't
+void mount_private_dir(const std::string &dir);
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+
+// A node's files, kept in the orchestrator as memfds instead of on disk.
+//
+// Each path holds one memfd, which the node (or anything else that can see
+// orch's fds) opens through proc_path, so the node's opens are pointed there
+// and everything that copies files works on them unchanged. Renames and
+// unlinks only move or drop the memfd a path holds, and a node's fds into a
+// memfd keep it alive as they would a file on disk. Like the vclock page, the
+// memfds left at the end are kept until orch exits.
+class MemFs {
+public:
+  MemFs();
+
+  // the memfd path holds, or -1 if it doesn't exist
+  int fd(const std::string &path) const;
+  // the memfd path holds, made empty first if it didn't exist
+  int create(const std::string &path);
+  // where path can be opened: its memfd's name under /proc, or path itself
+  // (on disk) if it doesn't exist here
+  std::string proc_path(const std::string &path) const;
+
+  // moves from's memfd to to, dropping the one to held. false, doing
+  // nothing, if from doesn't exist
+  bool rename(const std::string &from, const std::string &to);
+  // false if path doesn't exist
+  bool unlink(const std::string &path);
+  // moves the regular file on disk at path (if there's one) into a memfd,
+  // removing it from disk. false if there wasn't one
+  bool import(const std::string &path);
+
+private:
+  // /proc/<orch's pid>/fd/
+  std::string fd_dir;
+  // path -> memfd
+  std::unordered_map<std::string, int> files;
+};
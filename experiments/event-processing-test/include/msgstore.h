@@ -0,0 +1,130 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "framing.h"
+
+// one message the proxy is holding back
+struct HeldMsg {
+  // where it starts in the stream of everything ever held for its link
+  uint64_t off;
+  uint32_t len;
+  // orchestrator step (see Proxy::set_step) it was completed at
+  uint64_t step;
+};
+
+// a uring buffer holding part of a link's stream
+struct HeldBuf {
+  // where its first byte is in the link's stream
+  uint64_t off;
+  uint32_t len;
+  uint16_t buf;
+};
+
+// Where the proxy keeps the messages it's holding back, per link (the proxied
+// fd they'll be sent on).
+//
+// Bytes go in as they arrive (add), and are cut into messages as the link's
+// framing finds where they end (scanned). Bytes past the last message are
+// held too, but can't be released until the rest of their message arrives.
+//
+// Each link gets fixed-size rings of descriptors, cut from slabs that only
+// grow when more links are open at once than ever before, so holding and
+// releasing a message never allocates. Bytes stay wherever the proxy engine
+// put them: a pipe the store owns (with_pipe), or uring buffers, listed in
+// order of where they are in the stream. Either way a link holds at most
+// MSGS_PER_LINK messages (and uring buffers), and (with a pipe) at most
+// byte_limit bytes, which only grows when one message needs more.
+class MsgStore {
+public:
+  static const size_t MSGS_PER_LINK = 256;
+
+  MsgStore();
+  ~MsgStore();
+
+  MsgStore(const MsgStore &) = delete;
+  MsgStore &operator=(const MsgStore &) = delete;
+
+  void open(int fd, bool with_pipe);
+  // forgets everything held for fd. uring buffers are the caller's to recycle
+  void close(int fd);
+  bool is_open(int fd) const { return link_idx(fd) >= 0; }
+
+  // number of whole messages held for fd (0 if it isn't open)
+  size_t count(int fd) const;
+  // bytes held for fd, whole messages or not (0 if it isn't open)
+  size_t bytes(int fd) const;
+  // most bytes fd can hold, or 0 if that depends on the uring buffers
+  size_t byte_limit(int fd) const;
+  // whether fd can't take another message
+  bool full(int fd) const;
+  // doubles fd's pipe, up to /proc/sys/fs/pipe-max-size, so a message that
+  // fills it can go on arriving. false if it can't get any bigger
+  bool grow(int fd);
+  // how many more messages fd can take
+  size_t room(int fd) const;
+
+  // write end of fd's pipe to add bytes to, and read end to release them from
+  int pipe_in(int fd) const;
+  int pipe_out(int fd) const;
+
+  // appends len bytes to fd's stream, held in uring buffer buf (or the pipe,
+  // if buf is -1)
+  void add(int fd, uint32_t len, int32_t buf);
+  // where fd's framing is in its stream, and how far it has got into the
+  // message in progress
+  uint64_t scanned(int fd) const;
+  FrameState *frame_state(int fd);
+  // moves fd's framing len bytes on. if that finishes a message, it's held as
+  // having arrived at step. fd can't be full
+  void scan(int fd, size_t len, bool done, uint64_t step);
+  // turns whatever has been scanned past the last message into one, e.g. when
+  // the rest of it will never come. returns false if there wasn't anything
+  bool flush(int fd, uint64_t step);
+
+  // i-th oldest message held for fd
+  const HeldMsg &at(int fd, size_t i) const;
+  const HeldMsg &front(int fd) const { return at(fd, 0); }
+  void pop(int fd);
+
+  // uring buffers held for fd, oldest first
+  size_t num_bufs(int fd) const;
+  const HeldBuf &buf_at(int fd, size_t i) const;
+  void pop_buf(int fd);
+
+  // every open fd, in no particular order
+  const std::vector<int> &fds() const { return open_fds; }
+
+private:
+  struct Link {
+    int fd;
+    // position of this link in open_fds
+    size_t pos;
+    // first message / buffer in its rings, and how many there are
+    size_t head, count;
+    size_t buf_head, buf_count;
+    size_t bytes, limit;
+    // end of everything added, of everything scanned, and of the last message
+    uint64_t next_off, scanned, framed;
+    FrameState frame;
+    int rd, wr;
+  };
+
+  // MSGS_PER_LINK message and buffer descriptors for each entry of links
+  std::vector<HeldMsg> slab;
+  std::vector<HeldBuf> buf_slab;
+  std::vector<Link> links;
+  std::vector<size_t> free_links;
+  // fd -> index into links, or -1
+  std::vector<int> fd_link;
+  std::vector<int> open_fds;
+
+  int link_idx(int fd) const {
+    return fd >= 0 && (size_t)fd < fd_link.size() ? fd_link[fd] : -1;
+  }
+  Link &get(int fd);
+  const Link &get(int fd) const;
+};
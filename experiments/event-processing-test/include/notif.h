@@ -0,0 +1,53 @@
+#pragma once
+
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Helpers for the seccomp user-notification (SECCOMP_RET_USER_NOTIF)
+// interception backend.
+//
+// With user notifications, a syscall the filter flags doesn't cause a ptrace
+// stop. Instead, the tracee blocks in the kernel and the orchestrator gets a
+// notification on a listener fd, which it can answer directly (return value,
+// errno, or an fd installed with SECCOMP_IOCTL_NOTIF_ADDFD). Anything that needs
+// registers rewritten still goes through ptrace, so a tracee can be waiting on
+// either mechanism.
+namespace Notif {
+
+// (in the child, before exec) installs the filter and hands the listener fd
+// to the parent through sock. listener is O_CLOEXEC, so the child's copy is
+// gone after exec
+void install_and_send(struct sock_fprog *prog, int sock);
+
+// (in the parent) receives the listener fd sent by install_and_send
+int recv_listener(int sock);
+
+// blocks until pid either hits a ptrace stop or has a pending notification on
+// listener. returns true if there's a notification, otherwise fills status as
+// waitpid would
+bool wait(pid_t pid, int listener, int *status);
+
+// receives the next notification. false if the target is gone
+bool recv(int listener, struct seccomp_notif *req);
+
+// whether the notification is still live (the target hasn't been killed or
+// interrupted). should be checked after touching the target's memory and
+// before acting on it
+bool id_valid(int listener, uint64_t id);
+
+// completes the syscall with val (error == 0) or -error
+bool respond(int listener, uint64_t id, int64_t val, int error);
+
+// lets the target actually perform the syscall
+bool respond_continue(int listener, uint64_t id);
+
+// installs srcfd in the target, at newfd if it's non-negative (replacing
+// whatever is there). if send, the target's syscall completes with the new fd
+// as the return value. returns the fd number in the target, or -1 with errno
+// set. on failure nothing has answered the notification
+int addfd(int listener, uint64_t id, int srcfd, uint32_t newfd_flags,
+          bool send, int newfd = -1);
+
+} // namespace Notif
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+
+#include "extents.h"
+
+// how copies of a node's files (fsync backups, crash restores) are made. each
+// falls back to the ones after it wherever the filesystem doesn't support it
+enum PersistMode {
+  // FICLONE reflinks (btrfs, xfs, ...). the copy shares the file's extents
+  // copy-on-write, so it costs about the same whatever the file's size
+  PM_REFLINK,
+  // copy_file_range, or sendfile on kernels without it. every byte is copied,
+  // but without leaving the kernel
+  PM_COPY_RANGE,
+  // read/write through a buffer in the orchestrator
+  PM_STREAM,
+};
+
+const char *persist_mode_name(PersistMode mode);
+
+// Copies files for a Filter::Manager. A method found not to work is never
+// tried again, so only the first copy pays for falling back.
+class Persister {
+public:
+  Persister(PersistMode mode = PM_REFLINK);
+
+  // makes dst (created or truncated) a copy of src. a missing src leaves dst
+  // empty. returns whether dst could be opened
+  bool copy_file(const std::string &src, const std::string &dst);
+  // brings dst up to date with src, where the two only differ in extents (and
+  // in size). returns false, having done nothing, if either is missing
+  bool copy_extents(const std::string &src, const std::string &dst,
+                    const ExtentSet &extents);
+
+  // the mode copies are being made with, once fallbacks are taken
+  PersistMode method() const;
+  // files copied with a reflink, and bytes copied any other way
+  uint64_t num_clones() const { return clones; }
+  uint64_t num_bytes_copied() const { return bytes_copied; }
+
+private:
+  bool no_reflink;
+  bool no_copy_range;
+  bool no_sendfile;
+
+  uint64_t clones;
+  uint64_t bytes_copied;
+
+  // whether dst_fd was made a reflink of src_fd
+  bool _reflink(int src_fd, int dst_fd);
+  // copies len bytes at off in src_fd to the same offset in dst_fd, stopping
+  // early if src_fd ends first
+  void _copy(int src_fd, int dst_fd, off_t off, size_t len);
+};
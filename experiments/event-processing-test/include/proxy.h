@@ -7,16 +7,27 @@
 #include <syscall.h>
 
 #include <deque>
-#include <set>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
 
+#include "conntable.h"
 #include "fdmap.h"
-
-enum Status {
-  CONNECTING,
-  CONNECTED,
+#include "framing.h"
+#include "msgstore.h"
+#include "transport.h"
+#include "uring.h"
+
+// how the proxy does its I/O
+enum ProxyEngine {
+  // epoll, then a syscall per accept/recv/send. held messages are spliced
+  // through pipes
+  PE_EPOLL,
+  // io_uring, with multishot accepts and recvs into provided buffers, and the
+  // sends released between two waits submitted together. held messages stay
+  // in the buffer they arrived in
+  PE_URING,
 };
 
 // This ensures requests going to the proxy's address go to the node's address.
@@ -27,7 +38,9 @@ enum Status {
 class Proxy {
 public:
   Proxy(FdMap &fdmap, std::vector<sockaddr_in> actual_node_map,
-        std::vector<sockaddr_in> proxy_node_map, size_t num_clients);
+        std::vector<sockaddr_in> proxy_node_map, size_t num_clients,
+        ProxyEngine engine = PE_EPOLL, FrameKind frame_kind = FR_RAW,
+        Transport transport = TR_TCP);
 
   void set_alive(int idx);
 
@@ -38,19 +51,38 @@ public:
   // check for messages, blocking for a new message if needed
   bool poll_for_events(bool blocking);
 
-  // retrieves all inbound fds for a given node that have waiting messages
-  std::vector<int> get_fds_with_msgs(int idx);
+  // fills fds with all inbound fds for a given node that have waiting
+  // messages
+  void get_fds_with_msgs(int idx, std::vector<int> *fds);
 
-  // checks if fd has more to send
+  // checks if fd has another whole message to send
   bool has_more(int fd);
+  // number of whole messages waiting to be sent on fd
+  size_t num_msgs(int fd);
 
-  // send the next message waiting to be sent on the given fd. notifies
+  // send the next whole message waiting to be sent on the given fd. notifies
   // orchestrator if it should wait extra for closed connection
   bool allow_next_msg(int fd);
 
+  // blocks until everything sent by allow_next_msg has been acked, i.e. is
+  // sitting in the destination's receive queue, so the destination sees it as
+  // soon as it runs. (PE_EPOLL) a send that filled its socket isn't waited
+  // for, only pushed along
+  void wait_delivered();
+
+  // tags messages that arrive from now on as arriving at step
+  void set_step(uint64_t new_step) { step = new_step; }
+
+  // whether a message has come in that's bigger than the proxy can hold. it
+  // can never be released, so the run can't go on
+  bool msg_too_big() const { return too_big; }
+
   void print_state();
 
 private:
+  ProxyEngine engine;
+  Transport transport;
+
   // track if each node is alive
   std::unordered_map<int, bool> node_alive;
 
@@ -62,26 +94,121 @@ private:
   std::vector<sockaddr_in> actual_node_map;
   // address for each of the proxies
   std::vector<sockaddr_in> proxy_node_map;
+  // what to connect to for each node's actual address, under transport
+  std::vector<sockaddr_storage> node_connect_addrs;
+  std::vector<socklen_t> node_connect_lens;
 
   FdMap &fdmap;
 
-  // status of all fds
-  std::unordered_map<int, Status> fd_status;
-  // all inbound fds for a given destination node
-  std::unordered_map<int, std::set<int>> inbound_fds;
-  // fd -> destination node idx
-  std::unordered_map<int, int> fd_to_node;
-  // fd -> proxied fd (2-way)
-  std::unordered_map<int, int> related_fd;
-
-  // fd -> queue of messages
-  std::unordered_map<int, std::deque<std::vector<char>>> waiting_msgs;
+  // role, destination node and proxied fd of every fd
+  ConnTable conns;
+
+  // fd -> messages held back from it
+  MsgStore held_msgs;
+  uint64_t step;
+  // where messages end in what's held
+  std::unique_ptr<Framing> framing;
+  // (PE_EPOLL) what's waiting on a socket, copied out to be framed before
+  // it's spliced. empty if the framing doesn't look at bytes
+  std::vector<char> peek_buf;
+  // see msg_too_big
+  bool too_big;
+  // fds sent on since the last wait_delivered
+  std::unordered_set<int> unacked_fds;
+  // (PE_EPOLL) fd -> bytes of released messages still in its pipe, because
+  // its socket was full. they go out from epoll_poll once it has room
+  std::unordered_map<int, size_t> unsent;
+
+  // accepted before the node that connected had been seen connecting (see
+  // FdMap::proxy_accept_fd), so not yet known who they're from
+  struct Unclaimed {
+    int fd;
+    // listener it came in on
+    int listener;
+    sockaddr_in addr;
+  };
+  std::vector<Unclaimed> unclaimed;
+
+  // (PE_URING)
+  std::unique_ptr<Uring> ring;
+  // part of a buffer still to be sent: bytes off up to len
+  struct Sending {
+    uint16_t buf;
+    size_t off, len;
+  };
+  // fd -> released messages not yet fully sent. only the front is submitted,
+  // so messages on one fd go out in order
+  std::unordered_map<int, std::deque<Sending>> sending;
+  size_t num_sending;
+  // buffer -> how many held messages and sends it's still part of
+  std::vector<uint16_t> buf_refs;
+  // fds whose recv stopped because every buffer was held. rearmed once one
+  // is recycled
+  std::unordered_set<int> starved_fds;
+  // completions reaped while waiting for sends, handled at the next poll
+  std::deque<struct io_uring_cqe> deferred;
 
   int create_listen(int idx);
   std::vector<std::pair<int, int>> stop_node(int idx);
 
-  void register_fd(int fd);
+  // starts tracking (and polling) fd. node is the node a listener is for, or
+  // where a connection's held messages go. a CONNECTING fd is only read from
+  // once finish_connect says it's connected
+  void register_fd(int fd, ConnRole role, int node,
+                   Status status = CONNECTED);
   void unregister_fd(int fd,
                      std::vector<std::pair<int, int>> *related_nodes = nullptr);
   void link_fds(int fd1, int fd2);
+  // drops everything held for fd
+  void close_queue(int fd);
+  // moves whatever has arrived on conn_fd (up to what to_fd's queue has room
+  // for) into to_fd's queue. returns bytes moved, 0 on EOF, or -1 (with errno
+  // set, EMSGSIZE if one message won't fit however much is released)
+  ssize_t hold_msg(int conn_fd, int to_fd);
+  // frames len bytes of what's held for fd, starting where the last call
+  // stopped. returns how many it got through before fd filled up
+  size_t frame(int fd, const char *data, size_t len);
+  // (PE_URING) frames as much as it can of what's held for fd in buffers
+  void frame_bufs(int fd);
+  // holds whatever fd has of a message that was cut off, as a message
+  void flush_partial(int fd);
+  // waits for fd's send queue to empty. returns false if it took too long
+  bool wait_acked(int fd);
+  // takes fromfd, just accepted by listener my_idx from addr. it's set up
+  // right away if the node that connected is known, or else put in unclaimed.
+  // returns false if it was dropped or put aside
+  bool accept_conn(int my_idx, int fromfd, sockaddr_in addr);
+  // sets up what's in unclaimed that can be now. returns true if any was
+  bool claim_unclaimed();
+  // sets up a proxied connection from node idx on fromfd, by connecting to
+  // node my_idx. returns false if it was dropped
+  bool open_conn(int my_idx, int fromfd, int idx);
+  // starts fd's (non-blocking) connect to node, which finish_connect ends
+  void start_connect(int fd, int node);
+  // err is the connect's errno, or 0 if it worked
+  void finish_connect(int fd, int err);
+
+  bool epoll_poll(bool blocking);
+  // one read from conn_fd into its peer's link. false if nothing could be
+  // read, because the link is full or nothing is waiting. once the sender has
+  // closed, conn_fd is unregistered, with any partial message flushed
+  bool epoll_recv(int conn_fd);
+  // sends len more bytes of fd's pipe, after anything unsent, as far as its
+  // socket takes them. whatever's left waits for EPOLLOUT
+  void epoll_send(int fd, size_t len);
+  bool uring_poll(bool blocking);
+  // (PE_URING) starts the multishot accept/recv on fd
+  void uring_arm(int fd, bool listener);
+  void uring_send(int fd);
+  // handles one completion. returns true if it was an accept or message (or
+  // one too big to hold)
+  bool uring_complete(const struct io_uring_cqe &cqe);
+  // reaps completions until fd (or every fd, if -1) has nothing left sending
+  void uring_wait_sent(int fd);
+  // whether a buffer can still come back: something is sending, or holds a
+  // whole message to release. if not, every buffer is part of one unfinished
+  // message
+  bool can_free_bufs() const;
+  // drops a reference to buf, recycling it if it was the last
+  void recycle_buf(uint16_t buf);
 };
\ No newline at end of file
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// A set of the nodes (or clients) that can be run next, as a bitset over the
+// indices [base, base + capacity). Members are kept in increasing order, so
+// nth(k) is the same member *std::next(set.begin(), k) would be for a
+// std::set, and a decider picks the same one from the same random number
+// either way.
+class RunSet {
+public:
+  RunSet(int base, size_t capacity);
+
+  void insert(int idx);
+  void erase(int idx);
+  bool contains(int idx) const;
+
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+
+  // the k-th smallest member (k < size()). a popcount per 64 members, so
+  // constant time for any cluster up to 64 wide
+  int nth(size_t k) const;
+  // fills out with every member, smallest first
+  void members(std::vector<int> *out) const;
+
+private:
+  int base;
+  size_t capacity;
+  size_t count;
+  std::vector<uint64_t> words;
+
+  // the bit for idx, exiting if it's out of range
+  size_t _bit(int idx) const;
+};
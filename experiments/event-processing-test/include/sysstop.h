@@ -0,0 +1,125 @@
+#pragma once
+
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/user.h>
+
+#include <vector>
+
+// Decoded registers of a tracee at a syscall stop (seccomp, entry or exit).
+//
+// All registers are fetched with one PTRACE_GETREGS the first time anything
+// is asked for, and cached for the rest of the stop. Changes are kept in the
+// cache and only the registers that changed are written back, on flush or
+// when resuming through to_exit. Whoever resumes the tracee some other way
+// must flush before and call next_stop after.
+class SyscallStop {
+public:
+  SyscallStop();
+
+  void attach(pid_t new_pid);
+  void detach();
+
+  // forget the cached registers. must be called whenever the tracee has run
+  void next_stop();
+
+  long nr();
+  // i-th syscall argument (0-5, in seccomp_data order)
+  uint64_t arg(int i);
+  long ret();
+
+  void set_nr(long nr);
+  void set_arg(int i, uint64_t val);
+  void set_ret(long ret);
+
+  // for anything not covered above
+  const struct user_regs_struct &regs();
+  void set_regs(const struct user_regs_struct &new_regs);
+
+  // writes back any registers that changed
+  void flush();
+
+  // flushes, then runs the tracee to the exit stop of the current syscall.
+  // returns false if it stopped (or died) some other way. either way, status
+  // is filled as by waitpid
+  bool to_exit(int *status);
+
+private:
+  pid_t pid;
+  bool loaded;
+  // bit i is set if the i-th word of cached has changed
+  uint32_t dirty;
+  struct user_regs_struct cached;
+
+  void load();
+  void set_word(size_t word, uint64_t val);
+};
+
+// how the seccomp filter gets a syscall to the orchestrator
+enum SyscallRoute {
+  // always a ptrace stop
+  SR_TRACE,
+  // a user notification if notifications are on, otherwise a ptrace stop
+  SR_NOTIFY,
+  // a ptrace stop, but only if its fd (first argument) is at or above the
+  // tracked fd base. anything else goes through untouched
+  SR_TRACKED_FD,
+};
+
+// syscall numbers are all below this on x86_64
+const size_t SYSCALL_MAX = 512;
+
+// maps a syscall number to its entry in an intercept table, so dispatching a
+// stop is a single lookup
+struct SyscallIndex {
+  // entry index + 1, or 0 if not intercepted
+  uint16_t slots[SYSCALL_MAX];
+
+  constexpr int find(long nr) const {
+    return (nr < 0 || (size_t)nr >= SYSCALL_MAX) ? -1 : (int)slots[nr] - 1;
+  }
+};
+
+// builds the index for a table of entries with an nr field
+template <typename Entry, size_t N>
+constexpr SyscallIndex make_syscall_index(const Entry (&table)[N]) {
+  SyscallIndex index{};
+  for (size_t i = 0; i < N; i++) {
+    index.slots[table[i].nr] = i + 1;
+  }
+  return index;
+}
+
+// builds the seccomp program for a table of entries with nr and route fields
+template <typename Entry, size_t N>
+std::vector<struct sock_filter>
+build_seccomp_filter(const Entry (&table)[N], bool notify,
+                     uint32_t tracked_fd_base) {
+  std::vector<struct sock_filter> filter;
+  filter.push_back(
+      BPF_STMT(BPF_LD + BPF_W + BPF_ABS, offsetof(struct seccomp_data, nr)));
+  for (const Entry &entry : table) {
+    if (entry.route == SR_TRACKED_FD) {
+      // both branches return, so clobbering nr is fine. the low half of
+      // args[0] is the int fd (little endian)
+      filter.push_back(BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, entry.nr, 0, 4));
+      filter.push_back(BPF_STMT(BPF_LD + BPF_W + BPF_ABS,
+                                offsetof(struct seccomp_data, args[0])));
+      filter.push_back(
+          BPF_JUMP(BPF_JMP + BPF_JGE + BPF_K, tracked_fd_base, 0, 1));
+      filter.push_back(BPF_STMT(BPF_RET + BPF_K, SECCOMP_RET_TRACE));
+      filter.push_back(BPF_STMT(BPF_RET + BPF_K, SECCOMP_RET_ALLOW));
+      continue;
+    }
+    bool to_notify = notify && entry.route == SR_NOTIFY;
+    filter.push_back(BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, entry.nr, 0, 1));
+    filter.push_back(BPF_STMT(BPF_RET + BPF_K, to_notify
+                                                   ? SECCOMP_RET_USER_NOTIF
+                                                   : SECCOMP_RET_TRACE));
+  }
+  filter.push_back(BPF_STMT(BPF_RET + BPF_K, SECCOMP_RET_ALLOW));
+  return filter;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <set>
+#include <utility>
+#include <vector>
+
+// deadline of a node that would wait forever (a poll with no timeout)
+const uint64_t TIMER_NEVER = UINT64_MAX;
+
+// The virtual times idle nodes will wake up at, soonest first.
+//
+// A node is armed while it sits in a poll, with the vtime (in ns, see
+// vclock.h) its poll would time out at, or its own current vtime once a
+// message is waiting for it and the poll would return at once. Nodes all
+// start from the same vtime and only move theirs forward while they run, so
+// running the one armed earliest is a discrete-event simulation: whenever
+// every node is idle, time jumps straight to the next thing that can happen,
+// instead of nodes taking turns timing out polls.
+class TimerQueue {
+public:
+  TimerQueue(size_t num_nodes);
+
+  // (re)arms node to wake at deadline
+  void arm(int node, uint64_t deadline);
+  // the node is running, dead, or otherwise not waiting on a timer
+  void disarm(int node);
+
+  bool armed(int node) const { return deadlines[node] != UNARMED; }
+  uint64_t deadline(int node) const { return deadlines[node]; }
+  size_t size() const { return queue.size(); }
+  bool empty() const { return queue.empty(); }
+
+  // the node armed earliest (the lowest one of any tied), or -1 if none is
+  int earliest() const;
+
+private:
+  // not a deadline anyone can be armed with, since TIMER_NEVER is one
+  static const uint64_t UNARMED = 0;
+
+  // (deadline, node), so the earliest (lowest node on ties) comes first
+  std::set<std::pair<uint64_t, int>> queue;
+  // each node's deadline in queue, or UNARMED
+  std::vector<uint64_t> deadlines;
+};
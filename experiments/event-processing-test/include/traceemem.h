@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Bulk access to a stopped tracee's memory.
+//
+// Reads and writes go through process_vm_readv / process_vm_writev so that a
+// whole buffer (or several) costs a single syscall instead of one
+// PTRACE_PEEKTEXT / PTRACE_POKETEXT per word. Anything those can't handle
+// (e.g. pages that are read-only in the tracee) falls back to /proc/pid/mem,
+// which ptrace attachment lets us write through.
+//
+// Strings read from the tracee are cached until the next call to next_stop(),
+// so a manager can look at the same path argument multiple times within a
+// single syscall stop for free.
+class TraceeMemory {
+public:
+  TraceeMemory();
+  ~TraceeMemory();
+
+  TraceeMemory(const TraceeMemory &other);
+  TraceeMemory &operator=(const TraceeMemory &other);
+
+  // start operating on the given pid. /proc/pid/mem is bound to the address
+  // space at open time, so it is only opened lazily (after any exec)
+  void attach(pid_t pid);
+  void detach();
+
+  // tracee has been resumed, so anything cached may be stale
+  void next_stop();
+
+  // copy exactly len bytes between the tracee at addr and a local buffer
+  void read(void *out, uint64_t addr, size_t len);
+  void write(const void *in, uint64_t addr, size_t len);
+
+  // scatter/gather versions. local[i] is paired with remote[i], and both must
+  // have the same length
+  void readv(const std::vector<struct iovec> &local,
+             const std::vector<struct iovec> &remote);
+  void writev(const std::vector<struct iovec> &local,
+              const std::vector<struct iovec> &remote);
+
+  // read a NUL-terminated string of at most max_len bytes (including the NUL)
+  const std::string &read_string(uint64_t addr, size_t max_len);
+
+private:
+  pid_t pid;
+  // lazily opened /proc/pid/mem, -1 if not opened yet
+  int mem_fd;
+  // tracee addr -> string read at that addr during the current stop
+  std::unordered_map<uint64_t, std::string> str_cache;
+
+  int get_mem_fd();
+  // moves n paired iovecs in one syscall, falling back for the remainder
+  void transfer(bool is_write, const struct iovec *local,
+                const struct iovec *remote, size_t n);
+  void fallback_read(char *out, uint64_t addr, size_t len);
+  void fallback_write(const char *in, uint64_t addr, size_t len);
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// A thread that owns one tracee.
+//
+// ptrace only takes requests from the thread that attached (for us, the one
+// that forked the tracee), so once a manager lives on a Tracer, everything
+// that touches its tracee has to be run through it. Jobs run one at a time,
+// in the order they were given.
+class Tracer {
+public:
+  Tracer();
+  ~Tracer();
+
+  Tracer(const Tracer &) = delete;
+  Tracer &operator=(const Tracer &) = delete;
+
+  // runs job on the tracer thread, and waits for it to finish
+  void run(std::function<void()> job);
+  // starts job on the tracer thread without waiting for it. waits for the
+  // previous job first, if it's still running
+  void post(std::function<void()> job);
+  // waits for the current job (if any) to finish
+  void wait();
+
+private:
+  std::mutex lock;
+  // signalled whenever a job is posted or finishes
+  std::condition_variable changed;
+  std::function<void()> job;
+  bool has_job;
+  bool stopping;
+  std::thread thread;
+
+  void loop();
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <netinet/ip.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#include "sysstop.h"
+#include "traceemem.h"
+
+// how nodes, clients and the proxy reach each other
+enum Transport {
+  // TCP, over the loopback addresses orch is given
+  TR_TCP,
+  // AF_UNIX stream sockets in the abstract namespace. nodes and clients still
+  // make AF_INET sockets and use AF_INET addresses, but the sockets they get
+  // are unix ones, and every address they use is swapped for a name standing
+  // in for it. the addresses are only ever names, so they don't have to be
+  // free (or even exist) on the host
+  TR_UNIX,
+};
+
+// The same AF_INET address gets a different unix name depending on who has it
+// (the proxy and a node both listen on a node's address, for one), so each
+// name says which.
+enum UnixRole {
+  // the proxy's listener for a node's advertised address (old_addr)
+  UR_PROXY = 'p',
+  // a node's own listener (what its bind was redirected to)
+  UR_NODE = 'n',
+  // the connecting end of a connection, named so that whoever accepts it can
+  // tell who it is, the way it would from a TCP source address
+  UR_PEER = 'c',
+};
+
+// fills name with the name standing in for addr in role, returns its length.
+// names are unique to this orch, so any number can run on one host
+socklen_t unix_name(UnixRole role, const struct sockaddr_in &addr,
+                    struct sockaddr_un *name);
+// the AF_INET address addr (of len bytes) is or stands in for. unnamed unix
+// sockets (or names from anyone else) come out as 0.0.0.0:0, like an unbound
+// AF_INET socket
+struct sockaddr_in as_inet(const struct sockaddr_storage &addr, socklen_t len);
+// a port no UR_PEER name has had for a while, to stand in for the ephemeral
+// port a TCP socket would have been given. they come round again, so one can
+// still be bound (see tracee_bind_ephemeral). safe from any thread
+in_port_t unix_ephemeral_port();
+
+// a new stream socket for tr, with type flags (SOCK_NONBLOCK etc.)
+int transport_socket(Transport tr, int flags);
+// binds fd (from transport_socket) to addr, as role under TR_UNIX. exits if
+// it can't
+void transport_bind(Transport tr, int fd, UnixRole role,
+                    const struct sockaddr_in &addr);
+// fills out with what to connect to to reach addr (as role under TR_UNIX),
+// returns its length
+socklen_t transport_addr(Transport tr, UnixRole role,
+                         const struct sockaddr_in &addr,
+                         struct sockaddr_storage *out);
+
+// a copy of a tracee's fd (sharing its open file), pulled over with
+// pidfd_getfd, or -1 with errno set
+int tracee_fd(pid_t pid, int fd);
+// the address a tracee's fd is bound to (its end of a connection), and the
+// address of the other end, found through a copy from tracee_fd. unix names
+// are given as what they stand in for. exits if they can't be had
+struct sockaddr_in tracee_sockname(pid_t pid, int fd);
+struct sockaddr_in tracee_peername(pid_t pid, int fd);
+// binds a tracee's (unix) fd to the name for addr in role. returns 0, or
+// -errno as the tracee's bind would have
+int tracee_bind(pid_t pid, int fd, UnixRole role,
+                const struct sockaddr_in &addr);
+// tracee_bind as UR_PEER on addr with a fresh port, moving on to the next
+// while the name is still bound. fills in addr's port. returns 0, -errno, or
+// -EADDRNOTAVAIL if every port is taken
+int tracee_bind_ephemeral(pid_t pid, int fd, struct sockaddr_in *addr);
+
+// The rest run a tracee's syscall under TR_UNIX. Each is called at the
+// syscall's seccomp stop, runs it through to_exit (and so returns and fills
+// status the same way), and leaves its arguments as the tracee passed them.
+
+// socket(AF_INET, SOCK_STREAM, ...) made as AF_UNIX instead
+bool unix_socket(SyscallStop &stop, int *status);
+// connect, with an AF_INET address swapped for the proxy's name for it. the
+// socket is named as coming from a fresh port on from first, so the proxy can
+// tell which fd it's accepting, and if that fails so does the connect. a
+// name is written to the tracee's stack, below the red zone
+bool unix_connect(pid_t pid, SyscallStop &stop, TraceeMemory &mem,
+                  struct in_addr from, int *status);
+// (unlike the rest, only at the seccomp stop) setsockopt or getsockopt on a
+// socket made AF_UNIX. IPPROTO_TCP options mean nothing to it, so they're
+// skipped instead of failing with EOPNOTSUPP: sets succeed, and gets read
+// back zeroed. returns whether the syscall was skipped
+bool unix_sockopt(SyscallStop &stop, TraceeMemory &mem);
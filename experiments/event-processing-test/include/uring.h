@@ -0,0 +1,63 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A bare io_uring: the submission and completion rings, plus one ring of
+// provided buffers for recvs to land in.
+//
+// Entries are queued with get_sqe and only handed to the kernel on submit, so
+// everything queued between two submits costs one io_uring_enter.
+class Uring {
+public:
+  Uring(unsigned entries);
+  ~Uring();
+
+  Uring(const Uring &) = delete;
+  Uring &operator=(const Uring &) = delete;
+
+  // next free submission entry, zeroed. submits what's queued if the ring is
+  // full
+  struct io_uring_sqe *get_sqe();
+  // hands everything queued to the kernel. if wait, also blocks for at least
+  // one completion
+  void submit(bool wait);
+
+  // next completion, or nullptr if there's none. each one has to be let go of
+  // with seen() before the next peek
+  struct io_uring_cqe *peek();
+  void seen();
+
+  // registers num (a power of 2) buffers of size bytes as buffer group
+  // group, for requests with IOSQE_BUFFER_SELECT
+  void setup_bufs(uint16_t group, unsigned num, size_t size);
+  char *buf(uint16_t bid);
+  size_t buf_size() const { return bufs_size; }
+  // gives a buffer the kernel picked back to the buffer ring
+  void recycle_buf(uint16_t bid);
+
+private:
+  int ring_fd;
+
+  // submission ring
+  void *sq_ptr;
+  size_t sq_len;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  struct io_uring_sqe *sqes;
+  size_t sqes_len;
+  unsigned sq_entries;
+  // entries handed out by get_sqe but not yet submitted
+  unsigned to_submit;
+
+  // completion ring (shares sq_ptr's mapping)
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  // provided buffers
+  struct io_uring_buf_ring *buf_ring;
+  size_t buf_ring_len;
+  char *bufs;
+  size_t bufs_size;
+  unsigned bufs_num;
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#include <string>
+
+// Virtual clock shared between the orchestrator and a node through a memfd.
+//
+// Normally every clock_gettime/gettimeofday a node makes traps into the
+// orchestrator, which answers with the node's vtime. With a shared clock, the
+// node is started with libvclock.so preloaded, which maps the page and answers
+// those calls itself. The orchestrator keeps the page in sync with vtime
+// whenever the node isn't running, and reads back whatever the node did to it
+// once the node stops again.
+//
+// Every read ticks the clock forward by step_ns before returning it, which is
+// exactly what a trap does, so the node sees the same times either way.
+
+// layout of the shared page
+struct VClockPage {
+  // current virtual time, in nanoseconds
+  uint64_t now_ns;
+  // how far each read moves the clock
+  uint64_t step_ns;
+};
+
+namespace VClock {
+
+// environment variable telling the shim which fd the page is on
+const char *const FD_ENV = "VCLOCK_FD";
+// where the page ends up in the node. high enough that the node's own fds
+// are numbered the same as without it, and just under Filter::TRACKED_FD_BASE,
+// so it's never taken for a tracked fd and its syscalls never stop
+const int NODE_FD = 511;
+
+// (in the orchestrator) creates the memfd backing a page, and maps it into
+// page. the fd is O_CLOEXEC, so it has to be dup2'd to NODE_FD before exec
+int create(VClockPage **page);
+
+// (in the child, before exec) puts the page at NODE_FD and points the shim
+// at it. once the shim has mapped it, it closes the fd on exec and drops the
+// variable, so the node's own children don't share the page
+void prepare_node(int fd, const std::string &shim);
+
+uint64_t to_ns(const struct timespec &ts);
+struct timespec from_ns(uint64_t ns);
+
+} // namespace VClock
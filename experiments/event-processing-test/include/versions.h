@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// one version of a file, by its interned path
+struct FileVersion {
+  int file;
+  int version;
+
+  bool operator==(const FileVersion &other) const {
+    return file == other.file && version == other.version;
+  }
+};
+
+// a rename that's happened in the node but not yet to the backups
+struct RenameOp {
+  // ops are numbered from 1, in the order they happened
+  size_t idx;
+  FileVersion src;
+  FileVersion dst;
+};
+
+// The renames of a node's files that are still pending, and what they mean
+// for its backups.
+//
+// A rename makes a new version of its destination out of the current version
+// of its source, so pending renames chain versions back to the one whose
+// backup holds their data (their root). Paths are interned to ids, each
+// version keeps the op that made it, and root lookups are path compressed,
+// so neither finding a root nor flushing a directory scans the pending ops,
+// compares paths or allocates.
+class VersionGraph {
+public:
+  VersionGraph();
+
+  // the id of path, interning it (and its directory) if it's new
+  int intern(const std::string &path);
+  // the id of path, or -1 if it's never been interned
+  int find(const std::string &path) const;
+  const std::string &path(int file) const { return paths[file]; }
+
+  // registers a rename of src to dst, returning its idx
+  size_t add(FileVersion src, FileVersion dst);
+  // the oldest pending op (there must be one), and dropping it once it's been
+  // done to the backups
+  const RenameOp &front() const { return pending.front(); }
+  void pop_front();
+
+  size_t size() const { return pending.size(); }
+  bool empty() const { return pending.empty(); }
+  const std::deque<RenameOp> &ops() const { return pending; }
+  // idx of the last op done (popped)
+  size_t done() const { return ops_done; }
+
+  // the version whose backup fv's data is in, following pending renames back
+  FileVersion root(FileVersion fv);
+  // whether a pending op still needs fv's backup: moves it, or makes fv
+  bool pending_on(FileVersion fv) const {
+    return moves.count(_key(fv)) > 0 || links.count(_key(fv)) > 0;
+  }
+  // idx of the newest op still pending into or out of a direct child of dir,
+  // or at most done() if none is
+  size_t last_op_in(int dir) const;
+
+  // drops every pending op (paths stay interned)
+  void clear();
+
+private:
+  std::unordered_map<std::string, int> ids;
+  std::vector<std::string> paths;
+  // each file's directory, or -1 for /
+  std::vector<int> dirs;
+  // for each directory, the idx of the newest op on any of its children
+  std::vector<size_t> dir_last_op;
+
+  std::deque<RenameOp> pending;
+  size_t ops_done;
+  size_t op_count;
+
+  // how a version came from a pending op
+  struct Link {
+    // the op's source, and the idx of the op
+    uint64_t src;
+    size_t op;
+    // further back along the chain, where it was last found to end, valid
+    // while jump_op (the oldest op on the way) is still pending
+    uint64_t jump;
+    size_t jump_op;
+  };
+  // keyed by _key of the version each op made
+  std::unordered_map<uint64_t, Link> links;
+  // _key of each version a pending op moves -> how many do
+  std::unordered_map<uint64_t, size_t> moves;
+
+  static uint64_t _key(FileVersion fv) {
+    return ((uint64_t)(uint32_t)fv.file << 32) | (uint32_t)fv.version;
+  }
+  static FileVersion _version(uint64_t key) {
+    return {(int)(key >> 32), (int)(uint32_t)key};
+  }
+};
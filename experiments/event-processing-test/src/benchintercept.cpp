@@ -0,0 +1,122 @@
+#include <arpa/inet.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "fdmap.h"
+#include "filter.h"
+
+// Compares how many intercepted syscalls per second each Filter::Backend can
+// get through. The tracee is this same binary, run with --tracee, which just
+// hammers the syscalls Raft nodes make the most (the clock and randomness).
+// The ptrace backend is run both ways --emulate can go (entry, where each of
+// these is one stop, and exit, where it's two), and with the shared virtual
+// clock (libvclock.so, which has to be built next to this binary), where clock
+// reads don't trap.
+//
+// Usage: ./benchintercept [num_iters]
+// orchestrator logging goes to stdout, so redirect it somewhere
+
+static const int DEFAULT_ITERS = 20000;
+// each iteration does this many clock_gettimes, and one of each of the others
+static const int CLOCKS_PER_ITER = 8;
+
+static int run_tracee(int iters) {
+  struct timespec ts;
+  struct timeval tv;
+  char buf[32];
+  for (int i = 0; i < iters; i++) {
+    for (int j = 0; j < CLOCKS_PER_ITER; j++) {
+      // through libc, so the shared clock gets a chance to answer. the vDSO
+      // is disabled, so otherwise these are syscalls
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+    }
+    gettimeofday(&tv, nullptr);
+    syscall(SYS_getrandom, buf, sizeof(buf), 0);
+  }
+  return 0;
+}
+
+static double run_backend(Filter::Backend backend, bool emulate_at_entry,
+                          std::string vclock_shim, std::string self,
+                          int iters) {
+  FdMap fdmap(1, 0);
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  std::vector<std::string> command = {self, "--tracee", std::to_string(iters)};
+  std::mt19937 rng(244);
+
+  auto start = std::chrono::steady_clock::now();
+  Filter::Manager manager(0, command, addr, addr, fdmap, "/nonexistent/", true,
+                          backend, emulate_at_entry, vclock_shim);
+  while (true) {
+    Filter::Event ev = manager.to_next_event();
+    if (ev == Filter::EV_EXIT) {
+      break;
+    } else if (ev == Filter::EV_RANDOM) {
+      manager.handle_getrandom(ev, [&](void *buf, size_t buf_len) -> void {
+        for (size_t i = 0; i < buf_len; i += 4) {
+          *(int *)((char *)buf + i) = rng();
+        }
+      });
+    } else if (ev == Filter::EV_WRITE) {
+      manager.handle_write(ev, [](size_t max_write) { return max_write; });
+    } else {
+      fprintf(stderr, "unexpected event %d from tracee\n", ev);
+      exit(1);
+    }
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+int main(int argc, char **argv) {
+  if (argc == 3 && strcmp(argv[1], "--tracee") == 0) {
+    return run_tracee(atoi(argv[2]));
+  }
+  int iters = argc > 1 ? atoi(argv[1]) : DEFAULT_ITERS;
+
+  char self[PATH_MAX];
+  ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+  if (len < 0) {
+    perror("readlink");
+    return 1;
+  }
+  self[len] = '\0';
+
+  long total = (long)iters * (CLOCKS_PER_ITER + 2);
+  std::string dir(self);
+  std::string shim = dir.substr(0, dir.rfind('/') + 1) + "libvclock.so";
+
+  fprintf(stderr, "%-14s %10s %10s %14s\n", "backend", "syscalls", "secs",
+          "syscalls/sec");
+  for (bool at_entry : {false, true}) {
+    double secs = run_backend(Filter::BK_PTRACE, at_entry, "", self, iters);
+    fprintf(stderr, "%-14s %10ld %10.3f %14.0f\n",
+            at_entry ? "ptrace (entry)" : "ptrace (exit)", total, secs,
+            total / secs);
+  }
+  {
+    double secs = run_backend(Filter::BK_NOTIF, false, "", self, iters);
+    fprintf(stderr, "%-14s %10ld %10.3f %14.0f\n", "notif", total, secs,
+            total / secs);
+  }
+  if (access(shim.c_str(), R_OK) == 0) {
+    double secs = run_backend(Filter::BK_PTRACE, true, shim, self, iters);
+    fprintf(stderr, "%-14s %10ld %10.3f %14.0f\n", "ptrace+vclock", total,
+            secs, total / secs);
+  }
+  return 0;
+}
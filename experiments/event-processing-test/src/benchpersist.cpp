@@ -0,0 +1,118 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "persist.h"
+
+// Compares what an fsync-heavy node costs the orchestrator under each
+// PersistMode, and under the iostream copy backups used to be made with. A
+// log file is grown to each size, then gets an append and an fsync backup
+// (the whole file copied next to it, as Filter::Manager::backup_file does)
+// over and over, the way a Raft log does while entries are committed. The
+// dirty rows only copy each append into the backup, as --backups dirty does.
+//
+// Usage: ./benchpersist [dir] [fsyncs_per_size]
+// dir should be on the filesystem node dirs are (reflinks need btrfs, xfs,
+// ...). defaults to /tmp
+
+static const int DEFAULT_FSYNCS = 50;
+// bytes appended before each fsync
+static const size_t ENTRY_SIZE = 4096;
+static const size_t LOG_SIZES[] = {64 << 10, 1 << 20, 16 << 20, 64 << 20};
+
+static void append(const std::string &file, size_t len) {
+  int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+  if (fd < 0) {
+    perror("open");
+    exit(1);
+  }
+  std::vector<char> buf(ENTRY_SIZE, 'r');
+  while (len > 0) {
+    size_t n = len < buf.size() ? len : buf.size();
+    if (write(fd, buf.data(), n) != (ssize_t)n) {
+      perror("write");
+      exit(1);
+    }
+    len -= n;
+  }
+  close(fd);
+}
+
+static void stream_copy(const std::string &src, const std::string &dst) {
+  std::ifstream in(src, std::ios::binary);
+  std::ofstream out(dst, std::ios::binary);
+  out << in.rdbuf();
+}
+
+// secs per fsync of a log starting at log_size. mode < 0 is the iostream
+// copy
+static double run(const std::string &dir, int mode, bool dirty,
+                  size_t log_size, int fsyncs, std::string *method) {
+  std::string log = dir + "/benchpersist.log";
+  std::string backup = log + ".1.__bk";
+  unlink(log.c_str());
+  append(log, log_size);
+  Persister persist(mode < 0 ? PM_STREAM : (PersistMode)mode);
+  if (dirty) {
+    // where the backup would have been left by the last fsync
+    persist.copy_file(log, backup);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < fsyncs; i++) {
+    append(log, ENTRY_SIZE);
+    if (dirty) {
+      ExtentSet extents;
+      extents.add(log_size + i * ENTRY_SIZE, ENTRY_SIZE);
+      persist.copy_extents(log, backup, extents);
+    } else if (mode < 0) {
+      stream_copy(log, backup);
+    } else {
+      persist.copy_file(log, backup);
+    }
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  if (mode < 0) {
+    *method = "iostream";
+  } else {
+    *method = persist_mode_name(persist.method());
+  }
+  unlink(log.c_str());
+  unlink(backup.c_str());
+  return elapsed.count() / fsyncs;
+}
+
+int main(int argc, char **argv) {
+  std::string dir = argc > 1 ? argv[1] : "/tmp";
+  int fsyncs = argc > 2 ? atoi(argv[2]) : DEFAULT_FSYNCS;
+
+  fprintf(stderr, "%-9s %-9s %-9s %-6s %12s %12s\n", "log", "mode", "method",
+          "dirty", "ms/fsync", "MB/s");
+  for (size_t log_size : LOG_SIZES) {
+    for (int mode : {-1, (int)PM_STREAM, (int)PM_COPY_RANGE, (int)PM_REFLINK}) {
+      for (bool dirty : {false, true}) {
+        if (dirty && mode != PM_COPY_RANGE) {
+          continue;
+        }
+        std::string method;
+        double secs = run(dir, mode, dirty, log_size, fsyncs, &method);
+        // MB/s of log backed up, whatever was actually copied
+        fprintf(stderr, "%-9s %-9s %-9s %-6s %12.3f %12.0f\n",
+                (std::to_string(log_size >> 10) + "K").c_str(),
+                mode < 0 ? "-" : persist_mode_name((PersistMode)mode),
+                method.c_str(), dirty ? "yes" : "no", secs * 1000,
+                log_size / secs / (1 << 20));
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,238 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "chunkstore.h"
+
+namespace {
+uint64_t _rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+uint64_t _fmix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// a word at a time, murmur3 style. collisions only cost a compare
+uint64_t _hash(const char *data, size_t len) {
+  const uint64_t k1 = 0x87c37b91114253d5ULL;
+  const uint64_t k2 = 0x4cf5ad432745937fULL;
+  uint64_t h = len * k1;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t w;
+    memcpy(&w, data + i, 8);
+    h ^= _rotl(w * k1, 31) * k2;
+    h = _rotl(h, 27) * 5 + 0x52dce729;
+  }
+  uint64_t tail = 0;
+  memcpy(&tail, data + i, len - i);
+  h ^= _rotl(tail * k1, 31) * k2;
+  return _fmix(h);
+}
+
+// reads len bytes at off, fewer only at EOF
+size_t _read_at(int fd, char *buf, size_t len, uint64_t off) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = pread(fd, buf + done, len - done, off + done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0) {
+      fprintf(stderr, "[CHUNKS] read failed: %s\n", strerror(errno));
+      exit(1);
+    } else if (n == 0) {
+      break;
+    }
+    done += n;
+  }
+  return done;
+}
+
+void _write_at(int fd, const char *buf, size_t len, uint64_t off) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = pwrite(fd, buf + done, len - done, off + done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0) {
+      fprintf(stderr, "[CHUNKS] write failed: %s\n", strerror(errno));
+      exit(1);
+    }
+    done += n;
+  }
+}
+} // namespace
+
+ChunkStore::ChunkStore()
+    : lock(), chunks(), free_slots(), by_hash(), bytes(0), deduped(0) {}
+
+bool ChunkStore::put_file(const std::string &path, Manifest *m,
+                          const ExtentSet *changed) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  uint64_t size = 0;
+  if (fd < 0 && errno != ENOENT) {
+    return false;
+  } else if (fd >= 0) {
+    struct stat s;
+    if (fstat(fd, &s) < 0) {
+      fprintf(stderr, "[CHUNKS] fstat of %s failed: %s\n", path.c_str(),
+              strerror(errno));
+      exit(1);
+    }
+    size = s.st_size;
+  }
+  // a missing file is stored empty, like copying it would have left it
+
+  std::vector<uint32_t> out;
+  out.reserve((size + CHUNK_SIZE - 1) / CHUNK_SIZE);
+  std::string buf(CHUNK_SIZE, '\0');
+  for (uint64_t off = 0; off < size; off += CHUNK_SIZE) {
+    size_t i = off / CHUNK_SIZE;
+    size_t len = std::min((uint64_t)CHUNK_SIZE, size - off);
+    size_t old_len =
+        off < m->size ? std::min((uint64_t)CHUNK_SIZE, m->size - off) : 0;
+    if (changed != nullptr && len == old_len && !changed->overlaps(off, len)) {
+      std::lock_guard<std::mutex> guard(lock);
+      chunks[m->chunks[i]].refs++;
+      out.push_back(m->chunks[i]);
+      continue;
+    }
+    len = _read_at(fd, &buf[0], len, off);
+    if (len == 0) {
+      // shrank while being read
+      size = off;
+      break;
+    }
+    uint64_t hash = _hash(buf.data(), len);
+    std::lock_guard<std::mutex> guard(lock);
+    out.push_back(_intern(hash, buf.data(), len));
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+
+  std::lock_guard<std::mutex> guard(lock);
+  for (uint32_t slot : m->chunks) {
+    _unref(slot);
+  }
+  m->chunks.swap(out);
+  m->size = size;
+  return true;
+}
+
+bool ChunkStore::get_file(const Manifest &m, const std::string &path,
+                          const ExtentSet *changed) {
+  int flags = O_WRONLY | O_CLOEXEC;
+  if (changed == nullptr) {
+    flags |= O_CREAT | O_TRUNC;
+  }
+  int fd = open(path.c_str(), flags, 0666);
+  if (fd < 0) {
+    return false;
+  }
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  if (changed != nullptr) {
+    changed->clipped(m.size, &ranges);
+  } else if (m.size > 0) {
+    ranges.push_back({0, m.size});
+  }
+  {
+    // chunks can't move while they're being written out
+    std::lock_guard<std::mutex> guard(lock);
+    for (const auto &range : ranges) {
+      uint64_t end = range.first + range.second;
+      for (uint64_t off = range.first; off < end;) {
+        const Chunk &chunk = chunks[m.chunks[off / CHUNK_SIZE]];
+        size_t within = off % CHUNK_SIZE;
+        size_t len = std::min(chunk.data.size() - within, end - off);
+        _write_at(fd, chunk.data.data() + within, len, off);
+        off += len;
+      }
+    }
+  }
+  if (changed != nullptr && ftruncate(fd, m.size) < 0) {
+    fprintf(stderr, "[CHUNKS] sizing %s failed: %s\n", path.c_str(),
+            strerror(errno));
+    exit(1);
+  }
+  close(fd);
+  return true;
+}
+
+void ChunkStore::release(Manifest *m) {
+  std::lock_guard<std::mutex> guard(lock);
+  for (uint32_t slot : m->chunks) {
+    _unref(slot);
+  }
+  m->chunks.clear();
+  m->size = 0;
+}
+
+size_t ChunkStore::num_chunks() {
+  std::lock_guard<std::mutex> guard(lock);
+  return chunks.size() - free_slots.size();
+}
+
+uint64_t ChunkStore::num_bytes() {
+  std::lock_guard<std::mutex> guard(lock);
+  return bytes;
+}
+
+uint64_t ChunkStore::num_deduped() {
+  std::lock_guard<std::mutex> guard(lock);
+  return deduped;
+}
+
+uint32_t ChunkStore::_intern(uint64_t hash, const char *data, size_t len) {
+  auto range = by_hash.equal_range(hash);
+  for (auto it = range.first; it != range.second; it++) {
+    Chunk &chunk = chunks[it->second];
+    if (chunk.data.size() == len && memcmp(chunk.data.data(), data, len) == 0) {
+      chunk.refs++;
+      deduped += len;
+      return it->second;
+    }
+  }
+  uint32_t slot;
+  if (!free_slots.empty()) {
+    slot = free_slots.back();
+    free_slots.pop_back();
+  } else {
+    slot = chunks.size();
+    chunks.push_back({0, 0, ""});
+  }
+  chunks[slot].hash = hash;
+  chunks[slot].refs = 1;
+  chunks[slot].data.assign(data, len);
+  by_hash.insert({hash, slot});
+  bytes += len;
+  return slot;
+}
+
+void ChunkStore::_unref(uint32_t slot) {
+  Chunk &chunk = chunks[slot];
+  if (--chunk.refs > 0) {
+    return;
+  }
+  auto range = by_hash.equal_range(chunk.hash);
+  for (auto it = range.first; it != range.second; it++) {
+    if (it->second == slot) {
+      by_hash.erase(it);
+      break;
+    }
+  }
+  bytes -= chunk.data.size();
+  // give the memory back, not just the slot
+  std::string().swap(chunk.data);
+  free_slots.push_back(slot);
+}
@@ -31,47 +31,18 @@
 
 #include "client.h"
 
-namespace {
-void _read_from_proc(pid_t child, char *out, char *addr, size_t len) {
-  size_t i = 0;
-  while (i < len) {
-    long val;
-
-    val = ptrace(PTRACE_PEEKTEXT, child, addr + i, NULL);
-    if (val == -1) {
-      fprintf(stderr, "failed to PEEKTEXT\n");
-      exit(1);
-    }
-
-    memcpy(out + i, &val, sizeof(long));
-    i += sizeof(long);
-  }
-}
-
-void _write_to_proc(pid_t child, char *to_write, char *addr, size_t len) {
-  size_t i = 0;
-  while (i < len) {
-    char val[sizeof(long)];
-    memcpy(val, to_write + i, sizeof(long));
-
-    long ret = ptrace(PTRACE_POKETEXT, child, addr + i, *(long *)val);
-    if (ret == -1) {
-      exit(1);
-    }
-
-    i += sizeof(long);
-  }
-}
-
-} // namespace
-
 namespace ClientFilter {
 
+constexpr ClientManager::Intercept ClientManager::syscalls_intercept[];
+constexpr SyscallIndex ClientManager::intercept_index =
+    make_syscall_index(ClientManager::syscalls_intercept);
+
 ClientManager::ClientManager(int client_idx, std::string seed,
                              std::vector<std::string> command, FdMap &fdmap,
-                             bool ignore_stdout)
+                             bool ignore_stdout, Transport transport)
     : my_idx(client_idx), seed(seed), command(command),
-      ignore_stdout(ignore_stdout), fdmap(fdmap), sockfds() {
+      ignore_stdout(ignore_stdout), fdmap(fdmap), transport(transport),
+      sockfds() {
   printf("[CLIENT] creating with command: %s\n", command[0].c_str());
 
   start_client();
@@ -105,24 +76,11 @@ void ClientManager::start_client() {
 
     // set up seccomp for tracing syscalls
     // https://www.alfonsobeato.net/c/filter-and-modify-system-calls-with-seccomp-and-ptrace/
-    int n_syscalls =
-        (sizeof(syscalls_intercept) / sizeof(syscalls_intercept[0]));
-    int filter_len = n_syscalls + 3;
-
-    struct sock_filter filter[filter_len];
-    filter[0] =
-        BPF_STMT(BPF_LD + BPF_W + BPF_ABS, offsetof(struct seccomp_data, nr));
-    filter[filter_len - 2] = BPF_STMT(BPF_RET + BPF_K, SECCOMP_RET_ALLOW);
-    filter[filter_len - 1] = BPF_STMT(BPF_RET + BPF_K, SECCOMP_RET_TRACE);
-
-    for (int i = 0; i < n_syscalls; i++) {
-      filter[i + 1] = BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, syscalls_intercept[i],
-                               u_int8_t(n_syscalls - i), 0);
-    }
-
+    std::vector<struct sock_filter> filter =
+        build_seccomp_filter(syscalls_intercept, false, 0);
     struct sock_fprog prog = {
-        (unsigned short)(sizeof(filter) / sizeof(filter[0])),
-        filter,
+        (unsigned short)filter.size(),
+        filter.data(),
     };
     ptrace(PTRACE_TRACEME, 0, 0, 0);
     /* To avoid the need for CAP_SYS_ADMIN */
@@ -145,6 +103,8 @@ void ClientManager::start_client() {
   }
 
   child = pid;
+  mem.attach(child);
+  stop.attach(child);
 
   int status;
   waitpid(pid, &status, 0);
@@ -161,6 +121,8 @@ void ClientManager::stop_client() {
     ;
   child = -1;
   child_state = ST_DEAD;
+  mem.detach();
+  stop.detach();
 
   sockfds.clear();
   fdmap.clear_nodefds(my_idx);
@@ -179,52 +141,37 @@ Event ClientManager::to_next_event() {
 
   int status;
   while (1) {
+    stop.flush();
     ptrace(PTRACE_CONT, child, 0, 0);
     waitpid(child, &status, 0);
+    mem.next_stop();
+    stop.next_stop();
     if (WIFSTOPPED(status)) {
       if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_SECCOMP << 8))) {
         // check if it's one of the syscalls we want to handle
-        int my_syscall =
-            ptrace(PTRACE_PEEKUSER, child, sizeof(long) * ORIG_RAX, 0);
+        long my_syscall = stop.nr();
         if (my_syscall > 0) {
           // If attempting to read the data failed, that may be because
           // program's still running
           child_state = ST_STOPPED;
         }
-        switch (my_syscall) {
-          // network-related
-        case SYS_socket:
-          handle_socket();
+        int idx = intercept_index.find(my_syscall);
+        if (idx < 0) {
           continue;
-        case SYS_shutdown: // we aren't *really* accounting for shutdown
-        case SYS_close: {
-          struct user_regs_struct regs;
-          ptrace(PTRACE_GETREGS, child, 0, &regs);
-          int fd = regs.rdi;
-
-          if (sockfds.find(fd) != sockfds.end()) {
-            child_state = ST_NETWORK;
-            return EV_CLOSE;
-          } else {
-            child_state = ST_STOPPED;
-            continue;
-          }
         }
-        case SYS_connect:
-          printf("[CLIENT] about to handle connect\n");
-          child_state = ST_NETWORK;
-          return EV_CONNECT;
-        case SYS_sendto:
-          printf("[CLIENT] about to handle sendto\n");
-          child_state = ST_NETWORK;
-          return EV_SENDTO;
-        case SYS_recvfrom:
-          printf("[CLIENT] waiting to recv\n");
-          child_state = ST_RECVING;
-          return EV_RECVING;
-        default:
+        const Intercept &icpt = syscalls_intercept[idx];
+        if (icpt.handle != nullptr) {
+          (this->*icpt.handle)();
+        }
+        if (icpt.ev == EV_INTERNAL ||
+            (icpt.sockfd_only &&
+             sockfds.find((int)stop.arg(0)) == sockfds.end())) {
+          child_state = ST_STOPPED;
           continue;
         }
+        printf("[CLIENT] about to handle %s\n", icpt.name);
+        child_state = icpt.state;
+        return icpt.ev;
       } else {
         child_state = ST_STOPPED;
       }
@@ -244,19 +191,23 @@ int ClientManager::allow_event(Event ev) {
   switch (ev) {
   case EV_CONNECT: {
     int status;
-    ptrace(PTRACE_SYSCALL, child, 0, 0);
-    waitpid(child, &status, 0);
-    if (WIFSTOPPED(status) && WSTOPSIG(status) & 0x80) {
-      struct user_regs_struct regs;
-      ptrace(PTRACE_GETREGS, child, 0, &regs);
-      int ret = (int)regs.rax;
-      int connfd = (int)regs.rdi;
+    // the proxy connects to nodes from localhost for clients, so clients
+    // look like they do too
+    struct in_addr from;
+    from.s_addr = htonl(INADDR_LOOPBACK);
+    bool at_exit = transport == TR_UNIX
+                       ? unix_connect(child, stop, mem, from, &status)
+                       : stop.to_exit(&status);
+    if (at_exit) {
+      int ret = (int)stop.ret();
+      int connfd = (int)stop.arg(0);
       if (ret < 0) {
         printf("[CLIENT] connect failed with %s\n", strerror(-ret));
         deadfds.insert(connfd);
         return -1;
       } else {
-        fdmap.node_connect_fd(my_idx, connfd);
+        fdmap.node_connect_fd(my_idx, connfd,
+                              tracee_sockname(child, connfd));
         return 0;
       }
     }
@@ -264,20 +215,15 @@ int ClientManager::allow_event(Event ev) {
   }
   case EV_SENDTO: {
     int status;
-    ptrace(PTRACE_SYSCALL, child, 0, 0);
-    waitpid(child, &status, 0);
-    if (WIFSTOPPED(status) && WSTOPSIG(status) & 0x80) {
-      struct user_regs_struct regs;
-      ptrace(PTRACE_GETREGS, child, 0, &regs);
-      int sendfd = (int)regs.rdi;
+    if (stop.to_exit(&status)) {
+      int sendfd = (int)stop.arg(0);
       if (fdmap.is_nodefd_alive(my_idx, sendfd)) {
         printf("[CLIENT] connection is still alive. allow sendto\n");
-        return (int)regs.rax;
+        return (int)stop.ret();
       } else {
         // proxy already closed. we should close this fd
         printf("[CLIENT] connection is dead. inject failure\n");
-        regs.rax = -((long)ECONNREFUSED);
-        ptrace(PTRACE_SETREGS, child, 0, &regs);
+        stop.set_ret(-((long)ECONNREFUSED));
         return -1;
       }
     }
@@ -294,12 +240,11 @@ int ClientManager::allow_event(Event ev) {
 
 bool ClientManager::handle_close() {
   int status;
-  ptrace(PTRACE_SYSCALL, child, 0, 0);
-  waitpid(child, &status, 0);
+  bool at_exit = stop.to_exit(&status);
   child_state = ST_STOPPED;
 
-  if (WIFSTOPPED(status) && WSTOPSIG(status) & 0x80) {
-    int fd = (int)ptrace(PTRACE_PEEKUSER, child, sizeof(long) * RDI, 0);
+  if (at_exit) {
+    int fd = (int)stop.arg(0);
     printf("[CLIENT] closed sockfd: %d\n", fd);
     sockfds.erase(fd);
     bool no_conn_fail = (deadfds.find(fd) == deadfds.end());
@@ -312,8 +257,8 @@ bool ClientManager::handle_close() {
 void ClientManager::handle_recv() {
   printf("[CLIENT] handling recv\n");
   int status;
-  struct user_regs_struct regs;
-  ptrace(PTRACE_GETREGS, child, 0, &regs);
+  // a copy, which is never written back
+  struct user_regs_struct regs = stop.regs();
   printf("[CLIENT] recving on fd %d\n", (int)regs.rdi);
 
   fflush(stdout);
@@ -324,10 +269,8 @@ void ClientManager::handle_recv() {
     // proxy already closed. we should close this fd
     printf("[CLIENT] connection is dead. inject failure\n");
     regs.orig_rax = -1;
-    ptrace(PTRACE_SYSCALL, child, 0, 0);
-    waitpid(child, &status, 0);
-    if (WIFSTOPPED(status) && WSTOPSIG(status) & 0x80) {
-      ptrace(PTRACE_GETREGS, child, 0, &regs);
+    if (stop.to_exit(&status)) {
+      regs = stop.regs();
       regs.rax = -((long)ETIMEDOUT);
     } else {
       fprintf(stderr, "[CLIENT] did not get subsequent syscall\n");
@@ -340,26 +283,51 @@ void ClientManager::handle_recv() {
 void ClientManager::handle_socket() {
   printf("[CLIENT] handling socket\n");
 
-  struct user_regs_struct regs;
-  ptrace(PTRACE_GETREGS, child, 0, &regs);
-  int domain = regs.rdi;
-  int type = regs.rsi;
-  // int protocol = regs.rdx;
+  int domain = stop.arg(0);
+  int type = stop.arg(1);
+  // int protocol = stop.arg(2);
 
   // printf("domain: %d, type: %d, protocol: %d\n", domain, type, protocol);
 
   if (domain == AF_INET && type & SOCK_STREAM) {
     // when TCP, track the socket being returned
     int status;
-    ptrace(PTRACE_SYSCALL, child, 0, 0);
-    waitpid(child, &status, 0);
-    if (WIFSTOPPED(status) && WSTOPSIG(status) & 0x80) {
-      uint64_t fd =
-          (uint64_t)ptrace(PTRACE_PEEKUSER, child, sizeof(long) * RAX, 0);
+    bool at_exit = transport == TR_UNIX ? unix_socket(stop, &status)
+                                        : stop.to_exit(&status);
+    if (at_exit) {
+      uint64_t fd = (uint64_t)stop.ret();
       printf("[CLIENT] new sockfd: %lu\n", fd);
       sockfds.insert(fd);
     }
   }
 }
 
-} // namespace ClientFilter
\ No newline at end of file
+void ClientManager::handle_bind() {
+  int sockfd = stop.arg(0);
+  if (transport != TR_UNIX || sockfds.find(sockfd) == sockfds.end() ||
+      stop.arg(2) < sizeof(sockaddr_in)) {
+    return;
+  }
+  sockaddr_in addr;
+  mem.read(&addr, stop.arg(1), sizeof(sockaddr_in));
+  if (addr.sin_family != AF_INET) {
+    return;
+  }
+  // a unix socket can't take an AF_INET address, so bind it ourselves and
+  // skip the syscall
+  int ret = addr.sin_port == 0
+                ? tracee_bind_ephemeral(child, sockfd, &addr)
+                : tracee_bind(child, sockfd, UR_PEER, addr);
+  printf("[CLIENT] bound %d as %s:%d: %d\n", sockfd, inet_ntoa(addr.sin_addr),
+         ntohs(addr.sin_port), ret);
+  stop.set_nr(-1);
+  stop.set_ret(ret);
+}
+
+void ClientManager::handle_sockopt() {
+  if (transport == TR_UNIX && sockfds.find(stop.arg(0)) != sockfds.end()) {
+    unix_sockopt(stop, mem);
+  }
+}
+
+} // namespace ClientFilter
@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "client.h"
+#include "conntable.h"
+
+ConnTable::ConnTable(size_t num_nodes, size_t num_clients)
+    : num_nodes(num_nodes), heads(num_nodes + num_clients, -1) {}
+
+void ConnTable::add(int fd, ConnRole role, int node) {
+  if (fd < 0 || role == CR_NONE) {
+    fprintf(stderr, "[CONNTABLE] can't add %d as %d\n", fd, role);
+    exit(1);
+  }
+  if (is_open(fd)) {
+    remove(fd);
+  }
+  if ((size_t)fd >= roles.size()) {
+    size_t size = fd + 1;
+    roles.resize(size, CR_NONE);
+    nodes.resize(size, -1);
+    peers.resize(size, -1);
+    gens.resize(size, 0);
+    statuses.resize(size, CONNECTED);
+    next_fd.resize(size, -1);
+    prev_fd.resize(size, -1);
+  }
+  roles[fd] = role;
+  nodes[fd] = node;
+  peers[fd] = -1;
+  gens[fd]++;
+  statuses[fd] = CONNECTED;
+  if (role == CR_LISTENER) {
+    return;
+  }
+
+  // keep the list in fd order
+  int &head = heads[slot(node)];
+  int prev = -1, cur = head;
+  while (cur >= 0 && cur < fd) {
+    prev = cur;
+    cur = next_fd[cur];
+  }
+  next_fd[fd] = cur;
+  prev_fd[fd] = prev;
+  if (cur >= 0) {
+    prev_fd[cur] = fd;
+  }
+  if (prev >= 0) {
+    next_fd[prev] = fd;
+  } else {
+    head = fd;
+  }
+}
+
+void ConnTable::remove(int fd) {
+  if (!is_open(fd)) {
+    return;
+  }
+  if (roles[fd] != CR_LISTENER) {
+    if (prev_fd[fd] >= 0) {
+      next_fd[prev_fd[fd]] = next_fd[fd];
+    } else {
+      heads[slot(nodes[fd])] = next_fd[fd];
+    }
+    if (next_fd[fd] >= 0) {
+      prev_fd[next_fd[fd]] = prev_fd[fd];
+    }
+    next_fd[fd] = -1;
+    prev_fd[fd] = -1;
+  }
+  roles[fd] = CR_NONE;
+  nodes[fd] = -1;
+  peers[fd] = -1;
+  gens[fd]++;
+  statuses[fd] = CONNECTED;
+}
+
+size_t ConnTable::slot(int node) const {
+  size_t idx = node < ClientFilter::CLIENT_OFFS
+                   ? node
+                   : num_nodes + node - ClientFilter::CLIENT_OFFS;
+  if (node < 0 || idx >= heads.size()) {
+    fprintf(stderr, "[CONNTABLE] no node %d\n", node);
+    exit(1);
+  }
+  return idx;
+}
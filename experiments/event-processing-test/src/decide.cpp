@@ -1,18 +1,93 @@
+#include <algorithm>
 #include <fcntl.h>
 #include <fstream>
 #include <iostream>
 #include <random>
-#include <set>
 #include <sstream>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 
 #include "decide.h"
 
 static const std::unordered_map<DecideEvent, char> trace_names{
     {RANDOM, 'r'},  {NEXT_NODE, 'n'}, {SEND_MSG, 'm'},   {SEND, 's'},
     {CONNECT, 'c'}, {WRITE, 'w'},     {FSYNC_FAIL, 'f'}, {FSYNC_RENAME, 'a'},
-    {REVIVE, 'v'},  {C_SEND, 'p'},    {C_CONNECT, 'q'}};
+    {REVIVE, 'v'},  {C_SEND, 'p'},    {C_CONNECT, 'q'}, {SEND_BATCH, 'b'}};
+
+namespace {
+// each message is held back with the same 1 in msg_delay_rate chance as
+// should_send_msg, and holding one back holds back the rest of its fd. the
+// ones that go are then shuffled across fds (within an fd, order is fixed)
+void _random_batch(std::mt19937 &rng, size_t msg_delay_rate,
+                   const std::vector<size_t> &waiting,
+                   std::vector<size_t> *batch) {
+  for (size_t i = 0; i < waiting.size(); i++) {
+    for (size_t n = 0; n < waiting[i] && (rng() % msg_delay_rate) != 0; n++) {
+      batch->push_back(i);
+    }
+  }
+  for (size_t i = batch->size(); i > 1; i--) {
+    std::swap((*batch)[i - 1], (*batch)[rng() % i]);
+  }
+}
+
+// one line for the whole batch: b<size>,<fd index>,<fd index>,...
+void _write_batch(std::ofstream &fout, const std::vector<size_t> &batch) {
+  fout << trace_names.at(SEND_BATCH) << batch.size();
+  for (size_t i : batch) {
+    fout << ',' << i;
+  }
+  fout << std::endl;
+}
+
+// the node to run when every one is polling or dead: the one polled least,
+// or, while they've all been polled the same, one picked by prop (a roll out
+// of 100): the primary (node 0) below primary_percent, and the others in
+// even slices above it. counts the poll against the node
+int _least_polled(std::vector<int> &poll_counts, size_t prop,
+                  size_t primary_percent) {
+  size_t num_nodes = poll_counts.size();
+  size_t min_idx = std::min_element(poll_counts.begin(), poll_counts.end()) -
+                   poll_counts.begin();
+  bool all_equal = std::count(poll_counts.begin(), poll_counts.end(),
+                              poll_counts[min_idx]) == (long)num_nodes;
+  size_t node_idx = min_idx;
+  if (all_equal && num_nodes > 1 && prop >= primary_percent) {
+    // node i runs once over gets past the slices before it, so the last
+    // slice takes whatever doesn't divide evenly (and everything, if the
+    // slices are empty). with 3 nodes this is over < share ? 1 : 2
+    size_t share = (100 - primary_percent) / (num_nodes - 1);
+    size_t over = prop - primary_percent;
+    node_idx = 1;
+    while (node_idx < num_nodes - 1 && over >= node_idx * share) {
+      node_idx++;
+    }
+  } else if (all_equal) {
+    node_idx = 0;
+  }
+  poll_counts[node_idx]++;
+  return node_idx;
+}
+
+} // namespace
+
+int Decider::idle_wakeup(size_t num_nodes) const {
+  if (idle_timers == nullptr || idle_timers->size() != num_nodes) {
+    return -1;
+  }
+  return idle_timers->earliest();
+}
+
+void Decider::choose_batch(const std::vector<size_t> &waiting,
+                           std::vector<size_t> *batch) {
+  batch->clear();
+  for (size_t i = 0; i < waiting.size(); i++) {
+    if (should_send_msg()) {
+      batch->push_back(i);
+    }
+  }
+}
 
 RRandDecider::RRandDecider(std::string seed, std::string trace_file,
                            std::string visited_file, size_t num_nodes,
@@ -32,7 +107,7 @@ RRandDecider::RRandDecider(std::string seed, std::string trace_file,
   std::seed_seq seed_seq(seed.begin(), seed.end());
   rng = std::mt19937(seed_seq);
 
-  node_poll_counts = std::vector<int>(3);
+  node_poll_counts = std::vector<int>(num_nodes);
 }
 
 void RRandDecider::fill_random(void *buf, size_t buf_len) {
@@ -45,8 +120,8 @@ void RRandDecider::fill_random(void *buf, size_t buf_len) {
   fout << std::endl;
 }
 
-int RRandDecider::get_next_node(int num_alive_nodes, std::set<int> &nodes,
-                                std::set<int> &clients) {
+int RRandDecider::get_next_node(int num_alive_nodes, RunSet &nodes,
+                                RunSet &clients) {
   if (curr_node >= 0) {
     // there was a previous node, update vis with its trace
     std::ostringstream oss;
@@ -77,41 +152,16 @@ int RRandDecider::get_next_node(int num_alive_nodes, std::set<int> &nodes,
     size_t to_run = rng() % tot_avail_nodes;
     if (to_run < node_pref * nodes.size()) {
       to_run %= nodes.size();
-      node_idx = *std::next(nodes.begin(), to_run);
+      node_idx = nodes.nth(to_run);
     } else {
       to_run -= node_pref * nodes.size();
-      node_idx = *std::next(clients.begin(), to_run);
+      node_idx = clients.nth(to_run);
     }
+  } else if ((node_idx = idle_wakeup(num_nodes)) >= 0) {
+    printf("[RANDOM] every node idle, waking %d\n", node_idx);
   } else {
     // everything is currently polling or dead
-    int min_cnt = INT32_MAX;
-    int min_idx = -1;
-    size_t num_mins = 0;
-    // TODO could extract this out to reduce the number of times it's called
-    for (size_t i = 0; i < num_nodes; i++) {
-      if (node_poll_counts[i] < min_cnt) {
-        min_idx = i;
-        min_cnt = node_poll_counts[i];
-        num_mins = 0;
-      }
-
-      if (node_poll_counts[i] == min_cnt) {
-        num_mins++;
-      }
-    }
-    size_t prop = rng() % 100;
-    if (num_mins == num_nodes) {
-      if (prop < primary_percent) {
-        node_idx = 0;
-      } else if ((prop - primary_percent) < ((100 - primary_percent) / 2)) {
-        node_idx = 1;
-      } else {
-        node_idx = 2;
-      }
-    } else {
-      node_idx = min_idx;
-    }
-    node_poll_counts[node_idx]++;
+    node_idx = _least_polled(node_poll_counts, rng() % 100, primary_percent);
   }
   printf("[RANDOM] chose %d as node to return\n", node_idx);
   fout << trace_names.at(NEXT_NODE) << node_idx << std::endl;
@@ -126,6 +176,20 @@ bool RRandDecider::should_send_msg() {
   return ret;
 }
 
+void RRandDecider::choose_batch(const std::vector<size_t> &waiting,
+                                std::vector<size_t> *batch) {
+  if (!batch_delivery) {
+    Decider::choose_batch(waiting, batch);
+    return;
+  }
+  batch->clear();
+  if (waiting.empty()) {
+    return;
+  }
+  _random_batch(rng, msg_delay_rate, waiting, batch);
+  _write_batch(fout, *batch);
+}
+
 bool RRandDecider::should_rename_on_fsync() {
   bool ret = rng() % fsync_rename_rate == 0;
   fout << trace_names.at(FSYNC_RENAME) << (ret ? "1" : "0") << std::endl;
@@ -216,8 +280,8 @@ void ReplayDecider::fill_random(void *buf, size_t buf_len) {
   }
 }
 
-int ReplayDecider::get_next_node(int num_alive_nodes, std::set<int> &nodes,
-                                 std::set<int> &clients) {
+int ReplayDecider::get_next_node(int num_alive_nodes, RunSet &nodes,
+                                 RunSet &clients) {
   printf("[REPLAY] Getting next node\n");
   char name = trace_names.at(NEXT_NODE);
   char f_name;
@@ -235,8 +299,7 @@ int ReplayDecider::get_next_node(int num_alive_nodes, std::set<int> &nodes,
   size_t tot_alive_nodes = nodes.size() + clients.size();
   if (num_alive_nodes > 0 && tot_alive_nodes > 0) {
     // can choose from clients and nodes
-    if (nodes.find(decision) == nodes.end() &&
-        clients.find(decision) == clients.end()) {
+    if (!nodes.contains(decision) && !clients.contains(decision)) {
       fprintf(stderr,
               "[REPLAY] found impossible next node, can't replay -- may be "
               "non-determinisic or program changed\n");
@@ -256,6 +319,37 @@ int ReplayDecider::get_next_node(int num_alive_nodes, std::set<int> &nodes,
 
 bool ReplayDecider::should_send_msg() { return validate_and_replay(SEND_MSG); }
 
+void ReplayDecider::choose_batch(const std::vector<size_t> &waiting,
+                                 std::vector<size_t> *batch) {
+  batch->clear();
+  if (waiting.empty()) {
+    return;
+  }
+  // traces from either kind of delivery replay the same way
+  fin >> std::ws;
+  if (fin.peek() != trace_names.at(SEND_BATCH)) {
+    Decider::choose_batch(waiting, batch);
+    return;
+  }
+  char f_name;
+  size_t size;
+  fin >> f_name >> size;
+  std::vector<size_t> left(waiting);
+  for (size_t i = 0; i < size; i++) {
+    char comma;
+    size_t idx;
+    fin >> comma >> idx;
+    if (idx >= left.size() || left[idx] == 0) {
+      fprintf(stderr,
+              "[REPLAY] found impossible message batch, can't replay -- may "
+              "be non-determinisic or program changed\n");
+      exit(1);
+    }
+    left[idx]--;
+    batch->push_back(idx);
+  }
+}
+
 bool ReplayDecider::should_fail_on_send() { return validate_and_replay(SEND); }
 
 bool ReplayDecider::should_fail_on_connect() {
@@ -332,8 +426,8 @@ void VisitedDecider::fill_random(void *buf, size_t buf_len) {
   fout << std::endl;
 }
 
-int VisitedDecider::get_next_node(int num_alive_nodes, std::set<int> &nodes,
-                                  std::set<int> &clients) {
+int VisitedDecider::get_next_node(int num_alive_nodes, RunSet &nodes,
+                                  RunSet &clients) {
   printf("[VIS_DEC] getting next node\n");
 
   if (curr_node >= 0) {
@@ -370,42 +464,17 @@ int VisitedDecider::get_next_node(int num_alive_nodes, std::set<int> &nodes,
       size_t to_run = rng() % tot_avail_nodes;
       if (to_run < node_pref * nodes.size()) {
         to_run %= nodes.size();
-        node_idx = *std::next(nodes.begin(), to_run);
+        node_idx = nodes.nth(to_run);
       } else {
         to_run -= node_pref * nodes.size();
-        node_idx = *std::next(clients.begin(), to_run);
+        node_idx = clients.nth(to_run);
       }
+    } else if ((node_idx = idle_wakeup(num_nodes)) >= 0) {
+      printf("[VIS_DEC] every node idle, waking %d\n", node_idx);
     } else {
       printf("[VIS_DEC] everything polling or dead\n");
       // everything is currently polling or dead
-      int min_cnt = INT32_MAX;
-      int min_idx = -1;
-      size_t num_mins = 0;
-      // TODO could extract this out to reduce the number of times it's called
-      for (size_t i = 0; i < num_nodes; i++) {
-        if (node_poll_counts[i] < min_cnt) {
-          min_idx = i;
-          min_cnt = node_poll_counts[i];
-          num_mins = 0;
-        }
-
-        if (node_poll_counts[i] == min_cnt) {
-          num_mins++;
-        }
-      }
-      size_t prop = rng() % 100;
-      if (num_mins == num_nodes) {
-        if (prop < primary_percent) {
-          node_idx = 0;
-        } else if ((prop - primary_percent) < ((100 - primary_percent) / 2)) {
-          node_idx = 1;
-        } else {
-          node_idx = 2;
-        }
-      } else {
-        node_idx = min_idx;
-      }
-      node_poll_counts[node_idx]++;
+      node_idx = _least_polled(node_poll_counts, rng() % 100, primary_percent);
     }
   } else {
     // if mixed and in Visited regime, choose randomly from available based on
@@ -414,10 +483,13 @@ int VisitedDecider::get_next_node(int num_alive_nodes, std::set<int> &nodes,
 
     std::unordered_map<int, size_t> my_counts;
 
-    for (auto &node : nodes) {
+    std::vector<int> members;
+    nodes.members(&members);
+    for (int node : members) {
       my_counts[node] = 1;
     }
-    for (auto &client : clients) {
+    clients.members(&members);
+    for (int client : members) {
       my_counts[client] = 1;
     }
 
@@ -476,6 +548,21 @@ bool VisitedDecider::should_send_msg() {
   return to_ret;
 }
 
+void VisitedDecider::choose_batch(const std::vector<size_t> &waiting,
+                                  std::vector<size_t> *batch) {
+  if (!batch_delivery) {
+    Decider::choose_batch(waiting, batch);
+    return;
+  }
+  // same as RRandom, like should_send_msg
+  batch->clear();
+  if (waiting.empty()) {
+    return;
+  }
+  _random_batch(rng, msg_delay_rate, waiting, batch);
+  _write_batch(fout, *batch);
+}
+
 bool VisitedDecider::should_rename_on_fsync() {
   vis.register_child(FSYNC_RENAME);
   bool to_ret = ((rng() % fsync_rename_rate) == 0);
@@ -0,0 +1,55 @@
+#include <algorithm>
+#include <iterator>
+
+#include "extents.h"
+
+ExtentSet::ExtentSet() : ranges() {}
+
+void ExtentSet::add(uint64_t off, uint64_t len) {
+  if (len == 0) {
+    return;
+  }
+  uint64_t end = (len == TO_EOF || off + len < off) ? TO_EOF : off + len;
+  // swallow a range ending at or after off that starts before it
+  auto it = ranges.upper_bound(off);
+  if (it != ranges.begin()) {
+    auto prev = std::prev(it);
+    if (prev->second >= off) {
+      off = prev->first;
+      end = std::max(end, prev->second);
+      ranges.erase(prev);
+    }
+  }
+  // and every range starting inside (or right after) the new one
+  it = ranges.lower_bound(off);
+  while (it != ranges.end() && it->first <= end) {
+    end = std::max(end, it->second);
+    it = ranges.erase(it);
+  }
+  ranges[off] = end;
+}
+
+bool ExtentSet::overlaps(uint64_t off, uint64_t len) const {
+  if (len == 0) {
+    return false;
+  }
+  // the last range starting before off + len is the only one that can reach
+  // back into it
+  auto it = ranges.lower_bound(off + len);
+  if (it == ranges.begin()) {
+    return false;
+  }
+  return std::prev(it)->second > off;
+}
+
+void ExtentSet::clipped(
+    uint64_t size, std::vector<std::pair<uint64_t, uint64_t>> *out) const {
+  out->clear();
+  for (const auto &range : ranges) {
+    if (range.first >= size) {
+      break;
+    }
+    uint64_t end = std::min(range.second, size);
+    out->push_back({range.first, end - range.first});
+  }
+}
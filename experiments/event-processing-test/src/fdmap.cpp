@@ -11,6 +11,7 @@
 
 #include <algorithm>
 #include <deque>
+#include <mutex>
 #include <unordered_map>
 #include <vector>
 
@@ -19,102 +20,107 @@
 #include "fdmap.h"
 
 FdMap::FdMap(size_t num_nodes, size_t num_clients)
-    : last_node(-1), last_nodefd(-1), nodefd_to_proxyfd(), proxyfd_to_nodefd() {
-  for (size_t i = 0; i < num_nodes; i++) {
-    nodes_to_connecting_proxyfds[i] =
-        std::vector<std::pair<int, struct sockaddr_in>>();
-    dead_nodefds[i] = std::unordered_set<int>();
-  }
-  for (size_t i = 0; i < num_clients; i++) {
-    size_t idx = i + ClientFilter::CLIENT_OFFS;
-    nodes_to_connecting_proxyfds[idx] =
-        std::vector<std::pair<int, struct sockaddr_in>>();
-    dead_nodefds[idx] = std::unordered_set<int>();
-  }
-}
+    : num_nodes(num_nodes),
+      nodes_to_connecting_proxyfds(num_nodes + num_clients),
+      nodefd_to_proxyfd(num_nodes + num_clients),
+      dead_nodefds(num_nodes + num_clients) {}
 
-int FdMap::get_last_node() { return last_node; }
-
-void FdMap::trash_last_node() {
-  printf("[FDMAP] trashing (%d,%d)\n", last_node, last_nodefd);
-  dead_nodefds[last_node].insert(last_nodefd);
-  nodefd_to_proxyfd.erase(key(last_node, last_nodefd));
-  last_node = -1;
-  last_nodefd = -1;
+namespace {
+bool _same_addr(const struct sockaddr_in &a, const struct sockaddr_in &b) {
+  return a.sin_family == b.sin_family &&
+         a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
 }
 
-void FdMap::node_connect_fd(int node, int fd) {
-  if (last_node != -1 || last_nodefd != -1) {
-    fprintf(stderr,
-            "[FDMAP] updated connectfd before linking - "
-            "last_node: %d, last_fd: %d\n",
-            last_node, last_nodefd);
-    exit(1);
+} // namespace
+
+void FdMap::node_connect_fd(int node, int fd, struct sockaddr_in nodeaddr) {
+  std::lock_guard<std::mutex> guard(lock);
+  for (const NodeConnect &conn : connecting_nodefds) {
+    if (_same_addr(conn.addr, nodeaddr)) {
+      fprintf(stderr,
+              "[FDMAP] (%d,%d) connecting from %s:%d, same as (%d,%d)\n",
+              node, fd, inet_ntoa(nodeaddr.sin_addr), ntohs(nodeaddr.sin_port),
+              conn.node, conn.nodefd);
+      exit(1);
+    }
   }
 
-  printf("[FDMAP] node connecting with (%d,%d)\n", node, fd);
+  printf("[FDMAP] node connecting with (%d,%d) from %s:%d\n", node, fd,
+         inet_ntoa(nodeaddr.sin_addr), ntohs(nodeaddr.sin_port));
   print_state();
 
-  dead_nodefds[node].erase(fd);
-  last_node = node;
-  last_nodefd = fd;
+  grow_nodefd(node, fd);
+  dead_nodefds[slot(node)][fd] = false;
+  connecting_nodefds.push_back({node, fd, nodeaddr});
   print_state();
 }
 
-void FdMap::proxy_accept_fd(int proxyfd) {
-  if (last_node == -1 || last_nodefd == -1) {
-    fprintf(stderr,
-            "[FDMAP] linking proxy with unfilled nodefd - "
-            "last_node: %d, last_fd: %d\n",
-            last_node, last_nodefd);
-    exit(1);
+bool FdMap::has_unaccepted() {
+  std::lock_guard<std::mutex> guard(lock);
+  return !connecting_nodefds.empty();
+}
+
+int FdMap::proxy_accept_fd(int proxyfd, struct sockaddr_in fromaddr) {
+  std::lock_guard<std::mutex> guard(lock);
+  auto it = connecting_nodefds.begin();
+  while (it != connecting_nodefds.end() && !_same_addr(it->addr, fromaddr)) {
+    it++;
   }
+  if (it == connecting_nodefds.end()) {
+    printf("[FDMAP] proxy accepted %d from %s:%d before any node connected\n",
+           proxyfd, inet_ntoa(fromaddr.sin_addr), ntohs(fromaddr.sin_port));
+    return -1;
+  }
+  int node = it->node;
+  int nodefd = it->nodefd;
+  connecting_nodefds.erase(it);
 
-  printf("[FDMAP] proxy accepted (%d,%d) with %d\n", last_node, last_nodefd,
-         proxyfd);
+  printf("[FDMAP] proxy accepted (%d,%d) with %d\n", node, nodefd, proxyfd);
   print_state();
-  dead_proxyfds.erase(proxyfd);
-
-  nodefd_to_proxyfd[key(last_node, last_nodefd)] = proxyfd;
-  proxyfd_to_nodefd[proxyfd] = {last_node, last_nodefd};
+  grow_proxyfd(proxyfd);
+  dead_proxyfds[proxyfd] = false;
 
-  last_node = -1;
-  last_nodefd = -1;
+  nodefd_to_proxyfd[slot(node)][nodefd] = proxyfd;
+  proxyfd_to_nodefd[proxyfd] = {node, nodefd};
   print_state();
+  return node;
 }
 
 void FdMap::proxy_connect_fd(int node, int proxyfd,
                              struct sockaddr_in proxyaddr) {
+  std::lock_guard<std::mutex> guard(lock);
   printf("[FDMAP] proxy attempting to connect using fd %d with %s:%d\n",
          proxyfd, inet_ntoa(proxyaddr.sin_addr), ntohs(proxyaddr.sin_port));
   print_state();
-  dead_proxyfds.erase(proxyfd);
+  grow_proxyfd(proxyfd);
+  dead_proxyfds[proxyfd] = false;
   connecting_proxyfds[proxyfd] = node;
 
-  nodes_to_connecting_proxyfds[node].push_back({proxyfd, proxyaddr});
+  nodes_to_connecting_proxyfds[slot(node)].push_back({proxyfd, proxyaddr});
   print_state();
 }
 
 void FdMap::node_accept_fd(int node, int nodefd, struct sockaddr_in nodeaddr) {
+  std::lock_guard<std::mutex> guard(lock);
   bool found = false;
-  auto it = nodes_to_connecting_proxyfds[node].begin();
-  while (it != nodes_to_connecting_proxyfds[node].end()) {
-    if (it->second.sin_family == nodeaddr.sin_family &&
-        it->second.sin_addr.s_addr == nodeaddr.sin_addr.s_addr &&
-        it->second.sin_port == nodeaddr.sin_port) {
+  auto &connecting = nodes_to_connecting_proxyfds[slot(node)];
+  auto it = connecting.begin();
+  while (it != connecting.end()) {
+    if (_same_addr(it->second, nodeaddr)) {
       found = true;
       printf("[FDMAP] node accepted %s:%d with fd: %d, corresponding to %d\n",
              inet_ntoa(nodeaddr.sin_addr), ntohs(nodeaddr.sin_port), nodefd,
              it->first);
       print_state();
 
-      dead_nodefds[node].erase(nodefd);
-      connecting_proxyfds.erase(it->first);
+      grow_nodefd(node, nodefd);
+      dead_nodefds[slot(node)][nodefd] = false;
+      connecting_proxyfds[it->first] = -1;
 
-      nodefd_to_proxyfd[key(node, nodefd)] = it->first;
+      nodefd_to_proxyfd[slot(node)][nodefd] = it->first;
       proxyfd_to_nodefd[it->first] = {node, nodefd};
 
-      it = nodes_to_connecting_proxyfds[node].erase(it);
+      it = connecting.erase(it);
       print_state();
       break;
     } else {
@@ -129,33 +135,37 @@ void FdMap::node_accept_fd(int node, int nodefd, struct sockaddr_in nodeaddr) {
 }
 
 void FdMap::node_close_fd(int node, int nodefd) {
+  std::lock_guard<std::mutex> guard(lock);
   // assume that node won't close an fd that's connecting
-  size_t my_key = key(node, nodefd);
   printf("[FDMAP] closing (%d, %d)\n", node, nodefd);
   print_state();
-  if (nodefd_to_proxyfd.find(my_key) != nodefd_to_proxyfd.end()) {
+  grow_nodefd(node, nodefd);
+  int proxyfd = nodefd_to_proxyfd[slot(node)][nodefd];
+  if (proxyfd >= 0) {
     // closing something that hasn't been unregistered by proxy
-    int proxyfd = nodefd_to_proxyfd.at(key(node, nodefd));
     printf("[FDMAP] successfully mapped to %d\n", proxyfd);
-    nodefd_to_proxyfd.erase(key(node, nodefd));
-    proxyfd_to_nodefd.erase(proxyfd);
+    nodefd_to_proxyfd[slot(node)][nodefd] = -1;
+    proxyfd_to_nodefd[proxyfd] = {-1, -1};
 
-    dead_nodefds[node].insert(nodefd);
-    dead_proxyfds.insert(proxyfd);
+    dead_nodefds[slot(node)][nodefd] = true;
+    dead_proxyfds[proxyfd] = true;
   }
   print_state();
 }
 
 void FdMap::proxy_clear_connecting(int proxyfd) {
+  std::lock_guard<std::mutex> guard(lock);
   printf("[FDMAP] Clearing connecting\n");
   print_state();
-  if (connecting_proxyfds.find(proxyfd) != connecting_proxyfds.end()) {
+  grow_proxyfd(proxyfd);
+  if (connecting_proxyfds[proxyfd] >= 0) {
     int node = connecting_proxyfds[proxyfd];
-    connecting_proxyfds.erase(proxyfd);
-    auto it = nodes_to_connecting_proxyfds[node].begin();
-    while (it != nodes_to_connecting_proxyfds[node].end()) {
+    connecting_proxyfds[proxyfd] = -1;
+    auto &connecting = nodes_to_connecting_proxyfds[slot(node)];
+    auto it = connecting.begin();
+    while (it != connecting.end()) {
       if (it->first == proxyfd) {
-        it = nodes_to_connecting_proxyfds[node].erase(it);
+        it = connecting.erase(it);
         break;
       } else {
         it++;
@@ -166,28 +176,36 @@ void FdMap::proxy_clear_connecting(int proxyfd) {
 }
 
 std::pair<int, int> FdMap::get_related_nodefd(int proxyfd) {
-  return proxyfd_to_nodefd.at(proxyfd);
+  std::lock_guard<std::mutex> guard(lock);
+  if (proxyfd < 0 || (size_t)proxyfd >= proxyfd_to_nodefd.size() ||
+      proxyfd_to_nodefd[proxyfd].first < 0) {
+    fprintf(stderr, "[FDMAP] proxyfd %d isn't linked\n", proxyfd);
+    exit(1);
+  }
+  return proxyfd_to_nodefd[proxyfd];
 }
 
 bool FdMap::is_linked(int proxyfd) {
+  std::lock_guard<std::mutex> guard(lock);
   // proxyfd must be linked and not dead
-  return (proxyfd_to_nodefd.find(proxyfd) != proxyfd_to_nodefd.end() &&
-          dead_proxyfds.find(proxyfd) == dead_proxyfds.end());
+  return proxyfd >= 0 && (size_t)proxyfd < proxyfd_to_nodefd.size() &&
+         proxyfd_to_nodefd[proxyfd].first >= 0 && !dead_proxyfds[proxyfd];
 }
 
 void FdMap::unregister_proxyfd(int proxyfd) {
+  std::lock_guard<std::mutex> guard(lock);
   printf("[FDMAP] unregistering proxyfd %d\n", proxyfd);
   print_state();
-  dead_proxyfds.insert(proxyfd);
-  if (proxyfd_to_nodefd.find(proxyfd) != proxyfd_to_nodefd.end()) {
+  grow_proxyfd(proxyfd);
+  dead_proxyfds[proxyfd] = true;
+  if (proxyfd_to_nodefd[proxyfd].first >= 0) {
     auto pair = proxyfd_to_nodefd[proxyfd];
-    proxyfd_to_nodefd.erase(proxyfd);
-    auto my_key = key(pair.first, pair.second);
-    if (nodefd_to_proxyfd.find(my_key) != nodefd_to_proxyfd.end() &&
-        nodefd_to_proxyfd[my_key] == proxyfd) {
+    proxyfd_to_nodefd[proxyfd] = {-1, -1};
+    int &nodefd_proxyfd = nodefd_to_proxyfd[slot(pair.first)][pair.second];
+    if (nodefd_proxyfd == proxyfd) {
       // nodefd wasn't closed, let's kill it
-      nodefd_to_proxyfd.erase(key(pair.first, pair.second));
-      dead_nodefds[pair.first].insert(pair.second);
+      nodefd_proxyfd = -1;
+      dead_nodefds[slot(pair.first)][pair.second] = true;
       printf("[FDMAP] unregistered, moved (%d,%d) to dead\n", pair.first,
              pair.second);
     } else {
@@ -199,14 +217,22 @@ void FdMap::unregister_proxyfd(int proxyfd) {
 }
 
 bool FdMap::is_nodefd_alive(int node, int nodefd) {
-  if (node == last_node && nodefd == last_nodefd) {
+  std::lock_guard<std::mutex> guard(lock);
+  grow_nodefd(node, nodefd);
+  bool connecting = false;
+  for (const NodeConnect &conn : connecting_nodefds) {
+    if (conn.node == node && conn.nodefd == nodefd) {
+      connecting = true;
+      break;
+    }
+  }
+  if (connecting) {
     // nodefd is currently connecting
     return true;
-  } else if (nodefd_to_proxyfd.find(key(node, nodefd)) !=
-             nodefd_to_proxyfd.end()) {
+  } else if (nodefd_to_proxyfd[slot(node)][nodefd] >= 0) {
     // nodefd is linked
     return true;
-  } else if (dead_nodefds[node].find(nodefd) != dead_nodefds[node].end()) {
+  } else if (dead_nodefds[slot(node)][nodefd]) {
     // nodefd is dead
     return false;
   } else {
@@ -218,47 +244,98 @@ bool FdMap::is_nodefd_alive(int node, int nodefd) {
 }
 
 void FdMap::clear_nodefds(int node) {
+  std::lock_guard<std::mutex> guard(lock);
   // do not unregister from n_to_p or p_to_n since these should be
   // cleared by the proxy already
   printf("[FDMAP] clearing nodefds of %d\n", node);
   print_state();
-  nodes_to_connecting_proxyfds[node].clear();
-  dead_nodefds[node].clear();
+  nodes_to_connecting_proxyfds[slot(node)].clear();
+  auto &dead = dead_nodefds[slot(node)];
+  std::fill(dead.begin(), dead.end(), false);
   print_state();
 }
 
+size_t FdMap::slot(int node) {
+  size_t idx = node < ClientFilter::CLIENT_OFFS
+                   ? node
+                   : num_nodes + node - ClientFilter::CLIENT_OFFS;
+  if (node < 0 || idx >= nodefd_to_proxyfd.size()) {
+    fprintf(stderr, "[FDMAP] no node %d\n", node);
+    exit(1);
+  }
+  return idx;
+}
+
+void FdMap::grow_proxyfd(int proxyfd) {
+  if (proxyfd < 0) {
+    fprintf(stderr, "[FDMAP] bad proxyfd %d\n", proxyfd);
+    exit(1);
+  }
+  if ((size_t)proxyfd >= connecting_proxyfds.size()) {
+    connecting_proxyfds.resize(proxyfd + 1, -1);
+    proxyfd_to_nodefd.resize(proxyfd + 1, {-1, -1});
+    dead_proxyfds.resize(proxyfd + 1, false);
+  }
+}
+
+void FdMap::grow_nodefd(int node, int nodefd) {
+  if (nodefd < 0) {
+    fprintf(stderr, "[FDMAP] bad nodefd %d\n", nodefd);
+    exit(1);
+  }
+  size_t idx = slot(node);
+  if ((size_t)nodefd >= nodefd_to_proxyfd[idx].size()) {
+    nodefd_to_proxyfd[idx].resize(nodefd + 1, -1);
+    dead_nodefds[idx].resize(nodefd + 1, false);
+  }
+}
+
 void FdMap::print_state() {
   if (true) {
     return;
   }
   printf("[FDMAP STATE] connecting_proxyfds:\n");
-  for (const auto &tup : connecting_proxyfds) {
-    printf("[FDMAP STATE]  %d -> %d\n", tup.first, tup.second);
+  for (size_t fd = 0; fd < connecting_proxyfds.size(); fd++) {
+    if (connecting_proxyfds[fd] >= 0) {
+      printf("[FDMAP STATE]  %lu -> %d\n", fd, connecting_proxyfds[fd]);
+    }
   }
   printf("[FDMAP STATE] proxyfd_to_nodefd\n");
-  for (const auto &tup : proxyfd_to_nodefd) {
-    printf("[FDMAP STATE]  %d -> (%d, %d)\n", tup.first, tup.second.first,
-           tup.second.second);
+  for (size_t fd = 0; fd < proxyfd_to_nodefd.size(); fd++) {
+    if (proxyfd_to_nodefd[fd].first >= 0) {
+      printf("[FDMAP STATE]  %lu -> (%d, %d)\n", fd,
+             proxyfd_to_nodefd[fd].first, proxyfd_to_nodefd[fd].second);
+    }
   }
   printf("[FDMAP STATE] dead_proxyfds\n");
-  for (const auto &tup : dead_proxyfds) {
-    printf("[FDMAP STATE]  %d\n", tup);
+  for (size_t fd = 0; fd < dead_proxyfds.size(); fd++) {
+    if (dead_proxyfds[fd]) {
+      printf("[FDMAP STATE]  %lu\n", fd);
+    }
   }
 
-  printf("[FDMAP STATE] last_node %d + last_nodefd %d\n", last_node,
-         last_nodefd);
+  printf("[FDMAP STATE] connecting_nodefds\n");
+  for (const NodeConnect &conn : connecting_nodefds) {
+    printf("[FDMAP STATE]  (%d, %d) from %s:%d\n", conn.node, conn.nodefd,
+           inet_ntoa(conn.addr.sin_addr), ntohs(conn.addr.sin_port));
+  }
   printf("[FDMAP STATE] nodefd_to_proxyfd\n");
-  for (const auto &tup : nodefd_to_proxyfd) {
-    int node = node_from_key(tup.first);
-    int fd = fd_from_key(tup.first);
-    printf("[FDMAP STATE]  (%d, %d) -> %d\n", node, fd, tup.second);
+  for (size_t idx = 0; idx < nodefd_to_proxyfd.size(); idx++) {
+    for (size_t fd = 0; fd < nodefd_to_proxyfd[idx].size(); fd++) {
+      if (nodefd_to_proxyfd[idx][fd] >= 0) {
+        printf("[FDMAP STATE]  (%lu, %lu) -> %d\n", idx, fd,
+               nodefd_to_proxyfd[idx][fd]);
+      }
+    }
   }
   printf("[FDMAP STATE] dead_nodefds\n");
-  for (const auto &tup : dead_nodefds) {
-    printf("[FDMAP STATE]  %d -> ", tup.first);
-    for (const auto &fd : tup.second) {
-      printf("%d ", fd);
+  for (size_t idx = 0; idx < dead_nodefds.size(); idx++) {
+    printf("[FDMAP STATE]  %lu -> ", idx);
+    for (size_t fd = 0; fd < dead_nodefds[idx].size(); fd++) {
+      if (dead_nodefds[idx][fd]) {
+        printf("%lu ", fd);
+      }
     }
     printf("\n");
   }
-}
\ No newline at end of file
+}
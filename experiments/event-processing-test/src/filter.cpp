@@ -7,8 +7,11 @@
 #include "dirent.h"
 #include "time.h"
 #include <arpa/inet.h>
+#include <elf.h>
 #include <fcntl.h>
 #include <fstream>
+#include <limits.h>
+#include <linux/falloc.h>
 #include <linux/filter.h>
 #include <linux/limits.h>
 #include <linux/seccomp.h>
@@ -16,9 +19,12 @@
 #include <signal.h>
 #include <sys/prctl.h>
 #include <sys/ptrace.h>
+#include <sys/ioctl.h>
 #include <sys/reg.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/user.h>
 #include <sys/wait.h>
 #include <syscall.h>
@@ -34,104 +40,36 @@
 
 #include "filter.h"
 
-namespace {
-int _get_offs_for_arg(int arg) {
-  switch (arg) {
-  case 1:
-    return RDI;
-  case 2:
-    return RSI;
-  default:
-    fprintf(stderr, "no support for arguments greater than two yet");
-    exit(1);
-  }
-}
-
-// assumes file is 2nd argument
-void _read_file(pid_t child, char *file, int arg) {
-  char *child_addr;
-  size_t i;
-
-  int offs = _get_offs_for_arg(arg);
-  child_addr = (char *)ptrace(PTRACE_PEEKUSER, child, sizeof(long) * offs, 0);
+#ifndef TFD_IOC_SET_TICKS
+// from linux/timerfd.h, which can't be included alongside sys/timerfd.h
+#define TFD_IOC_SET_TICKS _IOW('T', 0, uint64_t)
+#endif
 
-  do {
-    long val;
-    char *p;
-
-    val = ptrace(PTRACE_PEEKTEXT, child, child_addr, NULL);
-    if (val == -1) {
-      fprintf(stderr, "PTRACE_PEEKTEXT error: %s", strerror(errno));
-      exit(1);
-    }
-    child_addr += sizeof(long);
-
-    p = (char *)&val;
-    for (i = 0; i < sizeof(long); ++i, ++file) {
-      *file = *p++;
-      if (*file == '\0')
-        break;
-    }
-  } while (i == sizeof(long));
+namespace {
+// reads the path pointed to by the given argument
+std::string _read_file(SyscallStop &stop, TraceeMemory &mem, int arg) {
+  return mem.read_string(stop.arg(arg), PATH_MAX);
 }
 
-void _redirect_file(pid_t child, const char *file, int arg) {
-  char *stack_addr, *file_addr;
-  int offs = _get_offs_for_arg(arg);
-
-  stack_addr = (char *)ptrace(PTRACE_PEEKUSER, child, sizeof(long) * RSP, 0);
+void _redirect_file(SyscallStop &stop, TraceeMemory &mem,
+                    const std::string &file, int arg) {
+  uint64_t stack_addr = stop.regs().rsp;
   /* Move further of red zone and make sure we have space for the file name */
   stack_addr -= 128 + PATH_MAX;
-  file_addr = stack_addr;
 
   /* Write new file in lower part of the stack */
-  do {
-    size_t i;
-    char val[sizeof(long)];
-
-    for (i = 0; i < sizeof(long); ++i, ++file) {
-      val[i] = *file;
-      if (*file == '\0')
-        break;
-    }
-
-    ptrace(PTRACE_POKETEXT, child, stack_addr, *(long *)val);
-    stack_addr += sizeof(long);
-  } while (*file);
+  mem.write(file.c_str(), stack_addr,
+            std::min(file.size() + 1, (size_t)PATH_MAX));
 
   /* Change argument to open */
-  ptrace(PTRACE_POKEUSER, child, sizeof(long) * offs, file_addr);
-}
-
-void _read_from_proc(pid_t child, char *out, char *addr, size_t len) {
-  size_t i = 0;
-  while (i < len) {
-    long val;
-
-    val = ptrace(PTRACE_PEEKTEXT, child, addr + i, NULL);
-    if (val == -1) {
-      fprintf(stderr, "failed to PEEKTEXT\n");
-      exit(1);
-    }
-
-    memcpy(out + i, &val, sizeof(long));
-    i += sizeof(long);
-  }
+  stop.set_arg(arg, stack_addr);
 }
 
-void _write_to_proc(pid_t child, char *to_write, char *addr, size_t len) {
-  size_t i = 0;
-  while (i < len) {
-    char val[sizeof(long)];
-    memcpy(val, to_write + i, sizeof(long));
-
-    long ret = ptrace(PTRACE_POKETEXT, child, addr + i, *(long *)val);
-    if (ret == -1) {
-      exit(1);
-    }
-
-    i += sizeof(long);
-  }
+// getrandom never hands back more than this in one call, so an answer at the
+// seccomp stop can't either
+size_t _getrandom_len(size_t buflen) {
+  const size_t GETRANDOM_MAX = (1 << 25) - 1;
+  return std::min(buflen, GETRANDOM_MAX);
 }
 
 bool _startswith(std::string str, std::string prefix) {
@@ -159,6 +97,21 @@ bool _exists(std::string file) {
   return true;
 }
 
+// whether a file could be made at path: nothing is there, and the directory
+// it would go in is
+bool _can_create(const std::string &path) {
+  struct stat buf;
+  if (stat(path.c_str(), &buf) == 0 || errno != ENOENT) {
+    return false;
+  }
+  size_t slash = path.rfind('/');
+  if (slash == std::string::npos || slash == 0) {
+    return true;
+  }
+  return stat(path.substr(0, slash).c_str(), &buf) == 0 &&
+         S_ISDIR(buf.st_mode);
+}
+
 void _remove_dir(const char *path) {
   struct dirent *entry = NULL;
   DIR *dir = NULL;
@@ -189,15 +142,28 @@ void _remove_dir(const char *path) {
 namespace Filter {
 
 const std::string Manager::suffix = ".__bk";
+constexpr Manager::Intercept Manager::syscalls_intercept[];
+constexpr SyscallIndex Manager::intercept_index =
+    make_syscall_index(Manager::syscalls_intercept);
 
 Manager::Manager(int my_idx, std::vector<std::string> command,
                  sockaddr_in old_addr, sockaddr_in new_addr, FdMap &fdmap,
-                 std::string prefix, bool ignore_stdout)
+                 std::string prefix, bool ignore_stdout, Backend backend,
+                 bool emulate_at_entry, std::string vclock_shim,
+                 Transport transport, PersistMode persist_mode,
+                 bool dirty_backups, ChunkStore *chunks, bool mem_files)
     : my_idx(my_idx), command(command), vtime{244244, 244244244},
-      ignore_stdout(ignore_stdout), child_state(ST_DEAD), fdmap(fdmap),
-      old_addr(old_addr), new_addr(new_addr), sockfds(), prefix(prefix), fds(),
-      file_vers(), file_pers(), file_pending(), rename_srcs(), ops_done(0),
-      op_count(0), pending_ops(), restore_map() {
+      vclock_shim(vclock_shim), vclock_fd(-1), vclock(nullptr),
+      backend(backend), emulate_at_entry(emulate_at_entry), notif_fd(-1),
+      in_ptrace_stop(false), num_traps(0),
+      notif_pending(false), ignore_stdout(ignore_stdout),
+      child_state(ST_DEAD), fdmap(fdmap),
+      old_addr(old_addr), new_addr(new_addr), transport(transport), sockfds(),
+      vtimers(),
+      prefix(prefix), persist(persist_mode), dirty_backups(dirty_backups),
+      dirty(), fd_copies(), chunks(chunks), manifests(), mem_files(mem_files),
+      memfs(), fds(),
+      file_vers(), file_pers(), versions(), restore_map() {
   printf("[FILTER] creating with command: ");
   for (auto str : command) {
     printf("%s ", str.c_str());
@@ -223,11 +189,27 @@ void Manager::toggle_node() {
 }
 
 void Manager::start_node() {
+  // used to hand the seccomp listener back to us if using notifications
+  int socks[2] = {-1, -1};
+  if (backend == BK_NOTIF &&
+      socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, socks) < 0) {
+    fprintf(stderr, "[FILTER] socketpair failed: %s\n", strerror(errno));
+    exit(1);
+  }
+  if (!vclock_shim.empty() && vclock == nullptr) {
+    // kept for the manager's lifetime, so vtime carries over across restarts
+    vclock_fd = VClock::create(&vclock);
+    vclock->step_ns = VTIME_STEP_NS;
+  }
+  publish_vtime();
+
   pid_t pid;
   if ((pid = fork()) == 0) {
     /* If open syscall, trace */
+    // O_CLOEXEC so only the dup2'd copy survives exec, which keeps the node's
+    // fd numbering the same regardless of backend
     if (ignore_stdout) {
-      int devNull = open("/dev/null", O_WRONLY);
+      int devNull = open("/dev/null", O_WRONLY | O_CLOEXEC);
       dup2(devNull, STDOUT_FILENO);
     } else {
       std::ostringstream oss;
@@ -236,30 +218,21 @@ void Manager::start_node() {
       oss << "_";
       oss << ntohs(old_addr.sin_port);
       std::string blah = oss.str();
-      int file = open(blah.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+      int file =
+          open(blah.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
       dup2(file, STDOUT_FILENO);
     }
+    if (vclock != nullptr) {
+      VClock::prepare_node(vclock_fd, vclock_shim);
+    }
 
     // set up seccomp for tracing syscalls
     // https://www.alfonsobeato.net/c/filter-and-modify-system-calls-with-seccomp-and-ptrace/
-    int n_syscalls =
-        (sizeof(syscalls_intercept) / sizeof(syscalls_intercept[0]));
-    int filter_len = n_syscalls + 3;
-
-    struct sock_filter filter[filter_len];
-    filter[0] =
-        BPF_STMT(BPF_LD + BPF_W + BPF_ABS, offsetof(struct seccomp_data, nr));
-    filter[filter_len - 2] = BPF_STMT(BPF_RET + BPF_K, SECCOMP_RET_ALLOW);
-    filter[filter_len - 1] = BPF_STMT(BPF_RET + BPF_K, SECCOMP_RET_TRACE);
-
-    for (int i = 0; i < n_syscalls; i++) {
-      filter[i + 1] = BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, syscalls_intercept[i],
-                               u_int8_t(n_syscalls - i), 0);
-    }
-
+    std::vector<struct sock_filter> filter = build_seccomp_filter(
+        syscalls_intercept, backend == BK_NOTIF, TRACKED_FD_BASE);
     struct sock_fprog prog = {
-        (unsigned short)(sizeof(filter) / sizeof(filter[0])),
-        filter,
+        (unsigned short)filter.size(),
+        &filter[0],
     };
     ptrace(PTRACE_TRACEME, 0, 0, 0);
     /* To avoid the need for CAP_SYS_ADMIN */
@@ -267,7 +240,10 @@ void Manager::start_node() {
       perror("prctl(PR_SET_NO_NEW_PRIVS)");
       exit(1);
     }
-    if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) == -1) {
+    if (backend == BK_NOTIF) {
+      close(socks[0]);
+      Notif::install_and_send(&prog, socks[1]);
+    } else if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) == -1) {
       perror("when setting seccomp filter");
       exit(1);
     }
@@ -291,6 +267,11 @@ void Manager::start_node() {
   waitpid(pid, &status, 0);
   ptrace(PTRACE_SETOPTIONS, pid, 0,
          PTRACE_O_TRACESECCOMP | PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEEXEC);
+  if (backend == BK_NOTIF) {
+    close(socks[1]);
+    notif_fd = Notif::recv_listener(socks[0]);
+    close(socks[0]);
+  }
 
   {
     // disable vDSO to ensure we can intercept gettimeofday
@@ -302,35 +283,46 @@ void Manager::start_node() {
       waitpid(pid, &status, 0);
     }
     printf("[FILTER] hit exec point\n");
+    mem.attach(child);
+    stop.attach(child);
     // before exec starts, we overwrite AT_SYSINFO_EHDR
-    char todo[4000];
-    long rsp = ptrace(PTRACE_PEEKUSER, child, sizeof(long) * RSP, 0);
-    size_t num_to_get = command.size() + 150;
-    _read_from_proc(child, (char *)todo, (char *)rsp,
-                    num_to_get * sizeof(long));
+    // initial stack is argc, argv..., NULL, envp..., NULL, auxv pairs...
+    const size_t CHUNK = 512;
+    std::vector<long> stack;
+    uint64_t rsp = stop.regs().rsp;
     int num_nulls = 0;
-    int auxv_idx = 0;
     bool did_overwrite = false;
-    for (size_t i = 0; i < num_to_get; i++) {
-      long ptr = *(long *)(&todo[i * sizeof(long)]);
-
-      printf("[FILTER] this ptr: %lx\n", ptr);
-      if (num_nulls == 2) {
-        auxv_idx++;
-        if (auxv_idx == 2) {
-          // AT_SYSINFO_EHDR (vDSO location) experimentally found to be 2nd
-          // element in aux vector (at least in my OS **thinking**)
-          printf("[FILTER] overwriting vDSO: %lx\n", ptr);
-          did_overwrite = true;
-          long null = 0;
-          _write_to_proc(child, (char *)&null, (char *)rsp + (i * sizeof(long)),
-                         sizeof(long));
-          break;
+    size_t i = 1; // skip argc
+    while (!did_overwrite) {
+      while (i + 1 >= stack.size()) {
+        // pull in the rest of the current page of the stack in one go. don't
+        // go past it, since the stack may end there. a pair can straddle the
+        // end of one, so keep going until both its words are in
+        size_t old_size = stack.size();
+        uint64_t addr = rsp + old_size * sizeof(long);
+        size_t to_get = std::min(CHUNK, (4096 - (addr & 4095)) / sizeof(long));
+        stack.resize(old_size + to_get);
+        mem.read(&stack[old_size], addr, to_get * sizeof(long));
+      }
+      if (num_nulls < 2) {
+        if (stack[i] == 0) {
+          num_nulls++;
         }
+        i++;
+        continue;
       }
-      if (ptr == 0) {
-        num_nulls++;
+      // in the aux vector, so look at (type, value) pairs
+      long type = stack[i];
+      printf("[FILTER] auxv type: %ld value: %lx\n", type, stack[i + 1]);
+      if (type == AT_NULL) {
+        break;
+      } else if (type == AT_SYSINFO_EHDR) {
+        printf("[FILTER] overwriting vDSO: %lx\n", stack[i + 1]);
+        did_overwrite = true;
+        long null = 0;
+        mem.write(&null, rsp + (i + 1) * sizeof(long), sizeof(long));
       }
+      i += 2;
     }
     if (!did_overwrite) {
       fprintf(stderr, "[FILTER] Failed to overwrite vDSO\n");
@@ -339,6 +331,8 @@ void Manager::start_node() {
   }
 
   child_state = ST_STOPPED;
+  in_ptrace_stop = true;
+  num_traps = 0;
 }
 
 void Manager::stop_node() {
@@ -348,30 +342,37 @@ void Manager::stop_node() {
     ;
   child = -1;
   child_state = ST_DEAD;
+  in_ptrace_stop = false;
+  notif_pending = false;
+  mem.detach();
+  stop.detach();
+  if (notif_fd >= 0) {
+    close(notif_fd);
+    notif_fd = -1;
+  }
 
   fds.clear();
   sockfds.clear();
+  for (auto &tup : vtimers) {
+    close(tup.second.localfd);
+  }
+  vtimers.clear();
+  for (auto &tup : fd_copies) {
+    close(tup.second);
+  }
+  fd_copies.clear();
   // delete any unnecessary files for GC
-  for (auto &op : pending_ops) {
-    auto src = op.second.first;
-    std::string try_delete = get_backup_filename(src.first, src.second);
-    if (_exists(try_delete)) {
-      unlink(try_delete.c_str());
-    }
+  for (const RenameOp &op : versions.ops()) {
+    drop_backup(
+        get_backup_filename(versions.path(op.src.file), op.src.version));
   }
   for (auto &tup : file_vers) {
     std::string latest_write(tup.first);
     latest_write.append(".latest").append(suffix);
-    std::ofstream out(latest_write);
-    std::ifstream in(tup.first);
-    out << in.rdbuf();
+    save_backup(tup.first, latest_write);
   }
   // clear any operation-related structures
-  file_pending.clear();
-  ops_done = 0;
-  op_count = 0;
-  pending_ops.clear();
-  rename_srcs.clear();
+  versions.clear();
 
   fdmap.clear_nodefds(my_idx);
 }
@@ -388,105 +389,44 @@ Event Manager::to_next_event() {
 
   int status;
   while (1) {
-    ptrace(PTRACE_CONT, child, 0, 0);
-    waitpid(child, &status, 0);
+    if (wait_child(&status)) {
+      // tracee is blocked on a notification rather than in a ptrace stop
+      Event ev;
+      if (handle_notif(&ev)) {
+        return ev;
+      }
+      continue;
+    }
+    mem.next_stop();
     if (WIFSTOPPED(status)) {
       if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_SECCOMP << 8))) {
-        increment_vtime(0, 1000);
+        increment_vtime(0, VTIME_STEP_NS);
+        num_traps++;
         // check if it's one of the syscalls we want to handle
-        int my_syscall =
-            ptrace(PTRACE_PEEKUSER, child, sizeof(long) * ORIG_RAX, 0);
+        long my_syscall = stop.nr();
         if (my_syscall > 0) {
           // If attempting to read the data failed, that may be because
           // program's still running
           child_state = ST_STOPPED;
         }
-        switch (my_syscall) {
-          // polling-related
-        case SYS_poll:
-        case SYS_select:
-          child_state = ST_POLLING;
-          return EV_POLLING;
-        case SYS_gettimeofday:
-          handle_gettimeofday();
-          continue;
-        case SYS_clock_gettime:
-          handle_clock_gettime();
-          continue;
-        case SYS_getrandom:
-          child_state = ST_RANDOM;
-          return EV_RANDOM;
-
-          // filesystem-related
-        case SYS_openat:
-          handle_open(true);
-          continue;
-        case SYS_creat:
-          // handle like open since pathname in same place and we're not
-          // thinking too deeply about mode right now
-          // TODO think a bit more deeply about mode?
-        case SYS_open:
-          handle_open(false);
-          continue;
-        case SYS_mknod:
-          handle_mknod(1);
-          continue;
-        case SYS_mknodat:
-          handle_mknod(2);
-          continue;
-
-        case SYS_write:
-          child_state = ST_FILES;
-          return EV_WRITE;
-        case SYS_rename:
-          handle_rename();
-          continue;
-        case SYS_renameat:
-          // TODO if time, handle renameat
-          fprintf(stderr, "unaccounted for renameat\n");
-          exit(1);
-          break;
-        case SYS_syncfs:
-          // TODO if time, handle syncfs
-          fprintf(stderr, "unaccounted for syncfs\n");
-          exit(1);
-          break;
-        case SYS_fdatasync:
-        case SYS_fsync:
-          child_state = ST_FILES;
-          return EV_FSYNC;
-
-          // network-related
-        case SYS_socket:
-          handle_socket();
-          continue;
-        case SYS_bind:
-          handle_bind();
-          continue;
-        case SYS_close:
-          handle_close();
-          continue;
-        case SYS_getsockname:
-          handle_getsockname();
-          continue;
-        case SYS_accept4:
-        case SYS_accept:
-          handle_accept();
-          continue;
-        case SYS_connect:
-          child_state = ST_NETWORK;
-          return EV_CONNECT;
-        case SYS_sendto:
-          child_state = ST_NETWORK;
-          return EV_SENDTO;
-        default:
+        int idx = intercept_index.find(my_syscall);
+        if (idx < 0) {
           continue;
         }
+        const Intercept &icpt = syscalls_intercept[idx];
+        if (icpt.handle != nullptr) {
+          (this->*icpt.handle)();
+        }
+        if (icpt.ev != EV_INTERNAL) {
+          child_state = icpt.state;
+          return icpt.ev;
+        }
+        continue;
       } else {
         child_state = ST_STOPPED;
       }
     } else if (WIFEXITED(status)) {
-      printf("[FILTER] exited\n");
+      printf("[FILTER] exited after %lu traps\n", num_traps);
       child_state = ST_DEAD;
       return EV_EXIT;
     } else {
@@ -496,6 +436,64 @@ Event Manager::to_next_event() {
   }
 }
 
+bool Manager::wait_child(int *status) {
+  if (in_ptrace_stop) {
+    stop.flush();
+    ptrace(PTRACE_CONT, child, 0, 0);
+    in_ptrace_stop = false;
+  }
+  stop.next_stop();
+  if (backend == BK_NOTIF) {
+    bool is_notif = Notif::wait(child, notif_fd, status);
+    collect_vtime();
+    if (is_notif) {
+      return true;
+    }
+  } else {
+    waitpid(child, status, 0);
+    collect_vtime();
+  }
+  in_ptrace_stop = WIFSTOPPED(*status);
+  return false;
+}
+
+bool Manager::handle_notif(Event *ev) {
+  mem.next_stop();
+  if (!Notif::recv(notif_fd, &notif_req)) {
+    // child went away, so let waitpid tell us what happened
+    return false;
+  }
+  // keep vtime identical to the ptrace backend
+  increment_vtime(0, VTIME_STEP_NS);
+  num_traps++;
+  child_state = ST_STOPPED;
+  int idx = intercept_index.find(notif_req.data.nr);
+  if (idx < 0 || syscalls_intercept[idx].handle_notif == nullptr) {
+    fprintf(stderr, "[FILTER] unexpected notification for syscall %d\n",
+            notif_req.data.nr);
+    Notif::respond_continue(notif_fd, notif_req.id);
+    return false;
+  }
+  const Intercept &icpt = syscalls_intercept[idx];
+  (this->*icpt.handle_notif)();
+  if (icpt.ev != EV_INTERNAL) {
+    child_state = icpt.state;
+    *ev = icpt.ev;
+    return true;
+  }
+  return false;
+}
+
+void Manager::notif_getrandom() {
+  // needs the decider, so answered in handle_getrandom
+  notif_pending = true;
+}
+
+void Manager::handle_unsupported() {
+  fprintf(stderr, "unaccounted for syscall %ld\n", stop.nr());
+  exit(1);
+}
+
 int Manager::allow_event(Event ev) {
   child_state = ST_STOPPED;
   switch (ev) {
@@ -518,42 +516,34 @@ void Manager::backup_file(int fd) {
   printf("[FILTER] starting backup_file on %s\n", curr_loc.c_str());
 
   struct stat s;
-  if (stat(curr_loc.c_str(), &s) == 0) {
+  if (stat(file_path(curr_loc).c_str(), &s) == 0) {
     if (S_ISDIR(s.st_mode)) {
       printf("[FILTER] backing up directory\n");
       // perform rename ops until no more pending ops for any files in the dir
-      size_t last_rename = 0;
-      for (auto it = file_pending.begin(); it != file_pending.end(); it++) {
-        if (_startswith(it->first, curr_loc) &&
-            it->first.find('/', curr_loc.length() + 1) == it->first.npos) {
-          // direct child of dir, should perform all ops out of or into
-          if (it->second.back() > last_rename) {
-            last_rename = it->second.back();
-          }
-        }
-      }
-      while (ops_done < last_rename) {
+      size_t last_rename = versions.last_op_in(versions.find(curr_loc));
+      while (versions.done() < last_rename) {
         perform_next_op();
       }
     } else if (S_ISREG(s.st_mode)) {
       // persist data based on dependencies
       int curr_vers = file_vers[curr_loc];
+      int old_pers = file_pers[curr_loc];
       file_pers[curr_loc] = curr_vers;
       std::string my_file = get_backup_filename(curr_loc, curr_vers);
       bool has_root = false;
-      if (!_exists(my_file)) {
-        auto root = find_root(curr_loc, curr_vers);
-        if (curr_loc.compare(root.first) != 0 || curr_vers != root.second) {
+      int file = versions.find(curr_loc);
+      if (!backup_exists(my_file) && file >= 0) {
+        FileVersion root = versions.root({file, curr_vers});
+        if (!(root == FileVersion{file, curr_vers})) {
           has_root = true;
           // we have a root, which means we should persist data at the root
           // rather than at our filename (since the renames haven't happened
           // yet)
-          std::string out_file = get_backup_filename(root.first, root.second);
+          std::string out_file =
+              get_backup_filename(versions.path(root.file), root.version);
           printf("[FILTER] Found root for fsync. Copying %s to %s\n",
                  curr_loc.c_str(), out_file.c_str());
-          std::ifstream src(curr_loc, std::ios::binary);
-          std::ofstream dst(out_file, std::ios::binary);
-          dst << src.rdbuf();
+          save_backup(curr_loc, out_file);
         }
       }
       if (!has_root) {
@@ -563,12 +553,25 @@ void Manager::backup_file(int fd) {
         // TODO it's probably more correct to persist after all file changes,
         // but it _should_ be fine due to versioning
         std::string out_file = get_backup_filename(curr_loc, curr_vers);
-        printf("[FILTER] No root for fsync. Copying %s to %s\n",
-               curr_loc.c_str(), out_file.c_str());
-        std::ifstream src(curr_loc, std::ios::binary);
-        std::ofstream dst(out_file, std::ios::binary);
-        dst << src.rdbuf();
+        auto d = dirty.find(curr_loc);
+        if (d != dirty.end() && d->second.version == curr_vers &&
+            save_backup(curr_loc, out_file, &d->second.extents)) {
+          printf("[FILTER] No root for fsync. Updating %s from %s\n",
+                 out_file.c_str(), curr_loc.c_str());
+        } else {
+          printf("[FILTER] No root for fsync. Copying %s to %s\n",
+                 curr_loc.c_str(), out_file.c_str());
+          save_backup(curr_loc, out_file);
+        }
+        if (dirty_backups) {
+          dirty[curr_loc].version = curr_vers;
+          dirty[curr_loc].extents.clear();
+        }
+      } else {
+        // its own backup (if any) is behind, and will be renamed away
+        dirty.erase(curr_loc);
       }
+      drop_superseded(curr_loc, old_pers);
     } else {
       fprintf(stderr, "[FILTER] unexpected filetype of: %s\n",
               curr_loc.c_str());
@@ -583,24 +586,24 @@ void Manager::backup_file(int fd) {
   }
 }
 
-std::pair<std::string, int> Manager::find_root(std::string file, int version) {
-  printf("[FILTER] starting find_root\n");
-  auto it = pending_ops.rbegin();
-  for (; it != pending_ops.rend(); it++) {
-    auto op = it->second;
-    auto src = op.first;
-    auto dst = op.second;
-    if (dst.first.compare(file) == 0 && version == dst.second) {
-      file = src.first;
-      version = src.second;
-    }
-  }
-  return {file, version};
-}
-
 void Manager::setup_validate() {
   printf("[FILTER] starting validation setup\n");
   restore_map.reserve(file_vers.size());
+  if (mem_files) {
+    // nothing of the node's is on disk, so its persisted state can be written
+    // out where the validator looks without moving anything aside
+    for (const auto &tup : file_vers) {
+      std::string back_file =
+          get_backup_filename(tup.first, file_pers.at(tup.first));
+      if (backup_exists(back_file)) {
+        printf("[FILTER] Writing out %s to %s\n", back_file.c_str(),
+               tup.first.c_str());
+        write_backup(back_file, tup.first);
+        restore_map.push_back({tup.first, ""});
+      }
+    }
+    return;
+  }
   for (const auto &tup : file_vers) {
     std::ostringstream oss;
     oss << tup.first;
@@ -614,11 +617,21 @@ void Manager::setup_validate() {
       printf("[FILTER] Rename successful\n");
     }
   }
-  restore_files();
+  // the files are put back as they were by finish_validate, so their Dirty
+  // still holds
+  restore_files(false);
 }
 
 void Manager::finish_validate() {
   for (const auto &tup : restore_map) {
+    if (tup.second.empty()) {
+      printf("[FILTER] Removing %s\n", tup.first.c_str());
+      if (unlink(tup.first.c_str()) < 0) {
+        fprintf(stderr, "[FILTER] Remove unsuccessful\n");
+        exit(1);
+      }
+      continue;
+    }
     printf("[FILTER] Restoring %s to %s\n", tup.second.c_str(),
            tup.first.c_str());
     if (rename(tup.second.c_str(), tup.first.c_str()) < 0) {
@@ -629,53 +642,109 @@ void Manager::finish_validate() {
   restore_map.clear();
 }
 
-void Manager::restore_files() {
+void Manager::restore_files(bool incremental) {
   printf("[FILTER] starting restore_files\n");
   for (auto &tup : file_vers) {
     printf("[FILTER] Attempting to restore %s\n", tup.first.c_str());
-    std::string back_file =
-        get_backup_filename(tup.first, file_pers.at(tup.first));
-    if (_exists(back_file)) {
+    int pers = file_pers.at(tup.first);
+    std::string back_file = get_backup_filename(tup.first, pers);
+    auto d = dirty.find(tup.first);
+    if (!backup_exists(back_file)) {
+      printf("[FILTER] %s not found, nop\n", back_file.c_str());
+      if (incremental && d != dirty.end()) {
+        dirty.erase(d);
+      }
+      continue;
+    }
+    // the file is only its backup plus what's been written if nothing's
+    // happened to it since (its version is still the one backed up)
+    bool in_sync = d != dirty.end() && d->second.version == pers &&
+                   tup.second == pers;
+    if (incremental && in_sync &&
+        load_backup(back_file, tup.first, &d->second.extents)) {
+      printf("[FILTER] Updating %s from %s\n", tup.first.c_str(),
+             back_file.c_str());
+    } else {
       printf("[FILTER] Copying %s to %s\n", back_file.c_str(),
              tup.first.c_str());
-      std::ifstream src(back_file, std::ios::binary);
-      std::ofstream dst(tup.first, std::ios::binary);
-      dst << src.rdbuf();
-    } else {
-      printf("[FILTER] %s not found, nop\n", back_file.c_str());
+      load_backup(back_file, tup.first);
+    }
+    if (!incremental) {
+      continue;
+    } else if (dirty_backups && tup.second == pers) {
+      dirty[tup.first].version = pers;
+      dirty[tup.first].extents.clear();
+    } else if (d != dirty.end()) {
+      dirty.erase(d);
     }
   }
 }
 
-void Manager::handle_open(bool at) {
-  char orig_file[PATH_MAX];
-
-  int arg = at ? 2 : 1;
-  _read_file(child, orig_file, arg);
-  printf("[FILTER] handling open%s: %s\n", at ? "at" : "", orig_file);
-  std::string to_open(orig_file);
+void Manager::handle_open() {
+  bool at = stop.nr() == SYS_openat;
+  int arg = at ? 1 : 0;
+  std::string to_open = _read_file(stop, mem, arg);
+  // creat has no flags, and never sets O_CLOEXEC
+  bool cloexec = stop.nr() != SYS_creat && (stop.arg(arg + 1) & O_CLOEXEC);
+  bool trunc = stop.nr() == SYS_creat || (stop.arg(arg + 1) & O_TRUNC);
+  printf("[FILTER] handling open%s: %s\n", at ? "at" : "", to_open.c_str());
 
   if (_startswith(to_open, prefix)) {
     // store existence of file to check if it was created
     bool exists =
         file_vers.find(to_open) != file_vers.end()
-            ? _exists(get_backup_filename(to_open, file_vers[to_open]))
+            ? backup_exists(get_backup_filename(to_open, file_vers[to_open]))
             : false;
+    // with mem_files, regular files are opened as their memfds, under the
+    // same flags apart from ones that can't apply to a /proc fd link
+    uint64_t path_ptr = stop.arg(arg);
+    uint64_t flags = stop.arg(arg + 1);
+    bool redirected = false;
+    if (mem_files && to_open[to_open.size() - 1] != '/') {
+      bool create = stop.nr() == SYS_creat || (flags & O_CREAT);
+      if (in_memory(to_open)) {
+        if (stop.nr() != SYS_creat && (flags & O_CREAT) && (flags & O_EXCL)) {
+          skip_syscall(-EEXIST);
+          return;
+        }
+      } else if (create && _can_create(to_open)) {
+        memfs.create(to_open);
+      }
+      if (memfs.fd(to_open) >= 0) {
+        _redirect_file(stop, mem, memfs.proc_path(to_open), arg);
+        if (stop.nr() != SYS_creat) {
+          stop.set_arg(arg + 1, flags & ~(O_EXCL | O_NOFOLLOW));
+        }
+        redirected = true;
+      }
+    }
     // get file descriptor for the opened file so we can register it
     int status;
-    ptrace(PTRACE_SYSCALL, child, 0, 0);
-    waitpid(child, &status, 0);
-    if (WIFSTOPPED(status) && WSTOPSIG(status) & 0x80) {
-      int fd = (int)ptrace(PTRACE_PEEKUSER, child, sizeof(long) * RAX, 0);
+    if (stop.to_exit(&status)) {
+      if (redirected) {
+        stop.set_arg(arg, path_ptr);
+        if (stop.nr() != SYS_creat) {
+          stop.set_arg(arg + 1, flags);
+        }
+      }
+      int fd = (int)stop.ret();
       printf("return val: %d\n", fd);
       if (fd >= 0) {
+        fd = relocate_fd(cloexec);
+        auto copy = fd_copies.find(fd);
+        if (copy != fd_copies.end()) {
+          // left over from an fd closed without us seeing it
+          close(copy->second);
+          fd_copies.erase(copy);
+        }
         if (to_open[to_open.size() - 1] == '/') {
           to_open = to_open.substr(0, to_open.size() - 1);
         }
         fds[fd] = to_open;
         // only maintain versions for regular files (not directories)
         struct stat s;
-        if (stat(to_open.c_str(), &s) == 0 && S_ISREG(s.st_mode)) {
+        if (stat(file_path(to_open).c_str(), &s) == 0 &&
+            S_ISREG(s.st_mode)) {
           printf("[FILTER] opened a regular file, track file_vers\n");
           if (file_vers.find(to_open) == file_vers.end()) {
             file_vers[to_open] = 0;
@@ -684,27 +753,39 @@ void Manager::handle_open(bool at) {
           if (!exists) {
             file_vers[to_open]++;
           }
+          if (trunc) {
+            note_write(to_open, 0, TO_EOF);
+          }
         }
       }
     }
   }
 }
 
-void Manager::handle_mknod(int arg) {
-  char orig_file[PATH_MAX];
-
-  _read_file(child, orig_file, arg);
-  printf("[FILTER] handling mknod: %s\n", orig_file);
-  std::string to_mknod(orig_file);
+void Manager::handle_mknod() {
+  int arg = stop.nr() == SYS_mknodat ? 1 : 0;
+  std::string to_mknod = _read_file(stop, mem, arg);
+  printf("[FILTER] handling mknod: %s\n", to_mknod.c_str());
 
   if (_startswith(to_mknod, prefix)) {
+    mode_t mode = stop.arg(arg + 1) & S_IFMT;
+    if (mem_files && (mode == 0 || mode == S_IFREG)) {
+      if (in_memory(to_mknod)) {
+        skip_syscall(-EEXIST);
+        return;
+      } else if (_can_create(to_mknod)) {
+        memfs.create(to_mknod);
+        skip_syscall(0);
+        file_vers[to_mknod]++;
+        return;
+      }
+      // fails on disk the way it should
+    }
     // get file descriptor for the opened file so we can register it
     int status;
-    ptrace(PTRACE_SYSCALL, child, 0, 0);
-    waitpid(child, &status, 0);
-    if (WIFSTOPPED(status) && WSTOPSIG(status) & 0x80) {
+    if (stop.to_exit(&status)) {
       uint64_t ret =
-          (uint64_t)ptrace(PTRACE_PEEKUSER, child, sizeof(long) * RAX, 0);
+          (uint64_t)stop.ret();
       printf("return val: %lu\n", ret);
       if (ret == 0) {
         if (to_mknod[to_mknod.size() - 1] == '/') {
@@ -716,22 +797,39 @@ void Manager::handle_mknod(int arg) {
   }
 }
 
-int Manager::handle_rename() {
+void Manager::handle_rename() {
   printf("[FILTER] handling rename\n");
 
-  char src[PATH_MAX];
-  char dst[PATH_MAX];
-  _read_file(child, src, 1);
-  _read_file(child, dst, 2);
+  std::string src_str = _read_file(stop, mem, 0);
+  std::string dst_str = _read_file(stop, mem, 1);
+  const char *src = src_str.c_str();
+  const char *dst = dst_str.c_str();
   printf("[FILTER] renaming %s to %s\n", src, dst);
-  if (strncmp(prefix.c_str(), src, strlen(prefix.c_str())) == 0 &&
-      strncmp(prefix.c_str(), dst, strlen(prefix.c_str())) == 0) {
+  if (_startswith(src_str, prefix) && _startswith(dst_str, prefix)) {
+    if (mem_files) {
+      // only memfs changes, so the node's disk is never touched
+      struct stat s;
+      if (in_memory(src_str)) {
+        if (!in_memory(dst_str) && stat(dst, &s) == 0) {
+          // something other than a regular file, which is left on disk
+          skip_syscall(-EISDIR);
+          return;
+        }
+        memfs.rename(src_str, dst_str);
+        skip_syscall(0);
+        note_rename(src_str, dst_str);
+        return;
+      } else if (stat(src, &s) == 0) {
+        fprintf(stderr, "[FILTER] rename on directories not supported\n");
+        exit(1);
+      }
+      skip_syscall(-ENOENT);
+      return;
+    }
     int status;
-    ptrace(PTRACE_SYSCALL, child, 0, 0);
-    waitpid(child, &status, 0);
-    if (WIFSTOPPED(status) && WSTOPSIG(status) & 0x80) {
+    if (stop.to_exit(&status)) {
       uint64_t ret =
-          (uint64_t)ptrace(PTRACE_PEEKUSER, child, sizeof(long) * RAX, 0);
+          (uint64_t)stop.ret();
       printf("[FILTER] return val: %lu\n", ret);
       if (ret == 0) {
         struct stat s;
@@ -744,87 +842,63 @@ int Manager::handle_rename() {
           fprintf(stderr, "[FILTER] rename on directories not supported\n");
           exit(1);
         }
-        std::string src_str(src);
-        std::string dst_str(dst);
-        // register new rename op
-        // TODO can we somehow GC pending ops that don't matter anymore?
-        op_count++;
-        file_vers[dst_str]++;
-        if (file_pers.find(dst_str) == file_pers.end()) {
-          file_pers[dst_str] = 0;
-        }
-        pending_ops[op_count] = {{src_str, file_vers[src_str]},
-                                 {dst_str, file_vers[dst_str]}};
-        if (file_pending.find(dst_str) == file_pending.end()) {
-          file_pending[dst_str] = {};
-        }
-        if (file_pending.find(src_str) == file_pending.end()) {
-          file_pending[src_str] = {};
-        }
-        file_pending[dst_str].push_back(op_count);
-        file_pending[src_str].push_back(op_count);
-        printf("[FILTER] registered new rename op %lu for (%s,%d) -> (%s,%d)\n",
-               op_count, src, file_vers[src_str], dst, file_vers[dst_str]);
-
-        // update current locations of any open fds
-        for (auto &tup : fds) {
-          if (tup.second.compare(src_str)) {
-            tup.second = dst_str;
-          }
-        }
-        file_vers[src_str]++;
+        note_rename(src_str, dst_str);
       }
-      return ret;
+      return;
     }
     // should be unreachable
     fprintf(stderr, "[FILTER] syscall continuation didn't work\n");
     exit(1);
-    return -1;
   } else {
     fprintf(stderr, "[FILTER] rename on non-prefixed files, exiting\n");
     exit(1);
-    return -1; // should be unreachable
   }
 }
 
-void Manager::perform_next_op() {
-  auto it = pending_ops.begin();
-
-  auto op = it->second;
-  auto src = op.first;
-  std::string src_file = get_backup_filename(src.first, src.second);
-  auto dst = op.second;
-  std::string dst_file = get_backup_filename(dst.first, dst.second);
-  printf("[FILTER] performing op %lu (%s -> %s)\n", it->first, src_file.c_str(),
-         dst_file.c_str());
-  if (!_exists(src_file)) {
-    std::ofstream to_create(dst_file);
-  } else {
-    // file exists, move to new file
-    if (rename(src_file.c_str(), dst_file.c_str()) < 0) {
-      fprintf(stderr, "[FILTER] perform_next_op failed to rename due to %s\n",
-              strerror(errno));
-      exit(1);
-    }
-  }
-  if (file_pending[dst.first].front() != it->first) {
-    fprintf(stderr, "[FILTER] mismatching pending idx for dst: %lu vs. %lu\n",
-            file_pending[dst.first].front(), it->first);
-    exit(1);
+void Manager::note_rename(const std::string &src, const std::string &dst) {
+  // register new rename op
+  // TODO can we somehow GC pending ops that don't matter anymore?
+  file_vers[dst]++;
+  if (file_pers.find(dst) == file_pers.end()) {
+    file_pers[dst] = 0;
   }
-  if (file_pending[src.first].front() != it->first) {
-    fprintf(stderr, "[FILTER] mismatching pending idx for src: %lu vs. %lu\n",
-            file_pending[src.first].front(), it->first);
-    exit(1);
+  size_t idx = versions.add({versions.intern(src), file_vers[src]},
+                            {versions.intern(dst), file_vers[dst]});
+  printf("[FILTER] registered new rename op %lu for (%s,%d) -> (%s,%d)\n", idx,
+         src.c_str(), file_vers[src], dst.c_str(), file_vers[dst]);
+
+  // update current locations of any open fds
+  for (auto &tup : fds) {
+    if (tup.second.compare(src) == 0) {
+      tup.second = dst;
+    }
   }
-  file_pending[dst.first].pop_front();
-  file_pending[src.first].pop_front();
-  file_pers[src.first] = std::max(file_pers[src.first], src.second + 1);
-  file_pers[dst.first] = std::max(file_pers[dst.first], dst.second);
+  file_vers[src]++;
+  dirty.erase(src);
+  dirty.erase(dst);
+}
+
+void Manager::perform_next_op() {
+  const RenameOp &op = versions.front();
+  const std::string &src = versions.path(op.src.file);
+  const std::string &dst = versions.path(op.dst.file);
+  std::string src_file = get_backup_filename(src, op.src.version);
+  std::string dst_file = get_backup_filename(dst, op.dst.version);
+  printf("[FILTER] performing op %lu (%s -> %s)\n", op.idx, src_file.c_str(),
+         dst_file.c_str());
+  move_backup(src_file, dst_file);
+  int old_src_pers = file_pers[src], old_dst_pers = file_pers[dst];
+  file_pers[src] = std::max(file_pers[src], op.src.version + 1);
+  file_pers[dst] = std::max(file_pers[dst], op.dst.version);
   printf("[FILTER] updating file_pers to src: %d and dst: %d\n",
-         file_pers[src.first], file_pers[dst.first]);
-  ops_done = it->first;
-  pending_ops.erase(it);
+         file_pers[src], file_pers[dst]);
+  // op goes with pop_front, but the paths stay interned
+  int dst_vers = op.dst.version;
+  versions.pop_front();
+  drop_superseded(src, old_src_pers);
+  drop_superseded(dst, old_dst_pers);
+  // moved into a version that's already behind
+  drop_superseded(dst, dst_vers);
 }
 
 void Manager::handle_fsync(Event ev, std::function<size_t(size_t)> num_ops_fn) {
@@ -836,13 +910,13 @@ void Manager::handle_fsync(Event ev, std::function<size_t(size_t)> num_ops_fn) {
   child_state = ST_STOPPED;
 
   // do some user-defined number of pending operations
-  size_t ops_to_do = num_ops_fn(pending_ops.size());
+  size_t ops_to_do = num_ops_fn(versions.size());
   printf("[FILTER] performing %lu ops before fsync\n", ops_to_do);
   for (size_t i = 0; i < ops_to_do; i++) {
     perform_next_op();
   }
 
-  int fd = (int)ptrace(PTRACE_PEEKUSER, child, sizeof(long) * RDI, 0);
+  int fd = (int)stop.arg(0);
   auto it = fds.find(fd);
   if (it != fds.end()) {
     backup_file(fd);
@@ -859,12 +933,12 @@ int Manager::handle_write(Event ev, std::function<size_t(size_t)> to_write_fn) {
   printf("[FILTER] handling write\n");
   child_state = ST_STOPPED;
 
-  struct user_regs_struct regs;
-  ptrace(PTRACE_GETREGS, child, 0, &regs);
-  int fd = regs.rdi;
-  size_t count = regs.rdx;
+  int fd = stop.arg(0);
+  size_t count = stop.arg(2);
 
   if (fds.find(fd) != fds.end()) {
+    // a partial write writes less, so this covers it either way
+    note_write(fd, AT_POS, count);
     // if this is a filesystem fd into prefix, allow write corruption on it
     size_t to_write = to_write_fn(count);
     if (to_write == count) {
@@ -872,18 +946,14 @@ int Manager::handle_write(Event ev, std::function<size_t(size_t)> to_write_fn) {
     } else {
       // we are failing the entire node after doing a partial write
       printf("[FILTER] write %lu chars before syncing and failing\n", to_write);
-      regs.rdx = to_write;
-      ptrace(PTRACE_SETREGS, child, 0, &regs);
+      stop.set_arg(2, to_write);
       int status;
-      ptrace(PTRACE_SYSCALL, child, 0, 0);
-      waitpid(child, &status, 0);
-      if (WIFSTOPPED(status) && WSTOPSIG(status) & 0x80) {
-        ssize_t ret =
-            (ssize_t)ptrace(PTRACE_PEEKUSER, child, sizeof(long) * RAX, 0);
+      if (stop.to_exit(&status)) {
+        ssize_t ret = stop.ret();
         printf("[FILTER] ret: %lu\n", ret);
 
         // flush all dentry changes and sync fd
-        while (!pending_ops.empty()) {
+        while (!versions.empty()) {
           perform_next_op();
         }
         backup_file(fd);
@@ -896,6 +966,266 @@ int Manager::handle_write(Event ev, std::function<size_t(size_t)> to_write_fn) {
   return 0;
 }
 
+void Manager::handle_pwrite() {
+  int fd = stop.arg(0);
+  auto it = fds.find(fd);
+  if (it == fds.end() || dirty.find(it->second) == dirty.end()) {
+    return;
+  }
+  long nr = stop.nr();
+  if (nr == SYS_pwrite64) {
+    note_write(fd, stop.arg(3), stop.arg(2));
+    return;
+  }
+  // the rest write out iovecs
+  size_t iovcnt = stop.arg(2);
+  if (iovcnt > IOV_MAX) {
+    // fails with EINVAL
+    return;
+  }
+  std::vector<struct iovec> iov(iovcnt);
+  mem.read(iov.data(), stop.arg(1), iovcnt * sizeof(struct iovec));
+  uint64_t len = 0;
+  for (const struct iovec &one : iov) {
+    len += one.iov_len;
+  }
+  int64_t off = AT_POS;
+  if (nr == SYS_pwritev2 && (stop.arg(5) & RWF_APPEND)) {
+    off = AT_END;
+  } else if (nr != SYS_writev && (int64_t)stop.arg(3) != -1) {
+    // pwritev2 at -1 writes at the fd's position, like writev
+    off = stop.arg(3);
+  }
+  note_write(fd, off, len);
+}
+
+void Manager::handle_truncate() {
+  if (mem_files && stop.nr() == SYS_truncate) {
+    std::string to_truncate = _read_file(stop, mem, 0);
+    if (_startswith(to_truncate, prefix) && in_memory(to_truncate)) {
+      note_write(to_truncate, stop.arg(1), TO_EOF);
+      uint64_t path_ptr = stop.arg(0);
+      _redirect_file(stop, mem, memfs.proc_path(to_truncate), 0);
+      int status;
+      if (stop.to_exit(&status)) {
+        stop.set_arg(0, path_ptr);
+      }
+      return;
+    }
+  }
+  if (dirty.empty()) {
+    return;
+  }
+  switch (stop.nr()) {
+  case SYS_truncate:
+    note_write(_read_file(stop, mem, 0), stop.arg(1), TO_EOF);
+    break;
+  case SYS_ftruncate:
+    note_write(stop.arg(0), stop.arg(1), TO_EOF);
+    break;
+  case SYS_fallocate: {
+    // these two shift everything after the range
+    bool shifts =
+        stop.arg(1) & (FALLOC_FL_COLLAPSE_RANGE | FALLOC_FL_INSERT_RANGE);
+    note_write(stop.arg(0), stop.arg(2), shifts ? TO_EOF : stop.arg(3));
+    break;
+  }
+  }
+}
+
+void Manager::handle_unlink() {
+  bool at = stop.nr() == SYS_unlinkat;
+  std::string to_unlink = _read_file(stop, mem, at ? 1 : 0);
+  // whether or not it goes through, a file made in its place won't match the
+  // backup outside of what's written to it
+  dirty.erase(to_unlink);
+  if (mem_files && _startswith(to_unlink, prefix) && in_memory(to_unlink)) {
+    if (at && (stop.arg(2) & AT_REMOVEDIR)) {
+      skip_syscall(-ENOTDIR);
+      return;
+    }
+    memfs.unlink(to_unlink);
+    skip_syscall(0);
+  }
+}
+
+void Manager::note_write(int fd, int64_t off, uint64_t len) {
+  auto it = fds.find(fd);
+  if (it == fds.end()) {
+    return;
+  }
+  auto d = dirty.find(it->second);
+  if (d == dirty.end()) {
+    return;
+  }
+  if (off < 0) {
+    // the position is the node's fd's, so read it through a copy
+    auto copy = fd_copies.find(fd);
+    if (copy == fd_copies.end()) {
+      int localfd = tracee_fd(child, fd);
+      if (localfd < 0) {
+        fprintf(stderr, "[FILTER] pidfd_getfd of fd %d failed: %s\n", fd,
+                strerror(errno));
+        exit(1);
+      }
+      copy = fd_copies.insert({fd, localfd}).first;
+    }
+    int flags = fcntl(copy->second, F_GETFL);
+    struct stat s;
+    if (off == AT_END || (flags >= 0 && (flags & O_APPEND))) {
+      if (fstat(copy->second, &s) < 0) {
+        fprintf(stderr, "[FILTER] fstat of fd %d failed: %s\n", fd,
+                strerror(errno));
+        exit(1);
+      }
+      off = s.st_size;
+    } else if ((off = lseek(copy->second, 0, SEEK_CUR)) < 0) {
+      fprintf(stderr, "[FILTER] lseek of fd %d failed: %s\n", fd,
+              strerror(errno));
+      exit(1);
+    }
+  }
+  d->second.extents.add(off, len);
+}
+
+void Manager::note_write(const std::string &file, uint64_t off,
+                         uint64_t len) {
+  auto d = dirty.find(file);
+  if (d != dirty.end()) {
+    d->second.extents.add(off, len);
+  }
+}
+
+std::string Manager::file_path(const std::string &name, bool create) {
+  if (!mem_files) {
+    return name;
+  } else if (create) {
+    memfs.create(name);
+  }
+  return memfs.proc_path(name);
+}
+
+bool Manager::in_memory(const std::string &path) {
+  if (memfs.fd(path) >= 0) {
+    return true;
+  } else if (memfs.import(path)) {
+    // left there from before orch started
+    printf("[FILTER] moved %s into memory\n", path.c_str());
+    return true;
+  }
+  return false;
+}
+
+bool Manager::backup_exists(const std::string &name) {
+  if (chunks != nullptr) {
+    return manifests.find(name) != manifests.end();
+  } else if (mem_files) {
+    return memfs.fd(name) >= 0;
+  }
+  return _exists(name);
+}
+
+bool Manager::save_backup(const std::string &file, const std::string &name,
+                          const ExtentSet *changed) {
+  if (chunks == nullptr) {
+    if (changed != nullptr) {
+      return persist.copy_extents(file_path(file), file_path(name), *changed);
+    }
+    persist.copy_file(file_path(file), file_path(name, true));
+    return true;
+  }
+  auto it = manifests.find(name);
+  if (changed != nullptr && it == manifests.end()) {
+    return false;
+  }
+  Manifest &m = it != manifests.end() ? it->second : manifests[name];
+  if (!chunks->put_file(file_path(file), &m, changed)) {
+    fprintf(stderr, "[FILTER] couldn't back up %s: %s\n", file.c_str(),
+            strerror(errno));
+    exit(1);
+  }
+  return true;
+}
+
+bool Manager::load_backup(const std::string &name, const std::string &file,
+                          const ExtentSet *changed) {
+  return write_backup(name, file_path(file, changed == nullptr), changed);
+}
+
+bool Manager::write_backup(const std::string &name, const std::string &path,
+                           const ExtentSet *changed) {
+  if (chunks == nullptr) {
+    if (changed != nullptr) {
+      return persist.copy_extents(file_path(name), path, *changed);
+    }
+    return persist.copy_file(file_path(name), path);
+  }
+  auto it = manifests.find(name);
+  if (it == manifests.end()) {
+    return false;
+  }
+  return chunks->get_file(it->second, path, changed);
+}
+
+void Manager::move_backup(const std::string &from, const std::string &to) {
+  if (chunks != nullptr) {
+    Manifest &dst = manifests[to];
+    auto it = manifests.find(from);
+    if (it == manifests.end()) {
+      chunks->release(&dst);
+    } else if (&it->second != &dst) {
+      chunks->release(&dst);
+      std::swap(dst, it->second);
+      manifests.erase(it);
+    }
+  } else if (mem_files) {
+    if (!memfs.rename(from, to) && ftruncate(memfs.create(to), 0) < 0) {
+      fprintf(stderr, "[FILTER] perform_next_op failed to empty %s due to %s\n",
+              to.c_str(), strerror(errno));
+      exit(1);
+    }
+  } else if (!_exists(from)) {
+    std::ofstream to_create(to);
+  } else if (rename(from.c_str(), to.c_str()) < 0) {
+    // file exists, move to new file
+    fprintf(stderr, "[FILTER] perform_next_op failed to rename due to %s\n",
+            strerror(errno));
+    exit(1);
+  }
+}
+
+void Manager::drop_backup(const std::string &name) {
+  if (chunks != nullptr) {
+    auto it = manifests.find(name);
+    if (it != manifests.end()) {
+      chunks->release(&it->second);
+      manifests.erase(it);
+    }
+  } else if (mem_files) {
+    memfs.unlink(name);
+  } else if (_exists(name)) {
+    unlink(name.c_str());
+  }
+}
+
+void Manager::drop_superseded(const std::string &file, int vers) {
+  auto pers = file_pers.find(file);
+  if (!mem_files || chunks != nullptr || pers == file_pers.end() ||
+      vers >= pers->second) {
+    return;
+  }
+  int id = versions.find(file);
+  if (id >= 0 && versions.pending_on({id, vers})) {
+    return;
+  }
+  std::string name = get_backup_filename(file, vers);
+  if (backup_exists(name)) {
+    printf("[FILTER] dropping %s, superseded by version %d\n", name.c_str(),
+           pers->second);
+    drop_backup(name);
+  }
+}
+
 std::string Manager::get_backup_filename(std::string file, int version) {
   file.append(".");
   file.append(std::to_string(version));
@@ -906,24 +1236,23 @@ std::string Manager::get_backup_filename(std::string file, int version) {
 void Manager::handle_socket() {
   printf("[FILTER] handling socket\n");
 
-  struct user_regs_struct regs;
-  ptrace(PTRACE_GETREGS, child, 0, &regs);
-  int domain = regs.rdi;
-  int type = regs.rsi;
-  // int protocol = regs.rdx;
+  int domain = stop.arg(0);
+  int type = stop.arg(1);
+  // int protocol = stop.arg(2);
 
   // printf("domain: %d, type: %d, protocol: %d\n", domain, type, protocol);
 
   if (domain == AF_INET && type & SOCK_STREAM) {
     // when TCP, track the socket being returned
     int status;
-    ptrace(PTRACE_SYSCALL, child, 0, 0);
-    waitpid(child, &status, 0);
-    if (WIFSTOPPED(status) && WSTOPSIG(status) & 0x80) {
-      uint64_t fd =
-          (uint64_t)ptrace(PTRACE_PEEKUSER, child, sizeof(long) * RAX, 0);
-      printf("[FILTER] sockfd: %lu\n", fd);
-      sockfds[fd] = false;
+    bool at_exit = transport == TR_UNIX ? unix_socket(stop, &status)
+                                        : stop.to_exit(&status);
+    if (at_exit) {
+      if ((int)stop.ret() >= 0) {
+        int fd = relocate_fd(type & SOCK_CLOEXEC);
+        printf("[FILTER] sockfd: %d\n", fd);
+        sockfds[fd] = false;
+      }
     }
   }
 }
@@ -931,19 +1260,41 @@ void Manager::handle_socket() {
 void Manager::handle_bind() {
   printf("[FILTER] handling bind\n");
 
-  struct user_regs_struct regs;
-  ptrace(PTRACE_GETREGS, child, 0, &regs);
-  int sockfd = regs.rdi;
-  unsigned long long sockaddr_ptr = regs.rsi;
-  size_t addrlen = regs.rdx;
+  int sockfd = stop.arg(0);
+  uint64_t sockaddr_ptr = stop.arg(1);
+  size_t addrlen = stop.arg(2);
 
+  if (addrlen < sizeof(sockaddr_in)) {
+    // too short to be an AF_INET address, let the kernel reject it
+    printf("[FILTER] sockfd: %d addrlen too short (%lu)\n", sockfd, addrlen);
+    return;
+  }
   sockaddr_in curr_addr;
-  _read_from_proc(child, (char *)&curr_addr, (char *)sockaddr_ptr, addrlen);
+  mem.read(&curr_addr, sockaddr_ptr, sizeof(sockaddr_in));
 
   printf("[FILTER] sockfd: %d oldaddr: %d %s:%d\n", sockfd,
          curr_addr.sin_family, inet_ntoa(curr_addr.sin_addr),
          ntohs(curr_addr.sin_port));
 
+  if (transport == TR_UNIX && curr_addr.sin_family == AF_INET &&
+      sockfds.find(sockfd) != sockfds.end()) {
+    // a unix socket can't take an AF_INET address, so bind it ourselves.
+    // anything meant for the node (or any address) goes to its own name
+    sockaddr_in my_new_addr = curr_addr;
+    if (curr_addr.sin_addr.s_addr == old_addr.sin_addr.s_addr ||
+        curr_addr.sin_addr.s_addr == htonl(INADDR_ANY)) {
+      my_new_addr.sin_addr.s_addr = new_addr.sin_addr.s_addr;
+    }
+    int ret = tracee_bind(child, sockfd, UR_NODE, my_new_addr);
+    printf("[FILTER] bound %d as %s:%d: %d\n", sockfd,
+           inet_ntoa(my_new_addr.sin_addr), ntohs(my_new_addr.sin_port), ret);
+    if (ret == 0) {
+      sockfds[sockfd] = true;
+    }
+    skip_syscall(ret);
+    return;
+  }
+
   if (curr_addr.sin_family == AF_INET &&
       curr_addr.sin_addr.s_addr == old_addr.sin_addr.s_addr) {
     // overwrite the address, in the same location
@@ -955,17 +1306,13 @@ void Manager::handle_bind() {
     printf("[FILTER] writing %s:%d to proc for %d\n",
            inet_ntoa(my_new_addr.sin_addr), ntohs(my_new_addr.sin_port),
            sockfd);
-    _write_to_proc(child, (char *)&my_new_addr, (char *)sockaddr_ptr,
-                   sizeof(sockaddr_in));
+    mem.write(&my_new_addr, sockaddr_ptr, sizeof(sockaddr_in));
     sockfds[sockfd] = true;
 
     // overwrite the arguments back after the syscall
     int status;
-    ptrace(PTRACE_SYSCALL, child, 0, 0);
-    waitpid(child, &status, 0);
-    if (WIFSTOPPED(status) && WSTOPSIG(status) & 0x80) {
-      _write_to_proc(child, (char *)&curr_addr, (char *)sockaddr_ptr,
-                     sizeof(sockaddr_in));
+    if (stop.to_exit(&status)) {
+      mem.write(&curr_addr, sockaddr_ptr, sizeof(sockaddr_in));
     }
   }
 }
@@ -973,102 +1320,268 @@ void Manager::handle_bind() {
 void Manager::handle_close() {
   printf("[FILTER] handling close\n");
   int status;
-  ptrace(PTRACE_SYSCALL, child, 0, 0);
-  waitpid(child, &status, 0);
-
-  if (WIFSTOPPED(status) && WSTOPSIG(status) & 0x80) {
-    struct user_regs_struct regs;
-    ptrace(PTRACE_GETREGS, child, 0, &regs);
-    int fd = regs.rdi;
-    if ((int)regs.rax == 0) {
-      if (sockfds.find(fd) != sockfds.end()) {
-        fdmap.node_close_fd(my_idx, fd);
-        // you probably don't need this since the close is idempotent and any
-        // new fd will get re-registered as necessary
-        sockfds.erase(fd);
-      } else if (fds.find(fd) != fds.end()) {
-        fds.erase(fd);
-      }
+  if (stop.to_exit(&status)) {
+    if ((int)stop.ret() == 0) {
+      forget_fd(stop.arg(0));
+    }
+  }
+}
+
+void Manager::forget_fd(int fd) {
+  if (sockfds.find(fd) != sockfds.end()) {
+    fdmap.node_close_fd(my_idx, fd);
+    // you probably don't need this since the close is idempotent and any
+    // new fd will get re-registered as necessary
+    sockfds.erase(fd);
+  } else if (fds.find(fd) != fds.end()) {
+    fds.erase(fd);
+    auto copy = fd_copies.find(fd);
+    if (copy != fd_copies.end()) {
+      close(copy->second);
+      fd_copies.erase(copy);
     }
+  } else if (vtimers.find(fd) != vtimers.end()) {
+    close(vtimers[fd].localfd);
+    vtimers.erase(fd);
   }
 }
 
+void Manager::handle_dup() {
+  long nr = stop.nr();
+  int old_fd = stop.arg(0);
+  bool cloexec = false;
+  if (nr == SYS_fcntl) {
+    int cmd = stop.arg(1);
+    if (cmd != F_DUPFD && cmd != F_DUPFD_CLOEXEC) {
+      return;
+    }
+    cloexec = cmd == F_DUPFD_CLOEXEC;
+  } else if (nr == SYS_dup3) {
+    cloexec = stop.arg(2) & O_CLOEXEC;
+  }
+  printf("[FILTER] handling dup of %d\n", old_fd);
+  int status;
+  if (!stop.to_exit(&status)) {
+    return;
+  }
+  int fd = (int)stop.ret();
+  if (fd < 0 || fd == old_fd) {
+    return;
+  }
+  bool placed = nr == SYS_dup2 || nr == SYS_dup3;
+  if (placed) {
+    // whatever was at fd has been closed over
+    forget_fd(fd);
+  }
+  if (fds.find(old_fd) == fds.end()) {
+    // a socket's proxied connection (FdMap) and a timerfd's virtual timer
+    // belong to one fd, so a copy of either is left to the kernel
+    printf("[FILTER] copy %d of %d isn't tracked\n", fd, old_fd);
+    return;
+  }
+  if (fd < TRACKED_FD_BASE) {
+    if (placed) {
+      // the node asked for this slot, so it can't be moved
+      printf("[FILTER] copy %d of %d is below the tracked fds\n", fd,
+             old_fd);
+      return;
+    }
+    fd = relocate_fd(cloexec);
+  }
+  fds[fd] = fds[old_fd];
+  printf("[FILTER] %d is a copy of %d (%s)\n", fd, old_fd,
+         fds[fd].c_str());
+}
+
 void Manager::handle_getsockname() {
   printf("[FILTER] handling getsockname\n");
-  struct user_regs_struct regs;
-  ptrace(PTRACE_GETREGS, child, 0, &regs);
-  int sockfd = regs.rdi;
-  unsigned long long sockaddr_ptr = regs.rsi;
-  unsigned long long addrlen_ptr = regs.rdx;
+  int sockfd = stop.arg(0);
+  uint64_t sockaddr_ptr = stop.arg(1);
+  uint64_t addrlen_ptr = stop.arg(2);
 
   auto got = sockfds.find(sockfd);
-  if (got == sockfds.end() || !got->second) {
+  // under TR_UNIX, every tracked socket's name needs translating back
+  if (got == sockfds.end() || (!got->second && transport != TR_UNIX)) {
     // not redirected, just ignore
     printf("[FILTER] sockfd %d not redirectd, ignore\n", sockfd);
     return;
   }
+  bool redirected = got->second;
 
-  long addrlen_lng;
-  _read_from_proc(child, (char *)&addrlen_lng, (char *)addrlen_ptr,
-                  sizeof(long));
-  size_t addrlen = (size_t)addrlen_lng;
+  socklen_t addrlen;
+  mem.read(&addrlen, addrlen_ptr, sizeof(socklen_t));
   if (addrlen < sizeof(sockaddr_in)) {
     fprintf(stderr, "Found addrlen that's smaller than expected.");
     exit(1);
   }
 
   int status;
-  ptrace(PTRACE_SYSCALL, child, 0, 0);
-  waitpid(child, &status, 0);
-  if (WIFSTOPPED(status) && WSTOPSIG(status) & 0x80) {
-    printf("[FILTER] length of overwrite: %ld\n", addrlen);
+  if (stop.to_exit(&status)) {
+    printf("[FILTER] length of overwrite: %u\n", addrlen);
     sockaddr_in addr_to_overwrite;
-    _read_from_proc(child, (char *)&addr_to_overwrite, (char *)sockaddr_ptr,
-                    sizeof(sockaddr_in));
-    addr_to_overwrite.sin_addr.s_addr = old_addr.sin_addr.s_addr;
+    if (transport == TR_UNIX) {
+      // what was written is a (cut off) unix name
+      addr_to_overwrite = tracee_sockname(child, sockfd);
+      socklen_t inet_len = sizeof(sockaddr_in);
+      mem.write(&inet_len, addrlen_ptr, sizeof(socklen_t));
+    } else {
+      mem.read(&addr_to_overwrite, sockaddr_ptr, sizeof(sockaddr_in));
+    }
+    if (redirected) {
+      addr_to_overwrite.sin_addr.s_addr = old_addr.sin_addr.s_addr;
+    }
     printf("[FILTER] overwriting %s:%d to proc\n",
            inet_ntoa(addr_to_overwrite.sin_addr),
            ntohs(addr_to_overwrite.sin_port));
-    _write_to_proc(child, (char *)&addr_to_overwrite, (char *)sockaddr_ptr,
-                   sizeof(sockaddr_in));
+    mem.write(&addr_to_overwrite, sockaddr_ptr, sizeof(sockaddr_in));
+  }
+}
+
+void Manager::handle_getpeername() {
+  int sockfd = stop.arg(0);
+  if (transport != TR_UNIX || sockfds.find(sockfd) == sockfds.end()) {
+    return;
+  }
+  printf("[FILTER] handling getpeername\n");
+  int status;
+  if (stop.to_exit(&status) && (int)stop.ret() == 0) {
+    write_inet_addr(stop.arg(1), stop.arg(2), tracee_peername(child, sockfd));
+  }
+}
+
+void Manager::handle_sockopt() {
+  if (transport == TR_UNIX && sockfds.find(stop.arg(0)) != sockfds.end()) {
+    unix_sockopt(stop, mem);
   }
 }
 
+void Manager::write_inet_addr(uint64_t addr_ptr, uint64_t addrlen_ptr,
+                              const sockaddr_in &addr) {
+  if (addr_ptr == 0) {
+    return;
+  }
+  // cut off to fit, like the kernel would, but with the full length returned
+  socklen_t addrlen;
+  mem.read(&addrlen, addrlen_ptr, sizeof(socklen_t));
+  mem.write(&addr, addr_ptr, std::min((size_t)addrlen, sizeof(sockaddr_in)));
+  addrlen = sizeof(sockaddr_in);
+  mem.write(&addrlen, addrlen_ptr, sizeof(socklen_t));
+}
+
 void Manager::handle_accept() {
   printf("[FILTER] handling accept\n");
+  bool cloexec =
+      stop.nr() == SYS_accept4 && (stop.arg(3) & SOCK_CLOEXEC);
   int status;
-  ptrace(PTRACE_SYSCALL, child, 0, 0);
-  waitpid(child, &status, 0);
-  if (WIFSTOPPED(status) && WSTOPSIG(status) & 0x80) {
-    struct user_regs_struct regs;
-    ptrace(PTRACE_GETREGS, child, 0, &regs);
-
-    int fd = (int)regs.rax;
+  if (stop.to_exit(&status)) {
+    int fd = (int)stop.ret();
     if (fd >= 0) {
+      fd = relocate_fd(cloexec);
       sockaddr_in from_addr;
-      _read_from_proc(child, (char *)&from_addr, (char *)regs.rsi,
-                      sizeof(sockaddr_in));
+      if (transport == TR_UNIX) {
+        // stands in for the proxy's address, so the node sees that instead
+        from_addr = tracee_peername(child, fd);
+        write_inet_addr(stop.arg(1), stop.arg(2), from_addr);
+      } else {
+        mem.read(&from_addr, stop.arg(1), sizeof(sockaddr_in));
+      }
 
       printf("[FILTER] accept from %s:%d on %d\n",
-             inet_ntoa(from_addr.sin_addr), ntohs(from_addr.sin_port),
-             (int)regs.rax);
-      fdmap.node_accept_fd(my_idx, (int)regs.rax, from_addr);
+             inet_ntoa(from_addr.sin_addr), ntohs(from_addr.sin_port), fd);
+      fdmap.node_accept_fd(my_idx, fd, from_addr);
       sockfds[fd] = true;
     }
   }
 }
 
+int Manager::relocate_fd(bool cloexec) {
+  int fd = (int)stop.ret();
+  // the kernel picks the lowest free slot, so nothing the node already has
+  // open up there gets closed over
+  long new_fd = inject_syscall(SYS_fcntl, fd,
+                               cloexec ? F_DUPFD_CLOEXEC : F_DUPFD,
+                               TRACKED_FD_BASE);
+  if (new_fd < TRACKED_FD_BASE) {
+    fprintf(stderr, "[FILTER] failed to move fd %d up to %d: %s\n", fd,
+            TRACKED_FD_BASE, new_fd < 0 ? strerror(-new_fd) : "too low");
+    exit(1);
+  }
+  // below TRACKED_FD_BASE, so this doesn't stop again
+  inject_syscall(SYS_close, fd, 0, 0);
+  printf("[FILTER] moved fd %d to %ld\n", fd, new_fd);
+
+  stop.set_ret(new_fd);
+  return new_fd;
+}
+
+int Manager::next_tracked_fd() {
+  std::string fd_dir = "/proc/" + std::to_string(child) + "/fd/";
+  int fd = TRACKED_FD_BASE;
+  struct stat s;
+  while (sockfds.find(fd) != sockfds.end() || fds.find(fd) != fds.end() ||
+         vtimers.find(fd) != vtimers.end() ||
+         lstat((fd_dir + std::to_string(fd)).c_str(), &s) == 0) {
+    fd++;
+  }
+  return fd;
+}
+
+long Manager::inject_syscall(long nr, long arg0, long arg1, long arg2) {
+  struct user_regs_struct inject = stop.regs();
+  inject.rax = nr;
+  inject.orig_rax = nr;
+  inject.rdi = arg0;
+  inject.rsi = arg1;
+  inject.rdx = arg2;
+  return rerun_syscall(inject);
+}
+
+long Manager::rerun_syscall(struct user_regs_struct inject) {
+  // back up over the syscall instruction (2 bytes) so the node runs it again,
+  // this time with our arguments
+  struct user_regs_struct saved = stop.regs();
+  inject.rip -= 2;
+  stop.set_regs(inject);
+  stop.flush();
+
+  // run to the exit stop of the injected syscall. the entry stop (and any
+  // seccomp stop) on the way there is skipped over
+  int status;
+  int stops_left = 2;
+  while (stops_left > 0) {
+    ptrace(PTRACE_SYSCALL, child, 0, 0);
+    waitpid(child, &status, 0);
+    if (!WIFSTOPPED(status)) {
+      fprintf(stderr, "[FILTER] node died while injecting syscall %lld\n",
+              inject.orig_rax);
+      exit(1);
+    }
+    if (WSTOPSIG(status) & 0x80) {
+      stops_left--;
+    }
+  }
+  stop.next_stop();
+  long ret = stop.ret();
+
+  // back to where we were, written out whenever the node next runs
+  stop.set_regs(saved);
+  return ret;
+}
+
 int Manager::handle_connect() {
   int status;
-  ptrace(PTRACE_SYSCALL, child, 0, 0);
-  waitpid(child, &status, 0);
-  if (WIFSTOPPED(status) && WSTOPSIG(status) & 0x80) {
-    int ret = (int)ptrace(PTRACE_PEEKUSER, child, sizeof(long) * RAX, 0);
+  bool at_exit = transport == TR_UNIX
+                     ? unix_connect(child, stop, mem, old_addr.sin_addr,
+                                    &status)
+                     : stop.to_exit(&status);
+  if (at_exit) {
+    int ret = (int)stop.ret();
     if ((int)ret < 0) {
       return -1;
     } else {
-      int connfd = (int)ptrace(PTRACE_PEEKUSER, child, sizeof(long) * RDI, 0);
-      fdmap.node_connect_fd(my_idx, connfd);
+      int connfd = (int)stop.arg(0);
+      fdmap.node_connect_fd(my_idx, connfd,
+                            tracee_sockname(child, connfd));
       return 0;
     }
   }
@@ -1077,21 +1590,16 @@ int Manager::handle_connect() {
 
 int Manager::handle_sendto() {
   int status;
-  ptrace(PTRACE_SYSCALL, child, 0, 0);
-  waitpid(child, &status, 0);
-  if (WIFSTOPPED(status) && WSTOPSIG(status) & 0x80) {
-    struct user_regs_struct regs;
-    ptrace(PTRACE_GETREGS, child, 0, &regs);
-    int sendfd = (int)regs.rdi;
+  if (stop.to_exit(&status)) {
+    int sendfd = (int)stop.arg(0);
     if (fdmap.is_nodefd_alive(my_idx, sendfd)) {
       printf("[FILTER] connection for %d is still alive. allow sendto\n",
              sendfd);
-      return (int)regs.rax;
+      return (int)stop.ret();
     } else {
       // proxy already closed. we should close this fd
       printf("[FILTER] connection for %d is dead. inject failure\n", sendfd);
-      regs.rax = -((long)ECONNRESET);
-      ptrace(PTRACE_SETREGS, child, 0, &regs);
+      stop.set_ret(-((long)ECONNRESET));
       return -1;
     }
   }
@@ -1107,16 +1615,29 @@ const long long i1e9 = 1000 * 1000 * 1000;
 void Manager::handle_gettimeofday() {
   printf("[FILTER] handling gettimeofday\n");
 
+  if (emulate_at_entry) {
+    if (stop.arg(1) != 0) {
+      fprintf(stderr, "[FILTER] Non-NULL timezone arg: %p\n",
+              (void *)stop.arg(1));
+      exit(1);
+    }
+    struct timeval new_tv;
+    new_tv.tv_sec = vtime.tv_sec;
+    new_tv.tv_usec = vtime.tv_nsec / i1e3;
+    printf("[FILTER] writing {sec: %ld, usec: %ld} as time at entry\n",
+           new_tv.tv_sec, new_tv.tv_usec);
+    mem.write(&new_tv, stop.arg(0), sizeof(struct timeval));
+    skip_syscall(0);
+    return;
+  }
+
   int status;
-  ptrace(PTRACE_SYSCALL, child, 0, 0);
-  waitpid(child, &status, 0);
-  if (WIFSTOPPED(status) && WSTOPSIG(status) & 0x80) {
-    struct user_regs_struct regs;
-    ptrace(PTRACE_GETREGS, child, 0, &regs);
-    if (regs.rsi != 0) {
-      fprintf(stderr, "[FILTER] Non-NULL timezone arg: %p\n", (void *)regs.rsi);
+  if (stop.to_exit(&status)) {
+    if (stop.arg(1) != 0) {
+      fprintf(stderr, "[FILTER] Non-NULL timezone arg: %p\n",
+              (void *)stop.arg(1));
       exit(1);
-    } else if (regs.rax != 0) {
+    } else if (stop.ret() != 0) {
       fprintf(stderr, "[FILTER] gettimeofday failed\n");
       exit(1);
     }
@@ -1126,29 +1647,97 @@ void Manager::handle_gettimeofday() {
     new_tv.tv_usec = vtime.tv_nsec / i1e3;
     printf("[FILTER] writing {sec: %ld, usec: %ld} as time\n", new_tv.tv_sec,
            new_tv.tv_usec);
-    _write_to_proc(child, (char *)&new_tv, (char *)regs.rdi,
-                   sizeof(struct timeval));
+    mem.write(&new_tv, stop.arg(0), sizeof(struct timeval));
   }
 }
 
 void Manager::handle_clock_gettime() {
   printf("[FILTER] handling clock_gettime\n");
 
+  if (emulate_at_entry) {
+    printf("[FILTER] writing {sec: %ld, nsec: %ld} as time at entry\n",
+           vtime.tv_sec, vtime.tv_nsec);
+    mem.write(&vtime, stop.arg(1), sizeof(struct timespec));
+    skip_syscall(0);
+    return;
+  }
+
   int status;
-  ptrace(PTRACE_SYSCALL, child, 0, 0);
-  waitpid(child, &status, 0);
-  if (WIFSTOPPED(status) && WSTOPSIG(status) & 0x80) {
-    struct user_regs_struct regs;
-    ptrace(PTRACE_GETREGS, child, 0, &regs);
-    if (regs.rax != 0) {
+  if (stop.to_exit(&status)) {
+    if (stop.ret() != 0) {
       fprintf(stderr, "[FILTER] clock_gettime failed\n");
       exit(1);
     }
 
     printf("[FILTER] writing {sec: %ld, nsec: %ld} as time\n", vtime.tv_sec,
            vtime.tv_nsec);
-    _write_to_proc(child, (char *)&vtime, (char *)regs.rsi,
-                   sizeof(struct timespec));
+    mem.write(&vtime, stop.arg(1), sizeof(struct timespec));
+  }
+}
+
+void Manager::notif_gettimeofday() {
+  printf("[FILTER] handling gettimeofday from notification\n");
+  uint64_t tv_addr = notif_req.data.args[0];
+  if (notif_req.data.args[1] != 0) {
+    fprintf(stderr, "[FILTER] Non-NULL timezone arg: %p\n",
+            (void *)notif_req.data.args[1]);
+    exit(1);
+  }
+
+  struct timeval new_tv;
+  new_tv.tv_sec = vtime.tv_sec;
+  new_tv.tv_usec = vtime.tv_nsec / i1e3;
+  printf("[FILTER] writing {sec: %ld, usec: %ld} as time\n", new_tv.tv_sec,
+         new_tv.tv_usec);
+  if (Notif::id_valid(notif_fd, notif_req.id)) {
+    mem.write(&new_tv, tv_addr, sizeof(struct timeval));
+    Notif::respond(notif_fd, notif_req.id, 0, 0);
+  }
+}
+
+void Manager::notif_clock_gettime() {
+  printf("[FILTER] handling clock_gettime from notification\n");
+  uint64_t ts_addr = notif_req.data.args[1];
+
+  printf("[FILTER] writing {sec: %ld, nsec: %ld} as time\n", vtime.tv_sec,
+         vtime.tv_nsec);
+  if (Notif::id_valid(notif_fd, notif_req.id)) {
+    mem.write(&vtime, ts_addr, sizeof(struct timespec));
+    Notif::respond(notif_fd, notif_req.id, 0, 0);
+  }
+}
+
+void Manager::notif_socket() {
+  printf("[FILTER] handling socket from notification\n");
+  int domain = notif_req.data.args[0];
+  int type = notif_req.data.args[1];
+  int protocol = notif_req.data.args[2];
+
+  // tracked sockets go straight into the tracked range
+  bool track = domain == AF_INET && type & SOCK_STREAM;
+  // create the socket ourselves and install it in the node, so we learn the
+  // node's fd without waiting for the syscall to exit
+  int sockfd = track && transport == TR_UNIX
+                   ? socket(AF_UNIX, type | SOCK_CLOEXEC, 0)
+                   : socket(domain, type | SOCK_CLOEXEC, protocol);
+  if (sockfd < 0) {
+    Notif::respond(notif_fd, notif_req.id, 0, errno);
+    return;
+  }
+  int fd = Notif::addfd(notif_fd, notif_req.id, sockfd,
+                        (type & SOCK_CLOEXEC) ? O_CLOEXEC : 0, true,
+                        track ? next_tracked_fd() : -1);
+  int err = errno;
+  close(sockfd);
+  if (fd < 0) {
+    // nothing answered the notification, so the node would wait forever
+    Notif::respond(notif_fd, notif_req.id, 0, err);
+    return;
+  }
+  if (track) {
+    // when TCP, track the socket being returned
+    printf("[FILTER] sockfd: %d\n", fd);
+    sockfds[fd] = false;
   }
 }
 
@@ -1162,78 +1751,196 @@ void Manager::handle_getrandom(Event ev,
   printf("[FILTER] handling getrandom\n");
   child_state = ST_STOPPED;
 
+  if (notif_pending) {
+    // answer on the node's behalf rather than letting getrandom run
+    notif_pending = false;
+    size_t len = notif_req.data.args[1];
+    printf("[FILTER] returning: %lu\n", len);
+    if (len > 0) {
+      std::vector<char> buf(len + sizeof(int));
+      fill_fn(&buf[0], len);
+      if (!Notif::id_valid(notif_fd, notif_req.id)) {
+        return;
+      }
+      mem.write(&buf[0], notif_req.data.args[0], len);
+    }
+    Notif::respond(notif_fd, notif_req.id, len, 0);
+    return;
+  }
+
+  if (emulate_at_entry) {
+    // still at the seccomp stop, so answer without running getrandom
+    size_t len = _getrandom_len(stop.arg(1));
+    printf("[FILTER] returning: %lu\n", len);
+    write_random(stop.arg(0), len, fill_fn);
+    skip_syscall(len);
+    return;
+  }
+
   int status;
-  ptrace(PTRACE_SYSCALL, child, 0, 0);
-  waitpid(child, &status, 0);
-  if (WIFSTOPPED(status) && WSTOPSIG(status) & 0x80) {
-    struct user_regs_struct regs;
-    ptrace(PTRACE_GETREGS, child, 0, &regs);
-    ssize_t ret = regs.rax;
+  if (stop.to_exit(&status)) {
+    ssize_t ret = stop.ret();
     printf("[FILTER] returned: %lu\n", ret);
     if (ret > 0) {
-      // generate <ret> pseudo-random bytes
-      char buf[ret + 4];
-      fill_fn(buf, ret);
-      _write_to_proc(child, buf, (char *)regs.rdi, ret);
+      write_random(stop.arg(0), ret, fill_fn);
     }
   }
 }
 
-void Manager::handle_poll() {
-  // get timeout param
-  struct user_regs_struct regs;
-  ptrace(PTRACE_GETREGS, child, 0, &regs);
-  struct timespec old_timeout;
-  switch (regs.orig_rax) {
-  case SYS_poll: {
-    printf("[FILTER] handling poll\n");
-    int timeout_ms = regs.rdx;
-    regs.rdx = 0;
-    printf("[FILTER] overwrite poll timeout from %dms to 0\n", timeout_ms);
-    ptrace(PTRACE_SETREGS, child, 0, &regs);
-
-    old_timeout.tv_sec = timeout_ms / i1e3;
-    old_timeout.tv_nsec = (timeout_ms % i1e3) * i1e6;
-    break;
-  }
-  case SYS_select: {
-    printf("[FILTER] handling select\n");
-    struct timeval old_us;
-
-    long timeout_addr = regs.r8;
-    _read_from_proc(child, (char *)&old_us, (char *)timeout_addr,
-                    sizeof(struct timeval));
-    old_timeout.tv_sec = old_us.tv_sec;
-    old_timeout.tv_nsec = old_us.tv_usec * i1e3;
-
-    printf("[FILTER] overwrite poll timeout from {sec: %ld, usec: %ld} to 0\n",
-           old_us.tv_sec, old_us.tv_usec);
-    old_us.tv_sec = 0;
-    old_us.tv_usec = 0;
-    long addr_to_write = regs.rsp - sizeof(struct timeval) - 64;
-    _write_to_proc(child, (char *)&old_us, (char *)addr_to_write,
-                   sizeof(struct timeval));
-    regs.r8 = addr_to_write;
-    ptrace(PTRACE_SETREGS, child, 0, &regs);
-    break;
+void Manager::write_random(uint64_t addr, size_t len,
+                           std::function<void(void *, size_t)> fill_fn) {
+  if (len == 0) {
+    return;
   }
+  // generate <len> pseudo-random bytes. fill_fn works in whole ints, so
+  // leave room for it to overshoot, but only hand <len> bytes back
+  std::vector<char> buf(len + sizeof(int));
+  fill_fn(&buf[0], len);
+  mem.write(&buf[0], addr, len);
+}
+
+void Manager::skip_syscall(long ret) {
+  // orig_rax of -1 at a seccomp stop makes the kernel skip the syscall and
+  // leave rax as the return value
+  stop.set_nr(-1);
+  stop.set_ret(ret);
+}
+
+namespace {
+// how a polling syscall takes its timeout
+enum TimeoutKind {
+  // an int of ms, negative for none
+  TK_MS,
+  // a struct timeval pointer, NULL for none
+  TK_TIMEVAL,
+  // a struct timespec pointer, NULL for none
+  TK_TIMESPEC,
+};
+
+struct PollTimeout {
+  const char *name;
+  int arg;
+  TimeoutKind kind;
+  // whether the kernel writes back the time left (only ever 0 here)
+  bool writes_left;
+};
+
+PollTimeout _poll_timeout(long nr) {
+  switch (nr) {
+  case SYS_poll:
+    return {"poll", 2, TK_MS, false};
+  case SYS_select:
+    return {"select", 4, TK_TIMEVAL, true};
+  case SYS_pselect6:
+    return {"pselect6", 4, TK_TIMESPEC, true};
+  case SYS_ppoll:
+    return {"ppoll", 2, TK_TIMESPEC, true};
+  case SYS_epoll_wait:
+    return {"epoll_wait", 3, TK_MS, false};
+  case SYS_epoll_pwait:
+    return {"epoll_pwait", 3, TK_MS, false};
+  case SYS_epoll_pwait2:
+    return {"epoll_pwait2", 3, TK_TIMESPEC, false};
   default:
-    fprintf(stderr, "[FILTER] unhandled polling syscall: %llu\n",
-            regs.orig_rax);
+    fprintf(stderr, "[FILTER] unhandled polling syscall: %ld\n", nr);
     exit(1);
   }
+}
+
+} // namespace
+
+bool Manager::poll_timeout(uint64_t *timeout_ns) {
+  PollTimeout pt = _poll_timeout(stop.nr());
+  uint64_t arg = stop.arg(pt.arg);
+  switch (pt.kind) {
+  case TK_MS: {
+    int timeout_ms = (int)arg;
+    if (timeout_ms < 0) {
+      return false;
+    }
+    *timeout_ns = timeout_ms * i1e6;
+    return true;
+  }
+  case TK_TIMEVAL: {
+    if (arg == 0) {
+      return false;
+    }
+    struct timeval tv;
+    mem.read(&tv, arg, sizeof(struct timeval));
+    *timeout_ns = tv.tv_sec * i1e9 + tv.tv_usec * i1e3;
+    return true;
+  }
+  case TK_TIMESPEC: {
+    if (arg == 0) {
+      return false;
+    }
+    struct timespec ts;
+    mem.read(&ts, arg, sizeof(struct timespec));
+    *timeout_ns = VClock::to_ns(ts);
+    return true;
+  }
+  }
+  return false;
+}
+
+void Manager::handle_poll() {
+  PollTimeout pt = _poll_timeout(stop.nr());
+  printf("[FILTER] handling %s\n", pt.name);
+  // anything due by now is readable before the node looks
+  fire_vtimers();
+
+  uint64_t timeout_ns = 0;
+  bool has_timeout = poll_timeout(&timeout_ns);
+  uint64_t timeout_arg = stop.arg(pt.arg);
+  if (pt.kind == TK_MS) {
+    stop.set_arg(pt.arg, 0);
+  } else {
+    // a zeroed struct of either kind, below the red zone
+    struct timespec zero = {0, 0};
+    uint64_t scratch = (stop.regs().rsp - 128 - sizeof(zero)) & ~15ULL;
+    mem.write(&zero, scratch, sizeof(zero));
+    stop.set_arg(pt.arg, scratch);
+  }
+  if (has_timeout) {
+    printf("[FILTER] overwrite %s timeout from %luns to 0\n", pt.name,
+           timeout_ns);
+  } else {
+    printf("[FILTER] overwrite %s timeout from none to 0\n", pt.name);
+  }
+  // to run it again once a timerfd goes off
+  struct user_regs_struct entry = stop.regs();
+  entry.rax = entry.orig_rax;
 
   int status;
-  ptrace(PTRACE_SYSCALL, child, 0, 0);
-  waitpid(child, &status, 0);
-  if (WIFSTOPPED(status) && WSTOPSIG(status) & 0x80) {
-    ptrace(PTRACE_GETREGS, child, 0, &regs);
-    int retval = regs.rax;
+  if (stop.to_exit(&status)) {
+    int retval = stop.ret();
+    stop.set_arg(pt.arg, timeout_arg);
     if (retval == 0) {
       // no updates to polling, which means the program waited the entire
-      // time.
-      printf("[FILTER] no results. updating vtime\n");
-      increment_vtime(old_timeout.tv_sec, old_timeout.tv_nsec);
+      // time, or until its next timerfd went off
+      uint64_t now = vtime_ns();
+      uint64_t wake = next_vtimer();
+      if (has_timeout && (wake == TIMER_NEVER || now + timeout_ns <= wake)) {
+        printf("[FILTER] no results. updating vtime\n");
+        if (pt.writes_left && timeout_arg != 0) {
+          struct timespec zero = {0, 0};
+          mem.write(&zero, timeout_arg,
+                    pt.kind == TK_TIMEVAL ? sizeof(struct timeval)
+                                          : sizeof(struct timespec));
+        }
+        increment_vtime(0, timeout_ns);
+      } else if (wake != TIMER_NEVER) {
+        // the node waits until its next timerfd goes off, then looks again.
+        // (still nothing if it wasn't looking at that timerfd, which it sees
+        // as an early timeout)
+        printf("[FILTER] no results. updating vtime to next timerfd\n");
+        increment_vtime(0, wake > now ? wake - now : 0);
+        retval = rerun_syscall(entry);
+        stop.set_ret(retval);
+        printf("[FILTER] found %d results after timerfd\n", retval);
+      } else {
+        printf("[FILTER] no results, and nothing to wait for\n");
+      }
     } else {
       // there were updates. just don't increment offset?
       printf("[FILTER] found %d results. no additional updates to vtime\n",
@@ -1242,10 +1949,189 @@ void Manager::handle_poll() {
   }
 }
 
+uint64_t Manager::poll_deadline() {
+  uint64_t timeout_ns;
+  uint64_t deadline = TIMER_NEVER;
+  if (poll_timeout(&timeout_ns)) {
+    // what handle_poll will have moved vtime to if the poll times out
+    deadline = vtime_ns() + timeout_ns;
+  }
+  return std::min(deadline, next_vtimer());
+}
+
+uint64_t Manager::sleep_ns(uint64_t req_ptr, bool abstime) {
+  struct timespec req;
+  mem.read(&req, req_ptr, sizeof(struct timespec));
+  uint64_t req_ns = VClock::to_ns(req);
+  if (!abstime) {
+    return req_ns;
+  }
+  // every clock reads as vtime
+  uint64_t now = vtime_ns();
+  return req_ns > now ? req_ns - now : 0;
+}
+
+void Manager::handle_nanosleep() {
+  bool clock = stop.nr() == SYS_clock_nanosleep;
+  uint64_t ns = clock ? sleep_ns(stop.arg(2), stop.arg(1) & TIMER_ABSTIME)
+                      : sleep_ns(stop.arg(0), false);
+  printf("[FILTER] sleeping %luns at entry\n", ns);
+  increment_vtime(0, ns);
+  skip_syscall(0);
+}
+
+void Manager::notif_nanosleep() {
+  printf("[FILTER] handling sleep from notification\n");
+  bool clock = notif_req.data.nr == SYS_clock_nanosleep;
+  uint64_t ns = clock ? sleep_ns(notif_req.data.args[2],
+                                 notif_req.data.args[1] & TIMER_ABSTIME)
+                      : sleep_ns(notif_req.data.args[0], false);
+  if (Notif::id_valid(notif_fd, notif_req.id)) {
+    printf("[FILTER] sleeping %luns\n", ns);
+    increment_vtime(0, ns);
+    Notif::respond(notif_fd, notif_req.id, 0, 0);
+  }
+}
+
+void Manager::handle_timerfd_create() {
+  printf("[FILTER] handling timerfd_create\n");
+  int flags = stop.arg(1);
+  int status;
+  if (stop.to_exit(&status) && (int)stop.ret() >= 0) {
+    int fd = relocate_fd(flags & TFD_CLOEXEC);
+    int localfd = tracee_fd(child, fd);
+    if (localfd < 0) {
+      fprintf(stderr, "[FILTER] couldn't copy timerfd %d: %s\n", fd,
+              strerror(errno));
+      exit(1);
+    }
+    printf("[FILTER] timerfd: %d\n", fd);
+    vtimers[fd] = {localfd, false, 0, 0};
+  }
+}
+
+void Manager::handle_timerfd_settime() {
+  int fd = stop.arg(0);
+  auto found = vtimers.find(fd);
+  if (found == vtimers.end()) {
+    return;
+  }
+  VTimer &vt = found->second;
+  // a blocking read on it would never return if it were never really armed
+  vt.virt = (fcntl(vt.localfd, F_GETFL) & O_NONBLOCK) != 0;
+  if (!vt.virt) {
+    printf("[FILTER] timerfd %d is blocking, leaving it in real time\n", fd);
+    return;
+  }
+
+  uint64_t now = vtime_ns();
+  if (stop.arg(3) != 0) {
+    struct itimerspec old;
+    old.it_value = VClock::from_ns(vt.next_ns > now ? vt.next_ns - now : 0);
+    old.it_interval = VClock::from_ns(vt.interval_ns);
+    mem.write(&old, stop.arg(3), sizeof(old));
+  }
+  struct itimerspec its;
+  mem.read(&its, stop.arg(2), sizeof(its));
+  uint64_t value_ns = VClock::to_ns(its.it_value);
+  vt.interval_ns = VClock::to_ns(its.it_interval);
+  if (value_ns == 0) {
+    vt.next_ns = 0;
+  } else if (stop.arg(1) & TFD_TIMER_ABSTIME) {
+    vt.next_ns = value_ns;
+  } else {
+    vt.next_ns = now + value_ns;
+  }
+  // (re)arming drops anything that went off but wasn't read, like it would
+  struct itimerspec disarm;
+  memset(&disarm, 0, sizeof(disarm));
+  timerfd_settime(vt.localfd, 0, &disarm, nullptr);
+  printf("[FILTER] timerfd %d next at %lu, every %luns\n", fd, vt.next_ns,
+         vt.interval_ns);
+  skip_syscall(0);
+  fire_vtimers();
+}
+
+void Manager::handle_timerfd_gettime() {
+  int fd = stop.arg(0);
+  auto found = vtimers.find(fd);
+  if (found == vtimers.end() || !found->second.virt) {
+    return;
+  }
+  const VTimer &vt = found->second;
+  uint64_t now = vtime_ns();
+  struct itimerspec curr;
+  curr.it_value = VClock::from_ns(vt.next_ns > now ? vt.next_ns - now : 0);
+  curr.it_interval = VClock::from_ns(vt.interval_ns);
+  mem.write(&curr, stop.arg(1), sizeof(curr));
+  skip_syscall(0);
+}
+
+void Manager::fire_vtimers() {
+  uint64_t now = vtime_ns();
+  for (auto &tup : vtimers) {
+    VTimer &vt = tup.second;
+    if (!vt.virt || vt.next_ns == 0 || vt.next_ns > now) {
+      continue;
+    }
+    uint64_t ticks = 1;
+    if (vt.interval_ns > 0) {
+      ticks += (now - vt.next_ns) / vt.interval_ns;
+      vt.next_ns += ticks * vt.interval_ns;
+    } else {
+      vt.next_ns = 0;
+    }
+    // add to whatever the node hasn't read yet
+    uint64_t unread;
+    if (read(vt.localfd, &unread, sizeof(unread)) == sizeof(unread)) {
+      ticks += unread;
+    }
+    if (ioctl(vt.localfd, TFD_IOC_SET_TICKS, &ticks) < 0) {
+      // without CONFIG_CHECKPOINT_RESTORE, settle for a single expiration,
+      // from a real timer that's already expired
+      struct itimerspec past;
+      memset(&past, 0, sizeof(past));
+      past.it_value.tv_nsec = 1;
+      timerfd_settime(vt.localfd, TFD_TIMER_ABSTIME, &past, nullptr);
+    }
+    printf("[FILTER] timerfd %d went off %lu times\n", tup.first, ticks);
+  }
+}
+
+uint64_t Manager::next_vtimer() {
+  uint64_t next = TIMER_NEVER;
+  for (const auto &tup : vtimers) {
+    if (tup.second.virt && tup.second.next_ns != 0) {
+      next = std::min(next, tup.second.next_ns);
+    }
+  }
+  return next;
+}
+
 void Manager::increment_vtime(long sec, long nsec) {
   vtime.tv_nsec += nsec;
   vtime.tv_sec += sec + (vtime.tv_nsec / i1e9);
   vtime.tv_nsec %= i1e9;
+  publish_vtime();
+  if (!vtimers.empty()) {
+    fire_vtimers();
+  }
+}
+
+void Manager::publish_vtime() {
+  if (vclock != nullptr) {
+    __atomic_store_n(&vclock->now_ns, VClock::to_ns(vtime), __ATOMIC_SEQ_CST);
+  }
+}
+
+void Manager::collect_vtime() {
+  // the node may have read (and so ticked) the clock while it was running
+  if (vclock != nullptr) {
+    vtime = VClock::from_ns(__atomic_load_n(&vclock->now_ns, __ATOMIC_SEQ_CST));
+    if (!vtimers.empty()) {
+      fire_vtimers();
+    }
+  }
 }
 
 } // namespace Filter
\ No newline at end of file
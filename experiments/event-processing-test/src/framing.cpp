@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "framing.h"
+
+size_t RawFraming::scan(FrameState *, const char *, size_t len,
+                        bool *done) const {
+  // each piece is handed over as it was read
+  *done = true;
+  return len;
+}
+
+size_t LengthFraming::scan(FrameState *state, const char *data, size_t len,
+                           bool *done) const {
+  size_t pos = 0;
+  // expect is the length read so far while in the header, and the whole
+  // message's length after it
+  while (state->seen < HEADER_LEN && pos < len) {
+    state->expect = state->expect << 8 | (uint8_t)data[pos];
+    state->seen++;
+    pos++;
+    if (state->seen == HEADER_LEN) {
+      state->expect += HEADER_LEN;
+    }
+  }
+  if (state->seen < HEADER_LEN) {
+    *done = false;
+    return pos;
+  }
+  size_t take = state->expect - state->seen;
+  if (take > len - pos) {
+    take = len - pos;
+  }
+  state->seen += take;
+  pos += take;
+  *done = state->seen == state->expect;
+  if (*done) {
+    *state = FrameState{0, 0};
+  }
+  return pos;
+}
+
+size_t NewlineFraming::scan(FrameState *state, const char *data, size_t len,
+                            bool *done) const {
+  const char *end = (const char *)memchr(data, '\n', len);
+  size_t take = end == nullptr ? len : end - data + 1;
+  state->seen += take;
+  *done = end != nullptr;
+  if (*done) {
+    *state = FrameState{0, 0};
+  }
+  return take;
+}
+
+std::unique_ptr<Framing> make_framing(FrameKind kind) {
+  switch (kind) {
+  case FR_RAW:
+    return std::unique_ptr<Framing>(new RawFraming());
+  case FR_LENGTH:
+    return std::unique_ptr<Framing>(new LengthFraming());
+  case FR_NEWLINE:
+    return std::unique_ptr<Framing>(new NewlineFraming());
+  }
+  fprintf(stderr, "[FRAMING] unknown framing %d\n", kind);
+  exit(1);
+}
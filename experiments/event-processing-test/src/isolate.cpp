@@ -0,0 +1,102 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "isolate.h"
+
+namespace {
+void _write_file(const char *path, const std::string &contents) {
+  int fd = open(path, O_WRONLY | O_CLOEXEC);
+  if (fd < 0 || write(fd, contents.data(), contents.size()) !=
+                    (ssize_t)contents.size()) {
+    fprintf(stderr, "[ISOLATE] couldn't write %s: %s\n", path,
+            strerror(errno));
+    exit(1);
+  }
+  close(fd);
+}
+
+void _loopback_up() {
+  int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    fprintf(stderr, "[ISOLATE] socket failed: %s\n", strerror(errno));
+    exit(1);
+  }
+  struct ifreq ifr;
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, "lo", IFNAMSIZ - 1);
+  if (ioctl(fd, SIOCGIFFLAGS, &ifr) < 0) {
+    fprintf(stderr, "[ISOLATE] couldn't get lo flags: %s\n", strerror(errno));
+    exit(1);
+  }
+  ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
+  if (ioctl(fd, SIOCSIFFLAGS, &ifr) < 0) {
+    fprintf(stderr, "[ISOLATE] couldn't bring up lo: %s\n", strerror(errno));
+    exit(1);
+  }
+  close(fd);
+}
+
+void _mkdirs(const std::string &dir) {
+  for (size_t pos = 1; pos <= dir.size(); pos++) {
+    if (pos != dir.size() && dir[pos] != '/') {
+      continue;
+    }
+    std::string prefix = dir.substr(0, pos);
+    if (mkdir(prefix.c_str(), 0755) < 0 && errno != EEXIST) {
+      fprintf(stderr, "[ISOLATE] couldn't create %s: %s\n", prefix.c_str(),
+              strerror(errno));
+      exit(1);
+    }
+  }
+}
+
+} // namespace
+
+void enter_private_namespaces() {
+  uid_t uid = getuid();
+  gid_t gid = getgid();
+  if (unshare(CLONE_NEWUSER | CLONE_NEWNET | CLONE_NEWNS) < 0) {
+    fprintf(stderr, "[ISOLATE] unshare failed: %s\n", strerror(errno));
+    exit(1);
+  }
+  // same ids inside, so files look the same from both sides. gid_map can
+  // only be written unprivileged once setgroups is off
+  _write_file("/proc/self/setgroups", "deny");
+  _write_file("/proc/self/uid_map",
+              std::to_string(uid) + " " + std::to_string(uid) + " 1");
+  _write_file("/proc/self/gid_map",
+              std::to_string(gid) + " " + std::to_string(gid) + " 1");
+
+  // so private dirs don't show up on the host
+  if (mount(nullptr, "/", nullptr, MS_REC | MS_PRIVATE, nullptr) < 0) {
+    fprintf(stderr, "[ISOLATE] couldn't make mounts private: %s\n",
+            strerror(errno));
+    exit(1);
+  }
+  _loopback_up();
+  printf("[ISOLATE] in private namespaces as %d:%d\n", uid, gid);
+}
+
+void mount_private_dir(const std::string &dir) {
+  _mkdirs(dir);
+  if (mount("tmpfs", dir.c_str(), "tmpfs", MS_NOSUID | MS_NODEV,
+            "mode=0755") < 0) {
+    fprintf(stderr, "[ISOLATE] couldn't mount tmpfs on %s: %s\n", dir.c_str(),
+            strerror(errno));
+    exit(1);
+  }
+  printf("[ISOLATE] private tmpfs on %s\n", dir.c_str());
+}
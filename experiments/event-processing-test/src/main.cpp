@@ -15,6 +15,7 @@
 #include <sys/prctl.h>
 #include <sys/ptrace.h>
 #include <sys/reg.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/user.h>
@@ -28,8 +29,8 @@
 #include <fstream>
 #include <functional>
 #include <iterator>
+#include <memory>
 #include <random>
-#include <set>
 #include <sstream>
 #include <string>
 #include <thread>
@@ -40,12 +41,20 @@
 #include "decide.h"
 #include "fdmap.h"
 #include "filter.h"
+#include "framing.h"
+#include "isolate.h"
+#include "chunkstore.h"
+#include "persist.h"
 #include "proxy.h"
+#include "tracer.h"
+#include "transport.h"
 
 static const int NUM_ITERS = 10000;
 static const int PRINT_EVERY = 100;
-static const int NUM_NODES = 3;
-static const int NUM_CLIENTS = 3;
+// nodes are indexed from 0 and clients from CLIENT_OFFS, so there can't be
+// more nodes than that
+static const int MAX_NODES = ClientFilter::CLIENT_OFFS;
+static const int MAX_CLIENTS = 1000;
 
 static int run_validate(std::string seed, std::vector<std::string> command) {
   printf("[FILTER] Running validation command: ");
@@ -106,6 +115,22 @@ enum config_field {
   LISTEN_PORT,
   REPLAY_FILE,
   VISITED_FILE,
+  BACKEND,
+  EMULATE,
+  CLOCK,
+  TRACERS,
+  PROXY,
+  FRAMING,
+  DELIVERY,
+  TRANSPORT,
+  NAMESPACE,
+  NUM_NODES,
+  NUM_CLIENTS,
+  IDLE,
+  PERSIST,
+  BACKUPS,
+  STORE,
+  FILESYSTEM,
 };
 
 struct orch_config {
@@ -120,6 +145,22 @@ struct orch_config {
   in_port_t listen_port;
   std::string replay_file;
   std::string visited_file;
+  Filter::Backend backend;
+  bool emulate_at_entry;
+  bool shared_clock;
+  bool tracer_threads;
+  ProxyEngine proxy_engine;
+  FrameKind framing;
+  bool batch_delivery;
+  Transport transport;
+  NamespaceMode namespace_mode;
+  int num_nodes;
+  int num_clients;
+  bool idle_timers;
+  PersistMode persist_mode;
+  bool dirty_backups;
+  bool chunk_store;
+  bool mem_files;
 };
 
 bool validate_args(int argc, char **argv, orch_config &config) {
@@ -158,6 +199,38 @@ bool validate_args(int argc, char **argv, orch_config &config) {
           next_arg = REPLAY_FILE;
         } else if (actual_spec.compare("visited-file") == 0) {
           next_arg = VISITED_FILE;
+        } else if (actual_spec.compare("backend") == 0) {
+          next_arg = BACKEND;
+        } else if (actual_spec.compare("emulate") == 0) {
+          next_arg = EMULATE;
+        } else if (actual_spec.compare("clock") == 0) {
+          next_arg = CLOCK;
+        } else if (actual_spec.compare("tracers") == 0) {
+          next_arg = TRACERS;
+        } else if (actual_spec.compare("proxy") == 0) {
+          next_arg = PROXY;
+        } else if (actual_spec.compare("framing") == 0) {
+          next_arg = FRAMING;
+        } else if (actual_spec.compare("delivery") == 0) {
+          next_arg = DELIVERY;
+        } else if (actual_spec.compare("transport") == 0) {
+          next_arg = TRANSPORT;
+        } else if (actual_spec.compare("namespace") == 0) {
+          next_arg = NAMESPACE;
+        } else if (actual_spec.compare("nodes") == 0) {
+          next_arg = NUM_NODES;
+        } else if (actual_spec.compare("clients") == 0) {
+          next_arg = NUM_CLIENTS;
+        } else if (actual_spec.compare("idle") == 0) {
+          next_arg = IDLE;
+        } else if (actual_spec.compare("persist") == 0) {
+          next_arg = PERSIST;
+        } else if (actual_spec.compare("backups") == 0) {
+          next_arg = BACKUPS;
+        } else if (actual_spec.compare("store") == 0) {
+          next_arg = STORE;
+        } else if (actual_spec.compare("fs") == 0) {
+          next_arg = FILESYSTEM;
         } else {
           fprintf(stderr, "unexpected specifier %s\n", actual_spec.c_str());
           return false;
@@ -218,10 +291,6 @@ bool validate_args(int argc, char **argv, orch_config &config) {
       std::istringstream iss(arg);
       std::vector<std::string> addrs{std::istream_iterator<std::string>{iss},
                                      std::istream_iterator<std::string>{}};
-      if (addrs.size() != NUM_NODES) {
-        fprintf(stderr, "%s needs %d addrs\n", argv[i - 1] + 2, NUM_NODES);
-        return false;
-      }
       struct in_addr ad;
       for (const auto &addr : addrs) {
         if (inet_aton(addr.c_str(), &ad) == 0) {
@@ -288,6 +357,194 @@ bool validate_args(int argc, char **argv, orch_config &config) {
       }
       break;
     }
+    case BACKEND: {
+      next_arg = SPECIFIER;
+      if (arg.compare("ptrace") == 0) {
+        config.backend = Filter::BK_PTRACE;
+      } else if (arg.compare("notif") == 0) {
+        config.backend = Filter::BK_NOTIF;
+      } else {
+        fprintf(stderr, "unexpected backend %s\n", arg.c_str());
+        return false;
+      }
+      break;
+    }
+    case EMULATE: {
+      next_arg = SPECIFIER;
+      if (arg.compare("entry") == 0) {
+        config.emulate_at_entry = true;
+      } else if (arg.compare("exit") == 0) {
+        config.emulate_at_entry = false;
+      } else {
+        fprintf(stderr, "unexpected emulate point %s\n", arg.c_str());
+        return false;
+      }
+      break;
+    }
+    case CLOCK: {
+      next_arg = SPECIFIER;
+      if (arg.compare("shared") == 0) {
+        config.shared_clock = true;
+      } else if (arg.compare("trap") == 0) {
+        config.shared_clock = false;
+      } else {
+        fprintf(stderr, "unexpected clock %s\n", arg.c_str());
+        return false;
+      }
+      break;
+    }
+    case TRACERS: {
+      next_arg = SPECIFIER;
+      if (arg.compare("single") == 0) {
+        config.tracer_threads = false;
+      } else if (arg.compare("threads") == 0) {
+        config.tracer_threads = true;
+      } else {
+        fprintf(stderr, "unexpected tracers %s\n", arg.c_str());
+        return false;
+      }
+      break;
+    }
+    case PROXY: {
+      next_arg = SPECIFIER;
+      if (arg.compare("epoll") == 0) {
+        config.proxy_engine = PE_EPOLL;
+      } else if (arg.compare("uring") == 0) {
+        config.proxy_engine = PE_URING;
+      } else {
+        fprintf(stderr, "unexpected proxy %s\n", arg.c_str());
+        return false;
+      }
+      break;
+    }
+    case FRAMING: {
+      next_arg = SPECIFIER;
+      if (arg.compare("raw") == 0) {
+        config.framing = FR_RAW;
+      } else if (arg.compare("length") == 0) {
+        config.framing = FR_LENGTH;
+      } else if (arg.compare("newline") == 0) {
+        config.framing = FR_NEWLINE;
+      } else {
+        fprintf(stderr, "unexpected framing %s\n", arg.c_str());
+        return false;
+      }
+      break;
+    }
+    case DELIVERY: {
+      next_arg = SPECIFIER;
+      if (arg.compare("each") == 0) {
+        config.batch_delivery = false;
+      } else if (arg.compare("batch") == 0) {
+        config.batch_delivery = true;
+      } else {
+        fprintf(stderr, "unexpected delivery %s\n", arg.c_str());
+        return false;
+      }
+      break;
+    }
+    case TRANSPORT: {
+      next_arg = SPECIFIER;
+      if (arg.compare("tcp") == 0) {
+        config.transport = TR_TCP;
+      } else if (arg.compare("unix") == 0) {
+        config.transport = TR_UNIX;
+      } else {
+        fprintf(stderr, "unexpected transport %s\n", arg.c_str());
+        return false;
+      }
+      break;
+    }
+    case NAMESPACE: {
+      next_arg = SPECIFIER;
+      if (arg.compare("host") == 0) {
+        config.namespace_mode = NS_HOST;
+      } else if (arg.compare("private") == 0) {
+        config.namespace_mode = NS_PRIVATE;
+      } else {
+        fprintf(stderr, "unexpected namespace %s\n", arg.c_str());
+        return false;
+      }
+      break;
+    }
+    case NUM_NODES:
+    case NUM_CLIENTS: {
+      int max = next_arg == NUM_NODES ? MAX_NODES : MAX_CLIENTS;
+      int count = std::atoi(arg.c_str());
+      if (count <= 0 || count > max) {
+        fprintf(stderr, "%s should be from 1 to %d\n", argv[i - 1] + 2, max);
+        return false;
+      }
+      if (next_arg == NUM_NODES) {
+        config.num_nodes = count;
+      } else {
+        config.num_clients = count;
+      }
+      next_arg = SPECIFIER;
+      break;
+    }
+    case IDLE: {
+      next_arg = SPECIFIER;
+      if (arg.compare("polls") == 0) {
+        config.idle_timers = false;
+      } else if (arg.compare("timers") == 0) {
+        config.idle_timers = true;
+      } else {
+        fprintf(stderr, "unexpected idle %s\n", arg.c_str());
+        return false;
+      }
+      break;
+    }
+    case PERSIST: {
+      next_arg = SPECIFIER;
+      if (arg.compare("reflink") == 0) {
+        config.persist_mode = PM_REFLINK;
+      } else if (arg.compare("copy") == 0) {
+        config.persist_mode = PM_COPY_RANGE;
+      } else if (arg.compare("stream") == 0) {
+        config.persist_mode = PM_STREAM;
+      } else {
+        fprintf(stderr, "unexpected persist %s\n", arg.c_str());
+        return false;
+      }
+      break;
+    }
+    case BACKUPS: {
+      next_arg = SPECIFIER;
+      if (arg.compare("full") == 0) {
+        config.dirty_backups = false;
+      } else if (arg.compare("dirty") == 0) {
+        config.dirty_backups = true;
+      } else {
+        fprintf(stderr, "unexpected backups %s\n", arg.c_str());
+        return false;
+      }
+      break;
+    }
+    case STORE: {
+      next_arg = SPECIFIER;
+      if (arg.compare("files") == 0) {
+        config.chunk_store = false;
+      } else if (arg.compare("chunks") == 0) {
+        config.chunk_store = true;
+      } else {
+        fprintf(stderr, "unexpected store %s\n", arg.c_str());
+        return false;
+      }
+      break;
+    }
+    case FILESYSTEM: {
+      next_arg = SPECIFIER;
+      if (arg.compare("disk") == 0) {
+        config.mem_files = false;
+      } else if (arg.compare("mem") == 0) {
+        config.mem_files = true;
+      } else {
+        fprintf(stderr, "unexpected fs %s\n", arg.c_str());
+        return false;
+      }
+      break;
+    }
     }
   }
 
@@ -307,6 +564,12 @@ bool validate_args(int argc, char **argv, orch_config &config) {
     fprintf(stderr, "visited mode requires visited file\n");
     return false;
   }
+  if (config.old_addrs.size() != (size_t)config.num_nodes ||
+      config.new_addrs.size() != (size_t)config.num_nodes) {
+    fprintf(stderr, "old-addrs and new-addrs need %d addrs each\n",
+            config.num_nodes);
+    return false;
+  }
   for (const auto &new_addr : config.new_addrs) {
     if (old_addrs_set.find(new_addr) != old_addrs_set.end()) {
       fprintf(stderr, "new addr %s is in old addrs\n", new_addr.c_str());
@@ -339,6 +602,8 @@ bool validate_args(int argc, char **argv, orch_config &config) {
     printf("%s ", old_addr.c_str());
   }
   printf("]\n");
+  printf("       - nodes: %d\n", config.num_nodes);
+  printf("       - clients: %d\n", config.num_clients);
   printf("       - new_addrs: [ ");
   for (const auto &new_addr : config.new_addrs) {
     printf("%s ", new_addr.c_str());
@@ -347,6 +612,28 @@ bool validate_args(int argc, char **argv, orch_config &config) {
   printf("       - node_dir: \"%s\"\n", config.node_dir.c_str());
   printf("       - listen_port: %hu\n", config.listen_port);
   printf("       - replay_file: %s\n", config.replay_file.c_str());
+  printf("       - backend: %s\n",
+         config.backend == Filter::BK_NOTIF ? "notif" : "ptrace");
+  printf("       - emulate: %s\n", config.emulate_at_entry ? "entry" : "exit");
+  printf("       - clock: %s\n", config.shared_clock ? "shared" : "trap");
+  printf("       - tracers: %s\n",
+         config.tracer_threads ? "threads" : "single");
+  printf("       - proxy: %s\n",
+         config.proxy_engine == PE_URING ? "uring" : "epoll");
+  printf("       - framing: %s\n",
+         config.framing == FR_LENGTH
+             ? "length"
+             : (config.framing == FR_NEWLINE ? "newline" : "raw"));
+  printf("       - delivery: %s\n", config.batch_delivery ? "batch" : "each");
+  printf("       - transport: %s\n",
+         config.transport == TR_UNIX ? "unix" : "tcp");
+  printf("       - namespace: %s\n",
+         config.namespace_mode == NS_PRIVATE ? "private" : "host");
+  printf("       - idle: %s\n", config.idle_timers ? "timers" : "polls");
+  printf("       - persist: %s\n", persist_mode_name(config.persist_mode));
+  printf("       - backups: %s\n", config.dirty_backups ? "dirty" : "full");
+  printf("       - store: %s\n", config.chunk_store ? "chunks" : "files");
+  printf("       - fs: %s\n", config.mem_files ? "mem" : "disk");
 
   return true;
 }
@@ -370,7 +657,23 @@ int main(int argc, char **argv) {
       "",                // node_dir
       0,                 // listen_port
       "",                // replay file
-      ""                 // visited file
+      "",                // visited file
+      Filter::BK_PTRACE, // backend
+      false,             // emulate_at_entry
+      false,             // shared_clock
+      false,             // tracer_threads
+      PE_EPOLL,          // proxy_engine
+      FR_RAW,            // framing
+      false,             // batch_delivery
+      TR_TCP,            // transport
+      NS_HOST,           // namespace_mode
+      3,                 // num_nodes
+      3,                 // num_clients
+      false,             // idle_timers
+      PM_REFLINK,        // persist_mode
+      false,             // dirty_backups
+      false,             // chunk_store
+      false,             // mem_files
   };
   if (!validate_args(argc, argv, config)) {
     // too lazy to do proper arg parsing
@@ -385,6 +688,7 @@ int main(int argc, char **argv) {
             "--val \"<validate> <args>\"\n"
             "--old-addrs \"<addr> <addr> ...\"\n"
             "--new-addrs \"<addr> <addr> ...\"\n"
+            "\t- one of each for every node\n"
             "--node-dir \"<dir>\"\n"
             "\t- allows {addr} for node's addr\n"
             "--listen-port <port>\n"
@@ -393,28 +697,147 @@ int main(int argc, char **argv) {
             "trace in <file>\n"
             "--visited-file <file>\n"
             "\t- if mode=visited, read (if exists). for mode=(rand|visited) "
-            "write visited paths from <file>"
+            "write visited paths from <file>\n"
+            "--backend (ptrace|notif)\n"
+            "\t- how to intercept syscalls. notif answers time and randomness "
+            "through seccomp user notifications. defaults to ptrace"
+            "\n"
+            "--emulate (entry|exit)\n"
+            "\t- with ptrace, whether time and randomness syscalls are "
+            "answered at the\n\t  seccomp stop or run and overwritten at "
+            "syscall exit. defaults to exit"
+            "\n"
+            "--clock (shared|trap)\n"
+            "\t- shared lets nodes read vtime from a page shared with the "
+            "orchestrator\n\t  (through libvclock.so, next to this binary). "
+            "trap intercepts every read.\n\t  shared moves vtime differently from trap, "
+            "so replaying a trap trace\n\t  needs trap. defaults to trap"
+            "\n"
+            "--tracers (single|threads)\n"
+            "\t- threads gives every node and client its own tracer thread, "
+            "and runs\n\t  ones that aren't waiting on input ahead to their "
+            "next event while\n\t  others are picked. defaults to single"
             "\n"
+            "--proxy (epoll|uring)\n"
+            "\t- uring runs the proxy on io_uring, with multishot "
+            "accepts/recvs and\n\t  sends submitted in batches. defaults to "
+            "epoll"
+            "\n"
+            "--framing (raw|length|newline)\n"
+            "\t- how the proxy splits connections into messages it holds "
+            "back: whatever\n\t  one read returns, a 4 byte big endian "
+            "length prefix, or a '\\n' at the\n\t  end of each. a held "
+            "message can't be bigger than a link's pipe\n\t  (which grows to "
+            "/proc/sys/fs/pipe-max-size) with epoll, or all the\n\t  "
+            "buffers (2 MiB) with uring. orch stops the run with exit code "
+            "5 if\n\t  one is. defaults to raw"
+            "\n"
+            "--delivery (each|batch)\n"
+            "\t- each gives every fd with messages for the node being run "
+            "one chance to\n\t  deliver one. batch lets a turn deliver "
+            "any number from each, in any\n\t  order, recorded as one "
+            "decision. defaults to each"
+            "\n"
+            "--transport (tcp|unix)\n"
+            "\t- unix makes the AF_INET sockets of nodes, clients and the "
+            "proxy unix\n\t  sockets named after the addresses they "
+            "use, so the addresses and port\n\t  needn't be free (or "
+            "exist). defaults to tcp"
+            "\n"
+            "--namespace (host|private)\n"
+            "\t- private runs everything in new user, network and mount "
+            "namespaces, with\n\t  its own loopback and a fresh tmpfs "
+            "on every node dir, so any number of\n\t  orchs can use "
+            "the same addresses, port and node dirs. defaults to host"
+            "\n"
+            "--nodes <n>\n"
+            "\t- how many nodes to run. defaults to 3\n"
+            "--clients <m>\n"
+            "\t- how many clients to run. defaults to 3\n"
+            "--idle (polls|timers)\n"
+            "\t- who runs once every node is idle in a poll. polls spreads "
+            "turns by how\n\t  often each has polled. timers runs the one "
+            "whose poll would time out\n\t  first in virtual time (or that "
+            "has a message waiting), skipping\n\t  the turns spent timing "
+            "out the others. defaults to polls\n"
+            "--persist (reflink|copy|stream)\n"
+            "\t- how fsynced files are backed up and restored. reflink "
+            "shares their\n\t  extents copy-on-write, copy uses "
+            "copy_file_range, and stream copies\n\t  through orch. each "
+            "falls back to the next where the filesystem\n\t  can't. "
+            "defaults to reflink\n"
+            "--backups (full|dirty)\n"
+            "\t- what an fsync backup (or crash restore) copies. dirty "
+            "only copies what's\n\t  been written since the file and "
+            "its backup last matched, and needs\n\t  nodes to write "
+            "their files through write calls (not mmap). defaults\n\t  "
+            "to full\n"
+            "--store (files|chunks)\n"
+            "\t- where fsync backups are kept. files keeps them as files "
+            "beside the\n\t  originals, and chunks in orch's memory, "
+            "split into chunks stored once\n\t  each across every "
+            "node's backups. defaults to files\n"
+            "--fs (disk|mem)\n"
+            "\t- where the nodes' files in their node_dir are kept. with "
+            "mem, they're\n\t  memfds in orch that the nodes' opens are "
+            "pointed at, and the backups\n\t  are too unless they're "
+            "chunks. nodes can only reach their files\n\t  through open, "
+            "mknod, rename, unlink and truncate. defaults to disk\n"
             "commands should be delimited by #, not spaces\n",
             argv[0]);
     exit(1);
   }
+  if (config.namespace_mode == NS_PRIVATE) {
+    // before anything starts a thread
+    enter_private_namespaces();
+  }
+
+  std::string vclock_shim;
+  if (config.shared_clock) {
+    // the shim is built alongside orch
+    char self[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (len < 0) {
+      fprintf(stderr, "[ORCH] couldn't find own binary: %s\n", strerror(errno));
+      exit(1);
+    }
+    self[len] = '\0';
+    std::string dir(self);
+    vclock_shim = dir.substr(0, dir.rfind('/') + 1) + "libvclock.so";
+    if (access(vclock_shim.c_str(), R_OK) != 0) {
+      fprintf(stderr, "[ORCH] missing %s for --clock shared\n",
+              vclock_shim.c_str());
+      exit(1);
+    }
+  }
+
+  // with --fs mem every backup holds a memfd, and every proxied connection
+  // holds sockets (and a pipe, with epoll), so take every fd allowed
+  struct rlimit nofile;
+  if (getrlimit(RLIMIT_NOFILE, &nofile) == 0 &&
+      nofile.rlim_cur < nofile.rlim_max) {
+    nofile.rlim_cur = nofile.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &nofile) < 0) {
+      printf("[ORCH] couldn't raise the fd limit: %s\n", strerror(errno));
+    }
+  }
 
   // needed for the entire lifetime of the program, so just let it die
   Decider *decider;
   switch (config.mode) {
   case orch_mode::RAND: {
     decider =
-        new RRandDecider(config.seed, config.replay_file, config.visited_file);
+        new RRandDecider(config.seed, config.replay_file, config.visited_file,
+                         config.num_nodes);
     break;
   }
   case orch_mode::REPLAY: {
-    decider = new ReplayDecider(config.replay_file);
+    decider = new ReplayDecider(config.replay_file, config.num_nodes);
     break;
   }
   case orch_mode::VISITED: {
     decider = new VisitedDecider(config.seed, config.replay_file,
-                                 config.visited_file);
+                                 config.visited_file, config.num_nodes);
     break;
   }
   default: {
@@ -422,11 +845,19 @@ int main(int argc, char **argv) {
     exit(1);
   }
   }
-  FdMap fdmap(NUM_NODES, NUM_CLIENTS);
+  decider->set_batch_delivery(config.batch_delivery);
+  // when each idle node's poll will time out. only kept with --idle timers
+  TimerQueue timers(config.num_nodes);
+  if (config.idle_timers) {
+    decider->set_idle_timers(&timers);
+  }
+  FdMap fdmap(config.num_nodes, config.num_clients);
+  // every node's backups, when they're kept in memory with --store chunks
+  ChunkStore chunk_store;
 
   std::vector<sockaddr_in> newaddrs;
   std::vector<sockaddr_in> oldaddrs;
-  for (int i = 0; i < NUM_NODES; i++) {
+  for (int i = 0; i < config.num_nodes; i++) {
     printf("%s -> %s\n", config.old_addrs[i].c_str(),
            config.new_addrs[i].c_str());
     {
@@ -447,13 +878,14 @@ int main(int argc, char **argv) {
     }
   }
   printf("newaddr: %lu, oldaddr: %lu\n", newaddrs.size(), oldaddrs.size());
-  for (int i = 0; i < NUM_NODES; i++) {
+  for (int i = 0; i < config.num_nodes; i++) {
     printf("%s:%hu -> %s:%hu\n", inet_ntoa(oldaddrs[i].sin_addr),
            ntohs(oldaddrs[i].sin_port), inet_ntoa(newaddrs[i].sin_addr),
            ntohs(newaddrs[i].sin_port));
   }
 
-  Proxy proxy(fdmap, newaddrs, oldaddrs, NUM_CLIENTS);
+  Proxy proxy(fdmap, newaddrs, oldaddrs, config.num_clients,
+              config.proxy_engine, config.framing, config.transport);
   // // FIXME temporary for testing proxy
   // {
   //   while (true) {
@@ -479,17 +911,44 @@ int main(int argc, char **argv) {
   //   }
   // }
 
+  // with --tracers threads, every node and client is traced from its own
+  // thread, and anything touching it has to go through on_tracer
+  std::unordered_map<int, std::unique_ptr<Tracer>> tracers;
+  if (config.tracer_threads) {
+    // block SIGCHLD before the threads exist so they all inherit it. the
+    // notif backend waits on it through a signalfd, which misses it if it's
+    // delivered to a thread that doesn't block it
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+    for (int i = 0; i < config.num_nodes; i++) {
+      tracers[i].reset(new Tracer());
+    }
+    for (int i = 0; i < config.num_clients; i++) {
+      tracers[ClientFilter::CLIENT_OFFS + i].reset(new Tracer());
+    }
+  }
+  auto on_tracer = [&](int idx, std::function<void()> job) {
+    auto found = tracers.find(idx);
+    if (found == tracers.end()) {
+      job();
+    } else {
+      found->second->run(job);
+    }
+  };
+
   std::vector<Filter::Manager> managers;
-  std::set<int> waiting_nodes;
+  RunSet waiting_nodes(0, config.num_nodes);
   std::unordered_map<int, int> num_polls;
-  for (int i = 0; i < NUM_NODES; i++) {
+  for (int i = 0; i < config.num_nodes; i++) {
     std::string node_addr = config.old_addrs[i];
     std::vector<std::string> command;
     for (const auto &tok : config.node_cmd) {
       if (tok.compare("{addr}") == 0) {
         command.push_back(node_addr);
       } else if (tok.compare("{o_addrs}") == 0) {
-        for (int j = 0; j < NUM_NODES; j++) {
+        for (int j = 0; j < config.num_nodes; j++) {
           if (i != j) {
             command.push_back(inet_ntoa(oldaddrs[j].sin_addr));
           }
@@ -512,8 +971,21 @@ int main(int argc, char **argv) {
       found = next + 6;
     }
     node_dir.append(config.node_dir.substr(found));
-    managers.push_back(Filter::Manager(i, command, oldaddrs[i], newaddrs[i],
-                                       fdmap, node_dir, false));
+    if (config.namespace_mode == NS_PRIVATE) {
+      mount_private_dir(node_dir);
+    }
+    on_tracer(i, [&] {
+      managers.push_back(Filter::Manager(i, command, oldaddrs[i], newaddrs[i],
+                                         fdmap, node_dir, false,
+                                         config.backend,
+                                         config.emulate_at_entry, vclock_shim,
+                                         config.transport,
+                                         config.persist_mode,
+                                         config.dirty_backups,
+                                         config.chunk_store ? &chunk_store
+                                                            : nullptr,
+                                         config.mem_files));
+    });
     waiting_nodes.insert(i);
     num_polls[i] = 0;
     // // FIXME temporary for testing virtual clock stuff
@@ -523,47 +995,109 @@ int main(int argc, char **argv) {
   }
 
   std::vector<ClientFilter::ClientManager> clients;
-  std::set<int> non_recv_clients;
-  for (int i = 0; i < NUM_CLIENTS; i++) {
+  RunSet non_recv_clients(ClientFilter::CLIENT_OFFS, config.num_clients);
+  for (int i = 0; i < config.num_clients; i++) {
     int idx = ClientFilter::CLIENT_OFFS + i;
-    clients.push_back(ClientFilter::ClientManager(
-        idx, config.seed, config.client_cmd, fdmap, false));
+    on_tracer(idx, [&] {
+      clients.push_back(ClientFilter::ClientManager(
+          idx, config.seed, config.client_cmd, fdmap, false,
+          config.transport));
+    });
     non_recv_clients.insert(idx);
   }
 
+  // events that nodes and clients were run ahead to on their tracers, kept
+  // until they're picked. (true, ev) if one is parked. only the tracee's own
+  // tracer touches the event, so it's safe for others to run meanwhile
+  std::vector<std::pair<bool, Filter::Event>> parked_nodes(
+      config.num_nodes, {false, Filter::EV_DEAD});
+  std::vector<std::pair<bool, ClientFilter::Event>> parked_clients(
+      config.num_clients, {false, ClientFilter::EV_DEAD});
+  // starts every tracee that isn't waiting on input towards its next event.
+  // to_next_event doesn't consult the decider, so which event each one
+  // reaches doesn't depend on when it's run
+  auto run_ahead = [&]() {
+    for (auto &tup : tracers) {
+      int idx = tup.first;
+      if (idx < ClientFilter::CLIENT_OFFS) {
+        if (parked_nodes[idx].first || !managers[idx].can_run_ahead()) {
+          continue;
+        }
+        parked_nodes[idx].first = true;
+        tup.second->post([&, idx] {
+          parked_nodes[idx].second = managers[idx].to_next_event();
+        });
+      } else {
+        int cidx = idx - ClientFilter::CLIENT_OFFS;
+        if (parked_clients[cidx].first || !clients[cidx].can_run_ahead()) {
+          continue;
+        }
+        parked_clients[cidx].first = true;
+        tup.second->post([&, cidx] {
+          parked_clients[cidx].second = clients[cidx].to_next_event();
+        });
+      }
+    }
+  };
+
   unsigned long long cnt = 0;
   unsigned long long it = 0;
-  int num_alive_nodes = NUM_NODES;
+  int num_alive_nodes = config.num_nodes;
+  // reused for every get_fds_with_msgs, and the batch sent from them
+  std::vector<int> msg_fds;
+  std::vector<size_t> msg_counts, batch;
   while (NUM_ITERS <= 0 || it++ < NUM_ITERS) {
+    if (proxy.msg_too_big()) {
+      fprintf(stderr, "[ORCH] a message is too big for the proxy to hold\n");
+      printf("[ORCH] a message is too big for the proxy to hold\n");
+      fflush(stdout);
+      kill_children();
+      decider->write_metadata();
+      exit(5);
+    }
+    proxy.set_step(it);
     {
       printf("[ORCH] printing state\n");
       proxy.print_state();
       printf("[ORCH] finished printing state\n");
       // jank way to send client responses
-      for (int i = 0; i < NUM_CLIENTS; i++) {
+      for (int i = 0; i < config.num_clients; i++) {
         int idx = i + ClientFilter::CLIENT_OFFS;
-        auto client_fds = proxy.get_fds_with_msgs(idx);
-        int count = 0;
-        for (const auto &x : client_fds) {
+        proxy.get_fds_with_msgs(idx, &msg_fds);
+        for (const auto &x : msg_fds) {
           while (proxy.has_more(x)) {
-            count++;
             non_recv_clients.insert(idx);
             if (proxy.allow_next_msg(x)) {
-              count++;
               break;
             }
           }
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(count * 30));
       }
+      proxy.wait_delivered();
     }
 
+    run_ahead();
+    if (config.idle_timers) {
+      // a message waiting for an idle node makes its poll return at once
+      for (int i = 0; i < config.num_nodes; i++) {
+        if (timers.armed(i) && timers.deadline(i) > managers[i].vtime_ns()) {
+          proxy.get_fds_with_msgs(i, &msg_fds);
+          if (!msg_fds.empty()) {
+            timers.arm(i, managers[i].vtime_ns());
+          }
+        }
+      }
+    }
     int node_idx = decider->get_next_node(num_alive_nodes, waiting_nodes,
                                           non_recv_clients);
 
     if ((it % PRINT_EVERY) == 0) {
       fprintf(stderr, "[ORCH] Current node: %d\n", node_idx);
       printf("[ORCH] validating\n");
+      // nodes running ahead may be touching their files
+      for (auto &tup : tracers) {
+        tup.second->wait();
+      }
       for (auto &mgr : managers) {
         mgr.setup_validate();
       }
@@ -583,225 +1117,261 @@ int main(int argc, char **argv) {
 
     if (node_idx < ClientFilter::CLIENT_OFFS) {
       // it's a node
+      timers.disarm(node_idx);
       {
         // send outstanding messages to the node
-        auto send_fds = proxy.get_fds_with_msgs(node_idx);
-        printf("[ORCH] Found %lu fds with waiting messages\n", send_fds.size());
-        int count = 0;
-        for (const auto &x : send_fds) {
-          if (decider->should_send_msg()) {
-            if (proxy.allow_next_msg(x))
-              count++;
-            count++;
-          }
+        proxy.get_fds_with_msgs(node_idx, &msg_fds);
+        printf("[ORCH] Found %lu fds with waiting messages\n", msg_fds.size());
+        msg_counts.clear();
+        for (const auto &x : msg_fds) {
+          msg_counts.push_back(proxy.num_msgs(x));
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(count * 50));
-      }
-
-      auto &manager = managers[node_idx];
-      bool to_continue;
-      bool has_sent;
-      do {
-        has_sent = false;
-        to_continue = false;
-        Filter::Event ev = manager.to_next_event();
-        switch (ev) {
-        case Filter::EV_RANDOM: {
-          manager.handle_getrandom(ev, [&](void *buf, size_t buflen) -> void {
-            decider->fill_random(buf, buflen);
-          });
-          to_continue = true;
-          break;
+        decider->choose_batch(msg_counts, &batch);
+        for (size_t i : batch) {
+          proxy.allow_next_msg(msg_fds[i]);
         }
-        case Filter::EV_CONNECT:
-        case Filter::EV_SENDTO: {
-          proxy.set_alive(node_idx);
-          waiting_nodes.insert(node_idx);
-          if ((ev == Filter::EV_CONNECT && decider->should_fail_on_connect()) ||
-              (ev == Filter::EV_SENDTO && decider->should_fail_on_send())) {
-            num_alive_nodes--;
-            printf("[ORCH STATE] Toggled node before network - %d, %d left\n",
-                   node_idx, num_alive_nodes);
-            fprintf(stderr, "Killed node before network - %d\n", node_idx);
-            for (auto &tup : proxy.toggle_node(node_idx)) {
-              if (tup.first >= ClientFilter::CLIENT_OFFS) {
-                // node died while there was a client connection, make sure the
-                // client is available to run
-                printf("[ORCH] re-enabling client %d\n", tup.first);
-                non_recv_clients.insert(tup.first);
-              }
-            }
-            fflush(stdout);
-            manager.toggle_node();
+        proxy.wait_delivered();
+      }
+
+      // the node can only be traced from its own tracer
+      on_tracer(node_idx, [&] {
+        auto &manager = managers[node_idx];
+        bool to_continue;
+        bool has_sent;
+        do {
+          has_sent = false;
+          to_continue = false;
+          Filter::Event ev;
+          if (parked_nodes[node_idx].first) {
+            ev = parked_nodes[node_idx].second;
+            parked_nodes[node_idx].first = false;
           } else {
-            int res = manager.allow_event(ev);
-            if (res < 0) {
-              printf("[ORCH] Send/connect failed\n");
-            } else {
-              has_sent = true;
-            }
+            ev = manager.to_next_event();
+          }
+          switch (ev) {
+          case Filter::EV_RANDOM: {
+            manager.handle_getrandom(ev, [&](void *buf, size_t buflen) -> void {
+              decider->fill_random(buf, buflen);
+            });
             to_continue = true;
+            break;
           }
-          break;
-        }
-        case Filter::EV_WRITE: {
-          proxy.set_alive(node_idx);
-          waiting_nodes.insert(node_idx);
-          int ret = manager.handle_write(ev, [&](size_t max_write) -> size_t {
-            if (decider->should_fail_on_write()) {
-              return max_write / 2;
+          case Filter::EV_CONNECT:
+          case Filter::EV_SENDTO: {
+            proxy.set_alive(node_idx);
+            waiting_nodes.insert(node_idx);
+            if ((ev == Filter::EV_CONNECT &&
+                 decider->should_fail_on_connect()) ||
+                (ev == Filter::EV_SENDTO && decider->should_fail_on_send())) {
+              num_alive_nodes--;
+              printf("[ORCH STATE] Toggled node before network - %d, %d left\n",
+                     node_idx, num_alive_nodes);
+              fprintf(stderr, "Killed node before network - %d\n", node_idx);
+              for (auto &tup : proxy.toggle_node(node_idx)) {
+                if (tup.first >= ClientFilter::CLIENT_OFFS) {
+                  // node died while there was a client connection, make sure
+                  // the client is available to run
+                  printf("[ORCH] re-enabling client %d\n", tup.first);
+                  non_recv_clients.insert(tup.first);
+                }
+              }
+              fflush(stdout);
+              manager.toggle_node();
             } else {
-              return max_write;
+              int res = manager.allow_event(ev);
+              if (res < 0) {
+                printf("[ORCH] Send/connect failed\n");
+              } else {
+                has_sent = true;
+              }
+              to_continue = true;
             }
-          });
-          if (ret < 0) {
-            num_alive_nodes--;
-            printf("[ORCH STATE] Toggled node during write - %d, %d left\n",
-                   node_idx, num_alive_nodes);
-            fprintf(stderr, "Killed node during write - %d\n", node_idx);
-            for (auto &tup : proxy.toggle_node(node_idx)) {
-              if (tup.first >= ClientFilter::CLIENT_OFFS) {
-                // node died while there was a client connection, make sure the
-                // client is available to run
-                printf("[ORCH] re-enabling client %d\n", tup.first);
-                non_recv_clients.insert(tup.first);
+            break;
+          }
+          case Filter::EV_WRITE: {
+            proxy.set_alive(node_idx);
+            waiting_nodes.insert(node_idx);
+            int ret = manager.handle_write(ev, [&](size_t max_write) -> size_t {
+              if (decider->should_fail_on_write()) {
+                return max_write / 2;
+              } else {
+                return max_write;
               }
+            });
+            if (ret < 0) {
+              num_alive_nodes--;
+              printf("[ORCH STATE] Toggled node during write - %d, %d left\n",
+                     node_idx, num_alive_nodes);
+              fprintf(stderr, "Killed node during write - %d\n", node_idx);
+              for (auto &tup : proxy.toggle_node(node_idx)) {
+                if (tup.first >= ClientFilter::CLIENT_OFFS) {
+                  // node died while there was a client connection, make sure
+                  // the client is available to run
+                  printf("[ORCH] re-enabling client %d\n", tup.first);
+                  non_recv_clients.insert(tup.first);
+                }
+              }
+              fflush(stdout);
+              manager.toggle_node();
+            } else {
+              to_continue = true;
             }
-            fflush(stdout);
-            manager.toggle_node();
-          } else {
-            to_continue = true;
+            break;
           }
-          break;
-        }
-        case Filter::EV_FSYNC: {
-          proxy.set_alive(node_idx);
-          waiting_nodes.insert(node_idx);
-          if (decider->should_fail_on_fsync()) {
-            num_alive_nodes--;
-            printf("[ORCH STATE] Toggled node before fsync - %d, %d left\n",
-                   node_idx, num_alive_nodes);
-            fprintf(stderr, "Killed node before fsync - %d\n", node_idx);
-            for (auto &tup : proxy.toggle_node(node_idx)) {
-              if (tup.first >= ClientFilter::CLIENT_OFFS) {
-                // node died while there was a client connection, make sure the
-                // client is available to run
-                printf("[ORCH] re-enabling client %d\n", tup.first);
-                non_recv_clients.insert(tup.first);
+          case Filter::EV_FSYNC: {
+            proxy.set_alive(node_idx);
+            waiting_nodes.insert(node_idx);
+            if (decider->should_fail_on_fsync()) {
+              num_alive_nodes--;
+              printf("[ORCH STATE] Toggled node before fsync - %d, %d left\n",
+                     node_idx, num_alive_nodes);
+              fprintf(stderr, "Killed node before fsync - %d\n", node_idx);
+              for (auto &tup : proxy.toggle_node(node_idx)) {
+                if (tup.first >= ClientFilter::CLIENT_OFFS) {
+                  // node died while there was a client connection, make sure
+                  // the client is available to run
+                  printf("[ORCH] re-enabling client %d\n", tup.first);
+                  non_recv_clients.insert(tup.first);
+                }
               }
+              fflush(stdout);
+              manager.toggle_node();
+            } else {
+              manager.handle_fsync(ev, [&](size_t max_ops) -> size_t {
+                if (decider->should_rename_on_fsync()) {
+                  return max_ops;
+                } else {
+                  return 0;
+                }
+              });
+              to_continue = true;
+            }
+            break;
+          }
+          case Filter::EV_DEAD: {
+            waiting_nodes.erase(node_idx);
+            if (decider->should_revive()) {
+              num_alive_nodes++;
+              printf("[ORCH STATE] Revived node - %d, %d left\n", node_idx,
+                     num_alive_nodes);
+              fprintf(stderr, "Revived node - %d\n", node_idx);
+              manager.toggle_node();
+              proxy.toggle_node(node_idx);
+              to_continue = true;
             }
+            break;
+          }
+          case Filter::EV_POLLING: {
+            proxy.set_alive(node_idx);
+            waiting_nodes.erase(node_idx);
+            if (config.idle_timers) {
+              timers.arm(node_idx, manager.poll_deadline());
+            }
+            break;
+          }
+          case Filter::EV_EXIT: {
+            fprintf(stderr, "[ORCH] node %d exited unexpectedly.\n", node_idx);
+            printf("[ORCH] node %d exited unexpectedly.\n", node_idx);
             fflush(stdout);
-            manager.toggle_node();
-          } else {
-            manager.handle_fsync(ev, [&](size_t max_ops) -> size_t {
-              if (decider->should_rename_on_fsync()) {
-                return max_ops;
-              } else {
-                return 0;
-              }
-            });
-            to_continue = true;
+            kill_children();
+            decider->write_metadata();
+            exit(2);
           }
-          break;
-        }
-        case Filter::EV_DEAD: {
-          waiting_nodes.erase(node_idx);
-          if (decider->should_revive()) {
-            num_alive_nodes++;
-            printf("[ORCH STATE] Revived node - %d, %d left\n", node_idx,
-                   num_alive_nodes);
-            fprintf(stderr, "Revived node - %d\n", node_idx);
-            manager.toggle_node();
-            proxy.toggle_node(node_idx);
-            to_continue = true;
+          case Filter::EV_INTERNAL:
+            // never returned by to_next_event
+            break;
           }
-          break;
-        }
-        case Filter::EV_POLLING: {
-          proxy.set_alive(node_idx);
-          waiting_nodes.erase(node_idx);
-          break;
-        }
-        case Filter::EV_EXIT: {
-          fprintf(stderr, "[ORCH] node %d exited unexpectedly.\n", node_idx);
-          printf("[ORCH] node %d exited unexpectedly.\n", node_idx);
-          fflush(stdout);
-          kill_children();
-          decider->write_metadata();
-          exit(2);
-        }
-        }
-        if (has_sent) {
-          proxy.poll_for_events(true);
-          has_sent = false;
-        }
-      } while (to_continue);
+          if (has_sent) {
+            proxy.poll_for_events(true);
+            has_sent = false;
+          }
+        } while (to_continue);
+      });
     } else {
       // it's a client
-      auto &client = clients[node_idx - ClientFilter::CLIENT_OFFS];
-
-      bool has_sent, to_continue;
-      do {
-        has_sent = false;
-        to_continue = false;
-
-        ClientFilter::Event ev = client.to_next_event();
-        switch (ev) {
-        case ClientFilter::EV_CLOSE: {
-          has_sent = client.handle_close();
-          to_continue = true;
-          break;
-        }
-        case ClientFilter::EV_CONNECT:
-        case ClientFilter::EV_SENDTO: {
-          if ((ev == ClientFilter::EV_CONNECT &&
-               decider->c_should_fail_on_connect()) ||
-              (ev == ClientFilter::EV_SENDTO &&
-               decider->c_should_fail_on_send())) {
-            fprintf(stderr, "Killed client - %d\n", node_idx);
-            printf("[ORCH STATE] Toggled client - %d\n", node_idx);
-            proxy.toggle_node(node_idx);
-            client.toggle_client();
+      on_tracer(node_idx, [&] {
+        auto &client = clients[node_idx - ClientFilter::CLIENT_OFFS];
+
+        bool has_sent, to_continue;
+        do {
+          has_sent = false;
+          to_continue = false;
+
+          ClientFilter::Event ev;
+          auto &parked = parked_clients[node_idx - ClientFilter::CLIENT_OFFS];
+          if (parked.first) {
+            ev = parked.second;
+            parked.first = false;
           } else {
-            int res = client.allow_event(ev);
-            if (res < 0) {
-              printf("[ORCH] Send/connect failed\n");
+            ev = client.to_next_event();
+          }
+          switch (ev) {
+          case ClientFilter::EV_CLOSE: {
+            has_sent = client.handle_close();
+            to_continue = true;
+            break;
+          }
+          case ClientFilter::EV_CONNECT:
+          case ClientFilter::EV_SENDTO: {
+            if ((ev == ClientFilter::EV_CONNECT &&
+                 decider->c_should_fail_on_connect()) ||
+                (ev == ClientFilter::EV_SENDTO &&
+                 decider->c_should_fail_on_send())) {
+              fprintf(stderr, "Killed client - %d\n", node_idx);
+              printf("[ORCH STATE] Toggled client - %d\n", node_idx);
+              proxy.toggle_node(node_idx);
+              client.toggle_client();
             } else {
-              has_sent = true;
+              int res = client.allow_event(ev);
+              if (res < 0) {
+                printf("[ORCH] Send/connect failed\n");
+              } else {
+                has_sent = true;
+              }
             }
+            break;
           }
-          break;
-        }
-        case ClientFilter::EV_DEAD: {
-          // just revive since client being dead doesn't really change anything
-          fprintf(stderr, "Revived client - %d\n", node_idx);
-          printf("[ORCH STATE] Toggled client - %d\n", node_idx);
-          proxy.toggle_node(node_idx);
-          client.toggle_client();
-          to_continue = true;
-          break;
-        }
-        case ClientFilter::EV_RECVING: {
-          non_recv_clients.erase(node_idx);
-          break;
-        }
-        case Filter::EV_EXIT: {
-          fflush(stdout);
-          fprintf(stderr, "[ORCH] client %d exited unexpectedly.\n", node_idx);
-          printf("[ORCH] client %d exited unexpectedly.\n", node_idx);
-          kill_children();
-          decider->write_metadata();
-          exit(3);
-        }
-        }
-        if (has_sent) {
-          proxy.poll_for_events(true);
-          has_sent = false;
-        }
-      } while (to_continue);
+          case ClientFilter::EV_DEAD: {
+            // just revive since client being dead doesn't really change
+            // anything
+            fprintf(stderr, "Revived client - %d\n", node_idx);
+            printf("[ORCH STATE] Toggled client - %d\n", node_idx);
+            proxy.toggle_node(node_idx);
+            client.toggle_client();
+            to_continue = true;
+            break;
+          }
+          case ClientFilter::EV_RECVING: {
+            non_recv_clients.erase(node_idx);
+            break;
+          }
+          case Filter::EV_EXIT: {
+            fflush(stdout);
+            fprintf(stderr, "[ORCH] client %d exited unexpectedly.\n",
+                    node_idx);
+            printf("[ORCH] client %d exited unexpectedly.\n", node_idx);
+            kill_children();
+            decider->write_metadata();
+            exit(3);
+          }
+          case ClientFilter::EV_INTERNAL:
+            // never returned by to_next_event
+            break;
+          }
+          if (has_sent) {
+            proxy.poll_for_events(true);
+            has_sent = false;
+          }
+        } while (to_continue);
+      });
     }
   }
 
+  if (config.chunk_store) {
+    printf("[ORCH] chunk store: %zu chunks, %lu bytes, %lu deduped\n",
+           chunk_store.num_chunks(), (unsigned long)chunk_store.num_bytes(),
+           (unsigned long)chunk_store.num_deduped());
+  }
   printf("[ORCH] finished successfully\n");
   fflush(stdout);
   kill_children();
@@ -0,0 +1,116 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "memfs.h"
+
+namespace {
+// read/write buffer for imports
+const size_t IMPORT_BUF = 1 << 16;
+
+int _memfd(const std::string &path) {
+  // the name is only for /proc/<pid>/fd links, so it's fine if it's cut off
+  int fd = memfd_create(path.c_str(), MFD_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "[MEMFS] memfd_create for %s failed: %s\n", path.c_str(),
+            strerror(errno));
+    exit(1);
+  }
+  return fd;
+}
+} // namespace
+
+MemFs::MemFs()
+    : fd_dir("/proc/" + std::to_string(getpid()) + "/fd/"), files() {}
+
+int MemFs::fd(const std::string &path) const {
+  auto it = files.find(path);
+  return it == files.end() ? -1 : it->second;
+}
+
+int MemFs::create(const std::string &path) {
+  auto it = files.find(path);
+  if (it != files.end()) {
+    return it->second;
+  }
+  int fd = _memfd(path);
+  files[path] = fd;
+  return fd;
+}
+
+std::string MemFs::proc_path(const std::string &path) const {
+  auto it = files.find(path);
+  if (it == files.end()) {
+    return path;
+  }
+  return fd_dir + std::to_string(it->second);
+}
+
+bool MemFs::rename(const std::string &from, const std::string &to) {
+  auto it = files.find(from);
+  if (it == files.end()) {
+    return false;
+  } else if (from == to) {
+    return true;
+  }
+  int fd = it->second;
+  files.erase(it);
+  unlink(to);
+  files[to] = fd;
+  return true;
+}
+
+bool MemFs::unlink(const std::string &path) {
+  auto it = files.find(path);
+  if (it == files.end()) {
+    return false;
+  }
+  close(it->second);
+  files.erase(it);
+  return true;
+}
+
+bool MemFs::import(const std::string &path) {
+  int src = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (src < 0) {
+    return false;
+  }
+  struct stat s;
+  if (fstat(src, &s) < 0 || !S_ISREG(s.st_mode)) {
+    close(src);
+    return false;
+  }
+  unlink(path);
+  int dst = create(path);
+  char buf[IMPORT_BUF];
+  ssize_t n;
+  while ((n = read(src, buf, IMPORT_BUF)) != 0) {
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0) {
+      fprintf(stderr, "[MEMFS] reading %s failed: %s\n", path.c_str(),
+              strerror(errno));
+      exit(1);
+    }
+    for (ssize_t done = 0; done < n;) {
+      ssize_t written = write(dst, buf + done, n - done);
+      if (written < 0) {
+        fprintf(stderr, "[MEMFS] write failed: %s\n", strerror(errno));
+        exit(1);
+      }
+      done += written;
+    }
+  }
+  close(src);
+  if (::unlink(path.c_str()) < 0) {
+    fprintf(stderr, "[MEMFS] couldn't remove %s: %s\n", path.c_str(),
+            strerror(errno));
+    exit(1);
+  }
+  return true;
+}
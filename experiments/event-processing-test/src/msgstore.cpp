@@ -0,0 +1,271 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "msgstore.h"
+
+namespace {
+// how big each link's pipe is asked to be (the default pipe-max-size)
+const int PIPE_SIZE = 1 << 20;
+
+static_assert((MsgStore::MSGS_PER_LINK & (MsgStore::MSGS_PER_LINK - 1)) == 0,
+              "MSGS_PER_LINK has to be a power of 2");
+
+// the most an unprivileged F_SETPIPE_SZ can ask for
+size_t pipe_max_size() {
+  static size_t max_size = 0;
+  if (max_size == 0) {
+    max_size = PIPE_SIZE;
+    FILE *f = fopen("/proc/sys/fs/pipe-max-size", "r");
+    if (f != nullptr) {
+      if (fscanf(f, "%lu", &max_size) != 1) {
+        max_size = PIPE_SIZE;
+      }
+      fclose(f);
+    }
+  }
+  return max_size;
+}
+
+} // namespace
+
+MsgStore::MsgStore() {}
+
+MsgStore::~MsgStore() {
+  for (int fd : std::vector<int>(open_fds)) {
+    close(fd);
+  }
+}
+
+void MsgStore::open(int fd, bool with_pipe) {
+  if (is_open(fd)) {
+    fprintf(stderr, "[MSGSTORE] %d is already open\n", fd);
+    exit(1);
+  }
+  if (free_links.empty()) {
+    // only happens when more links are open than ever before
+    free_links.push_back(links.size());
+    links.push_back(Link());
+    slab.resize(links.size() * MSGS_PER_LINK);
+    buf_slab.resize(links.size() * MSGS_PER_LINK);
+  }
+  size_t idx = free_links.back();
+  free_links.pop_back();
+
+  Link &link = links[idx];
+  link.fd = fd;
+  link.pos = open_fds.size();
+  link.head = 0;
+  link.count = 0;
+  link.buf_head = 0;
+  link.buf_count = 0;
+  link.bytes = 0;
+  link.limit = 0;
+  link.next_off = 0;
+  link.scanned = 0;
+  link.framed = 0;
+  link.frame = FrameState{0, 0};
+  link.rd = -1;
+  link.wr = -1;
+  if (with_pipe) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) < 0) {
+      fprintf(stderr, "[MSGSTORE] pipe for %d failed: %s\n", fd,
+              strerror(errno));
+      exit(1);
+    }
+    // not fatal, the link just fills up sooner
+    if (fcntl(fds[1], F_SETPIPE_SZ, PIPE_SIZE) < 0) {
+      printf("[MSGSTORE] couldn't grow pipe for %d: %s\n", fd,
+             strerror(errno));
+    }
+    link.rd = fds[0];
+    link.wr = fds[1];
+    link.limit = fcntl(fds[1], F_GETPIPE_SZ);
+  }
+
+  if ((size_t)fd >= fd_link.size()) {
+    fd_link.resize(fd + 1, -1);
+  }
+  fd_link[fd] = idx;
+  open_fds.push_back(fd);
+}
+
+void MsgStore::close(int fd) {
+  int idx = link_idx(fd);
+  if (idx < 0) {
+    return;
+  }
+  Link &link = links[idx];
+  if (link.rd >= 0) {
+    ::close(link.rd);
+    ::close(link.wr);
+  }
+  // swap the last open fd into this one's place
+  int last = open_fds.back();
+  open_fds[link.pos] = last;
+  links[fd_link[last]].pos = link.pos;
+  open_fds.pop_back();
+
+  fd_link[fd] = -1;
+  free_links.push_back(idx);
+}
+
+size_t MsgStore::count(int fd) const {
+  int idx = link_idx(fd);
+  return idx < 0 ? 0 : links[idx].count;
+}
+
+size_t MsgStore::bytes(int fd) const {
+  int idx = link_idx(fd);
+  return idx < 0 ? 0 : links[idx].bytes;
+}
+
+size_t MsgStore::byte_limit(int fd) const { return get(fd).limit; }
+
+bool MsgStore::full(int fd) const {
+  const Link &link = get(fd);
+  return link.count == MSGS_PER_LINK ||
+         (link.limit > 0 && link.bytes >= link.limit);
+}
+
+bool MsgStore::grow(int fd) {
+  Link &link = get(fd);
+  if (link.wr < 0 || link.limit >= pipe_max_size()) {
+    return false;
+  }
+  size_t new_size = std::min(link.limit * 2, pipe_max_size());
+  if (fcntl(link.wr, F_SETPIPE_SZ, (int)new_size) < 0) {
+    printf("[MSGSTORE] couldn't grow pipe for %d: %s\n", fd, strerror(errno));
+    return false;
+  }
+  link.limit = fcntl(link.wr, F_GETPIPE_SZ);
+  return true;
+}
+
+size_t MsgStore::room(int fd) const { return MSGS_PER_LINK - get(fd).count; }
+
+int MsgStore::pipe_in(int fd) const { return get(fd).wr; }
+
+int MsgStore::pipe_out(int fd) const { return get(fd).rd; }
+
+void MsgStore::add(int fd, uint32_t len, int32_t buf) {
+  Link &link = get(fd);
+  if (buf >= 0) {
+    if (link.buf_count == MSGS_PER_LINK) {
+      fprintf(stderr, "[MSGSTORE] no room for another buffer on %d\n", fd);
+      exit(1);
+    }
+    size_t idx = fd_link[fd] * MSGS_PER_LINK +
+                 ((link.buf_head + link.buf_count) & (MSGS_PER_LINK - 1));
+    buf_slab[idx] = HeldBuf{link.next_off, len, (uint16_t)buf};
+    link.buf_count++;
+  }
+  link.bytes += len;
+  link.next_off += len;
+}
+
+uint64_t MsgStore::scanned(int fd) const { return get(fd).scanned; }
+
+FrameState *MsgStore::frame_state(int fd) { return &get(fd).frame; }
+
+void MsgStore::scan(int fd, size_t len, bool done, uint64_t step) {
+  Link &link = get(fd);
+  if (link.scanned + len > link.next_off) {
+    fprintf(stderr, "[MSGSTORE] scanned past what %d holds\n", fd);
+    exit(1);
+  }
+  link.scanned += len;
+  if (done) {
+    flush(fd, step);
+  }
+}
+
+bool MsgStore::flush(int fd, uint64_t step) {
+  Link &link = get(fd);
+  if (link.scanned == link.framed) {
+    return false;
+  }
+  if (link.count == MSGS_PER_LINK) {
+    fprintf(stderr, "[MSGSTORE] no room for another message on %d\n", fd);
+    exit(1);
+  }
+  size_t idx = fd_link[fd] * MSGS_PER_LINK +
+               ((link.head + link.count) & (MSGS_PER_LINK - 1));
+  slab[idx] = HeldMsg{link.framed, (uint32_t)(link.scanned - link.framed),
+                      step};
+  link.count++;
+  link.framed = link.scanned;
+  link.frame = FrameState{0, 0};
+  return true;
+}
+
+const HeldMsg &MsgStore::at(int fd, size_t i) const {
+  const Link &link = get(fd);
+  if (i >= link.count) {
+    fprintf(stderr, "[MSGSTORE] %d only has %lu messages\n", fd, link.count);
+    exit(1);
+  }
+  return slab[fd_link[fd] * MSGS_PER_LINK +
+              ((link.head + i) & (MSGS_PER_LINK - 1))];
+}
+
+void MsgStore::pop(int fd) {
+  Link &link = get(fd);
+  if (link.count == 0) {
+    fprintf(stderr, "[MSGSTORE] nothing held for %d\n", fd);
+    exit(1);
+  }
+  link.bytes -= front(fd).len;
+  link.head = (link.head + 1) & (MSGS_PER_LINK - 1);
+  link.count--;
+}
+
+size_t MsgStore::num_bufs(int fd) const {
+  int idx = link_idx(fd);
+  return idx < 0 ? 0 : links[idx].buf_count;
+}
+
+const HeldBuf &MsgStore::buf_at(int fd, size_t i) const {
+  const Link &link = get(fd);
+  if (i >= link.buf_count) {
+    fprintf(stderr, "[MSGSTORE] %d only has %lu buffers\n", fd,
+            link.buf_count);
+    exit(1);
+  }
+  return buf_slab[fd_link[fd] * MSGS_PER_LINK +
+                  ((link.buf_head + i) & (MSGS_PER_LINK - 1))];
+}
+
+void MsgStore::pop_buf(int fd) {
+  Link &link = get(fd);
+  if (link.buf_count == 0) {
+    fprintf(stderr, "[MSGSTORE] no buffers held for %d\n", fd);
+    exit(1);
+  }
+  link.buf_head = (link.buf_head + 1) & (MSGS_PER_LINK - 1);
+  link.buf_count--;
+}
+
+MsgStore::Link &MsgStore::get(int fd) {
+  int idx = link_idx(fd);
+  if (idx < 0) {
+    fprintf(stderr, "[MSGSTORE] %d isn't open\n", fd);
+    exit(1);
+  }
+  return links[idx];
+}
+
+const MsgStore::Link &MsgStore::get(int fd) const {
+  int idx = link_idx(fd);
+  if (idx < 0) {
+    fprintf(stderr, "[MSGSTORE] %d isn't open\n", fd);
+    exit(1);
+  }
+  return links[idx];
+}
@@ -0,0 +1,253 @@
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <mutex>
+#include <vector>
+
+#include "notif.h"
+
+namespace {
+int _make_sigchld_fd() {
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  // must be blocked to be delivered through the signalfd. waitpid is
+  // unaffected. this only covers the calling thread, so with a thread per
+  // tracee it has to be blocked before the threads are made
+  if (pthread_sigmask(SIG_BLOCK, &mask, nullptr) != 0) {
+    fprintf(stderr, "[NOTIF] failed to block SIGCHLD\n");
+    exit(1);
+  }
+  int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "[NOTIF] signalfd failed: %s\n", strerror(errno));
+    exit(1);
+  }
+  return fd;
+}
+
+// SIGCHLD tells us about ptrace stops while we're also waiting on listeners.
+// created on first use, and shared by every manager in the process
+int _get_sigchld_fd() {
+  static int sigchld_fd = _make_sigchld_fd();
+  return sigchld_fd;
+}
+
+// whichever thread reads a SIGCHLD may not be the one whose tracee stopped,
+// so it wakes every waiting thread through its eventfd to check for itself
+std::mutex wakers_mutex;
+std::vector<int> wakers;
+
+// the calling thread's eventfd, made on first use and kept, like the signalfd,
+// for the life of the process
+int _get_waker_fd() {
+  thread_local int waker_fd = -1;
+  if (waker_fd < 0) {
+    waker_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (waker_fd < 0) {
+      fprintf(stderr, "[NOTIF] eventfd failed: %s\n", strerror(errno));
+      exit(1);
+    }
+    std::lock_guard<std::mutex> lock(wakers_mutex);
+    wakers.push_back(waker_fd);
+  }
+  return waker_fd;
+}
+
+void _wake_all() {
+  std::lock_guard<std::mutex> lock(wakers_mutex);
+  uint64_t one = 1;
+  for (int fd : wakers) {
+    if (write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+      fprintf(stderr, "[NOTIF] waking %d failed: %s\n", fd, strerror(errno));
+      exit(1);
+    }
+  }
+}
+
+} // namespace
+
+namespace Notif {
+
+void install_and_send(struct sock_fprog *prog, int sock) {
+  int listener = syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER,
+                         SECCOMP_FILTER_FLAG_NEW_LISTENER, prog);
+  if (listener < 0) {
+    perror("when setting seccomp filter with listener");
+    exit(1);
+  }
+
+  char dummy = 'l';
+  struct iovec iov = {&dummy, 1};
+  char ctrl[CMSG_SPACE(sizeof(int))];
+  memset(ctrl, 0, sizeof(ctrl));
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctrl;
+  msg.msg_controllen = sizeof(ctrl);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &listener, sizeof(int));
+  if (sendmsg(sock, &msg, 0) < 0) {
+    perror("when sending seccomp listener");
+    exit(1);
+  }
+}
+
+int recv_listener(int sock) {
+  char dummy;
+  struct iovec iov = {&dummy, 1};
+  char ctrl[CMSG_SPACE(sizeof(int))];
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctrl;
+  msg.msg_controllen = sizeof(ctrl);
+  if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) <= 0) {
+    fprintf(stderr, "[NOTIF] failed to receive listener: %s\n",
+            strerror(errno));
+    exit(1);
+  }
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == nullptr || cmsg->cmsg_type != SCM_RIGHTS) {
+    fprintf(stderr, "[NOTIF] no listener fd in message\n");
+    exit(1);
+  }
+  int listener;
+  memcpy(&listener, CMSG_DATA(cmsg), sizeof(int));
+  printf("[NOTIF] received listener fd %d\n", listener);
+  return listener;
+}
+
+bool wait(pid_t pid, int listener, int *status) {
+  int sigfd = _get_sigchld_fd();
+  int wakefd = _get_waker_fd();
+  while (true) {
+    // check for a ptrace stop first, since its SIGCHLD may have been drained
+    // by another thread, which will have woken this one
+    pid_t ret = waitpid(pid, status, WNOHANG);
+    if (ret == pid) {
+      return false;
+    } else if (ret < 0) {
+      fprintf(stderr, "[NOTIF] waitpid failed: %s\n", strerror(errno));
+      exit(1);
+    }
+
+    struct pollfd pfds[3];
+    pfds[0].fd = listener;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = sigfd;
+    pfds[1].events = POLLIN;
+    pfds[2].fd = wakefd;
+    pfds[2].events = POLLIN;
+    if (poll(pfds, 3, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "[NOTIF] poll failed: %s\n", strerror(errno));
+      exit(1);
+    }
+    if (pfds[0].revents & POLLIN) {
+      return true;
+    }
+    if (pfds[1].revents & POLLIN) {
+      // drained before waking the others, so a stop after this raises a new
+      // SIGCHLD instead of being folded into this one
+      struct signalfd_siginfo info;
+      bool got = false;
+      while (read(sigfd, &info, sizeof(info)) > 0) {
+        got = true;
+      }
+      if (got) {
+        _wake_all();
+      }
+    }
+    if (pfds[2].revents & POLLIN) {
+      uint64_t count;
+      while (read(wakefd, &count, sizeof(count)) > 0)
+        ;
+    }
+  }
+}
+
+bool recv(int listener, struct seccomp_notif *req) {
+  // kernel requires the buffer to be zeroed
+  memset(req, 0, sizeof(*req));
+  if (ioctl(listener, SECCOMP_IOCTL_NOTIF_RECV, req) < 0) {
+    printf("[NOTIF] recv failed: %s\n", strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool id_valid(int listener, uint64_t id) {
+  return ioctl(listener, SECCOMP_IOCTL_NOTIF_ID_VALID, &id) == 0;
+}
+
+bool respond(int listener, uint64_t id, int64_t val, int error) {
+  struct seccomp_notif_resp resp;
+  memset(&resp, 0, sizeof(resp));
+  resp.id = id;
+  resp.val = val;
+  resp.error = error == 0 ? 0 : -error;
+  if (ioctl(listener, SECCOMP_IOCTL_NOTIF_SEND, &resp) < 0) {
+    // ENOENT means the target died or was interrupted, which waitpid will
+    // tell us about
+    printf("[NOTIF] respond failed: %s\n", strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool respond_continue(int listener, uint64_t id) {
+  struct seccomp_notif_resp resp;
+  memset(&resp, 0, sizeof(resp));
+  resp.id = id;
+  resp.flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+  if (ioctl(listener, SECCOMP_IOCTL_NOTIF_SEND, &resp) < 0) {
+    printf("[NOTIF] respond_continue failed: %s\n", strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+int addfd(int listener, uint64_t id, int srcfd, uint32_t newfd_flags,
+          bool send, int newfd) {
+  struct seccomp_notif_addfd addfd;
+  memset(&addfd, 0, sizeof(addfd));
+  addfd.id = id;
+  addfd.flags = send ? SECCOMP_ADDFD_FLAG_SEND : 0;
+  addfd.srcfd = srcfd;
+  addfd.newfd_flags = newfd_flags;
+  if (newfd >= 0) {
+    addfd.flags |= SECCOMP_ADDFD_FLAG_SETFD;
+    addfd.newfd = newfd;
+  }
+  int ret = ioctl(listener, SECCOMP_IOCTL_NOTIF_ADDFD, &addfd);
+  if (ret < 0) {
+    int err = errno;
+    printf("[NOTIF] addfd failed: %s\n", strerror(err));
+    errno = err;
+    return -1;
+  }
+  return ret;
+}
+
+} // namespace Notif
@@ -0,0 +1,178 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "persist.h"
+
+namespace {
+// read/write buffer for PM_STREAM
+const size_t STREAM_BUF = 1 << 16;
+
+// errnos meaning the method isn't there (for this kernel or filesystem), as
+// opposed to the copy itself failing
+bool _unsupported(int err) {
+  return err == EOPNOTSUPP || err == ENOTTY || err == ENOSYS ||
+         err == EXDEV || err == EINVAL;
+}
+} // namespace
+
+const char *persist_mode_name(PersistMode mode) {
+  switch (mode) {
+  case PM_REFLINK:
+    return "reflink";
+  case PM_COPY_RANGE:
+    return "copy";
+  case PM_STREAM:
+    return "stream";
+  }
+  return "?";
+}
+
+Persister::Persister(PersistMode mode)
+    : no_reflink(mode > PM_REFLINK),
+      no_copy_range(mode > PM_COPY_RANGE), no_sendfile(mode > PM_COPY_RANGE),
+      clones(0), bytes_copied(0) {}
+
+PersistMode Persister::method() const {
+  if (!no_reflink) {
+    return PM_REFLINK;
+  }
+  return no_copy_range && no_sendfile ? PM_STREAM : PM_COPY_RANGE;
+}
+
+bool Persister::copy_file(const std::string &src, const std::string &dst) {
+  int dst_fd =
+      open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (dst_fd < 0) {
+    printf("[PERSIST] couldn't open %s: %s\n", dst.c_str(), strerror(errno));
+    return false;
+  }
+  int src_fd = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+  if (src_fd < 0) {
+    if (errno != ENOENT) {
+      fprintf(stderr, "[PERSIST] couldn't open %s: %s\n", src.c_str(),
+              strerror(errno));
+      exit(1);
+    }
+    close(dst_fd);
+    return true;
+  }
+  struct stat s;
+  if (fstat(src_fd, &s) < 0) {
+    fprintf(stderr, "[PERSIST] fstat of %s failed: %s\n", src.c_str(),
+            strerror(errno));
+    exit(1);
+  }
+  if (!_reflink(src_fd, dst_fd)) {
+    _copy(src_fd, dst_fd, 0, s.st_size);
+  }
+  close(src_fd);
+  close(dst_fd);
+  return true;
+}
+
+bool Persister::copy_extents(const std::string &src, const std::string &dst,
+                             const ExtentSet &extents) {
+  int src_fd = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+  if (src_fd < 0) {
+    return false;
+  }
+  int dst_fd = open(dst.c_str(), O_WRONLY | O_CLOEXEC);
+  if (dst_fd < 0) {
+    close(src_fd);
+    return false;
+  }
+  struct stat s;
+  if (fstat(src_fd, &s) < 0 || ftruncate(dst_fd, s.st_size) < 0) {
+    fprintf(stderr, "[PERSIST] sizing %s like %s failed: %s\n", dst.c_str(),
+            src.c_str(), strerror(errno));
+    exit(1);
+  }
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  extents.clipped(s.st_size, &ranges);
+  for (const auto &range : ranges) {
+    _copy(src_fd, dst_fd, range.first, range.second);
+  }
+  close(src_fd);
+  close(dst_fd);
+  return true;
+}
+
+bool Persister::_reflink(int src_fd, int dst_fd) {
+  if (no_reflink) {
+    return false;
+  }
+  if (ioctl(dst_fd, FICLONE, src_fd) == 0) {
+    clones++;
+    return true;
+  }
+  if (!_unsupported(errno)) {
+    fprintf(stderr, "[PERSIST] FICLONE failed: %s\n", strerror(errno));
+    exit(1);
+  }
+  printf("[PERSIST] no reflinks here (%s), copying instead\n",
+         strerror(errno));
+  no_reflink = true;
+  return false;
+}
+
+void Persister::_copy(int src_fd, int dst_fd, off_t off, size_t len) {
+  char buf[STREAM_BUF];
+  while (len > 0) {
+    ssize_t n;
+    if (!no_copy_range) {
+      loff_t in_off = off;
+      loff_t out_off = off;
+      n = copy_file_range(src_fd, &in_off, dst_fd, &out_off, len, 0);
+      if (n < 0 && _unsupported(errno)) {
+        printf("[PERSIST] no copy_file_range here (%s)\n", strerror(errno));
+        no_copy_range = true;
+        continue;
+      }
+    } else if (!no_sendfile) {
+      off_t in_off = off;
+      if (lseek(dst_fd, off, SEEK_SET) < 0) {
+        fprintf(stderr, "[PERSIST] lseek failed: %s\n", strerror(errno));
+        exit(1);
+      }
+      n = sendfile(dst_fd, src_fd, &in_off, len);
+      if (n < 0 && _unsupported(errno)) {
+        printf("[PERSIST] no sendfile here (%s)\n", strerror(errno));
+        no_sendfile = true;
+        continue;
+      }
+    } else {
+      n = pread(src_fd, buf, len < STREAM_BUF ? len : STREAM_BUF, off);
+      if (n > 0) {
+        for (ssize_t done = 0; done < n;) {
+          ssize_t written = pwrite(dst_fd, buf + done, n - done, off + done);
+          if (written < 0) {
+            fprintf(stderr, "[PERSIST] write failed: %s\n", strerror(errno));
+            exit(1);
+          }
+          done += written;
+        }
+      }
+    }
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "[PERSIST] copy failed: %s\n", strerror(errno));
+      exit(1);
+    } else if (n == 0) {
+      // src got shorter since it was sized
+      break;
+    }
+    off += n;
+    len -= n;
+    bytes_copied += n;
+  }
+}
@@ -1,24 +1,67 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <linux/sockios.h>
 #include <netinet/ip.h>
+#include <poll.h>
 #include <stdint.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <syscall.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <chrono>
 #include <deque>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
 #include "client.h"
 #include "fdmap.h"
+#include "framing.h"
 #include "proxy.h"
+#include "transport.h"
 
 namespace {
+// how long wait_delivered gives a destination to ack before moving on. over
+// loopback the ack comes back before send returns, so this only matters if
+// the destination's receive buffer is full
+const auto ACK_TIMEOUT = std::chrono::milliseconds(200);
+// most a single splice moves into a link's pipe
+const size_t MAX_SPLICE = 1 << 20;
+// most read at once from a connection whose bytes have nowhere to go
+const size_t MAX_DISCARD = 2000;
+
+// PE_URING sizes. every held message pins a buffer, so once all of them are
+// held, anything else sent stays in the sending socket until one is released
+const unsigned URING_ENTRIES = 256;
+const unsigned URING_BUFS = 128;
+const size_t URING_BUF_SIZE = 16 << 10;
+const uint16_t URING_BUF_GROUP = 0;
+
+// what a completion was for, packed into its user_data along with the fd, the
+// fd's generation, and (for sends) the buffer
+enum UringOp : uint8_t {
+  OP_ACCEPT,
+  OP_RECV,
+  OP_SEND,
+  OP_CANCEL,
+  OP_CONNECT,
+};
+
+uint64_t _tag(UringOp op, int fd, uint16_t gen, uint16_t buf = 0) {
+  return (uint64_t)op << 56 | (uint64_t)gen << 40 | (uint64_t)buf << 24 |
+         (uint32_t)fd;
+}
+
+UringOp _tag_op(uint64_t tag) { return (UringOp)(tag >> 56); }
+uint16_t _tag_gen(uint64_t tag) { return tag >> 40; }
+uint16_t _tag_buf(uint64_t tag) { return tag >> 24; }
+int _tag_fd(uint64_t tag) { return tag & 0xffffff; }
+
 void _set_nonblocking(int fd) {
   int flags = fcntl(fd, F_GETFL, 0);
   if (flags < 0) {
@@ -53,24 +96,40 @@ void _set_reuseaddr(int fd) {
 } // namespace
 
 Proxy::Proxy(FdMap &fdmap, std::vector<sockaddr_in> actual_node_map,
-             std::vector<sockaddr_in> proxy_node_map, size_t num_clients)
-    : actual_node_map(actual_node_map), proxy_node_map(proxy_node_map),
-      fdmap(fdmap) {
+             std::vector<sockaddr_in> proxy_node_map, size_t num_clients,
+             ProxyEngine engine, FrameKind frame_kind, Transport transport)
+    : engine(engine), transport(transport), efd(-1),
+      actual_node_map(actual_node_map),
+      proxy_node_map(proxy_node_map), fdmap(fdmap),
+      conns(actual_node_map.size(), num_clients), step(0),
+      framing(make_framing(frame_kind)), too_big(false), num_sending(0) {
   printf("[PROXY] initialize\n");
 
   sockfds.reserve(actual_node_map.size());
 
-  efd = epoll_create1(EPOLL_CLOEXEC);
+  if (engine == PE_URING) {
+    ring.reset(new Uring(URING_ENTRIES));
+    ring->setup_bufs(URING_BUF_GROUP, URING_BUFS, URING_BUF_SIZE);
+    buf_refs.resize(URING_BUFS, 0);
+  } else {
+    efd = epoll_create1(EPOLL_CLOEXEC);
+    if (framing->needs_bytes()) {
+      peek_buf.resize(MAX_SPLICE);
+    }
+  }
 
+  node_connect_addrs.resize(actual_node_map.size());
+  for (size_t i = 0; i < actual_node_map.size(); i++) {
+    node_connect_lens.push_back(transport_addr(
+        transport, UR_NODE, actual_node_map[i], &node_connect_addrs[i]));
+  }
   for (size_t i = 0; i < actual_node_map.size(); i++) {
     int sockfd = create_listen(i);
     sockfds.push_back(sockfd);
 
     node_alive[i] = false;
-    inbound_fds[i] = std::set<int>();
   }
   for (size_t i = 0; i < num_clients; i++) {
-    inbound_fds[ClientFilter::CLIENT_OFFS + i] = std::set<int>();
     node_alive[ClientFilter::CLIENT_OFFS + i] = false;
   }
 }
@@ -88,31 +147,26 @@ std::vector<std::pair<int, int>> Proxy::toggle_node(int idx) {
 }
 
 int Proxy::create_listen(int idx) {
-  int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
-  if (sockfd < 0) {
-    fprintf(stderr, "[PROXY] socket failed: %s\n", strerror(errno));
-    exit(1);
-  }
+  int sockfd = transport_socket(transport, SOCK_CLOEXEC);
   printf("[PROXY] creating listening sockfd: %d\n", sockfd);
   _set_nonblocking(sockfd);
   _set_reuseaddr(sockfd);
-  if (bind(sockfd, (const sockaddr *)&proxy_node_map[idx],
-           sizeof(sockaddr_in)) < 0) {
-    fprintf(stderr, "[PROXY] bind failed: %s\n", strerror(errno));
-    exit(1);
-  }
+  transport_bind(transport, sockfd, UR_PROXY, proxy_node_map[idx]);
   if (listen(sockfd, 100) < 0) {
     fprintf(stderr, "[PROXY] listen failed: %s\n", strerror(errno));
     exit(1);
   }
 
-  register_fd(sockfd);
+  register_fd(sockfd, CR_LISTENER, idx);
   return sockfd;
 }
 
 std::vector<std::pair<int, int>> Proxy::stop_node(int idx) {
-  std::unordered_set<int> tmpfds(inbound_fds[idx].begin(),
-                                 inbound_fds[idx].end());
+  // unregistering takes them out of the list
+  std::vector<int> tmpfds;
+  for (int fd = conns.first(idx); fd >= 0; fd = conns.next(fd)) {
+    tmpfds.push_back(fd);
+  }
   std::vector<std::pair<int, int>> related_nodes;
   for (int fd : tmpfds) {
     fdmap.proxy_clear_connecting(fd);
@@ -122,63 +176,273 @@ std::vector<std::pair<int, int>> Proxy::stop_node(int idx) {
   return related_nodes;
 }
 
-std::vector<int> Proxy::get_fds_with_msgs(int idx) {
-  std::vector<int> to_ret;
-  for (int fd : inbound_fds[idx]) {
-    if (waiting_msgs[fd].size() > 0) {
-      to_ret.push_back(fd);
+void Proxy::get_fds_with_msgs(int idx, std::vector<int> *fds) {
+  fds->clear();
+  for (int fd = conns.first(idx); fd >= 0; fd = conns.next(fd)) {
+    if (held_msgs.count(fd) > 0) {
+      fds->push_back(fd);
     }
   }
-  return to_ret;
 }
 
-bool Proxy::has_more(int fd) {
-  auto got = waiting_msgs.find(fd);
-  if (got == waiting_msgs.end()) {
-    return false;
-  } else {
-    return !got->second.empty();
+bool Proxy::has_more(int fd) { return held_msgs.count(fd) > 0; }
+
+size_t Proxy::num_msgs(int fd) { return held_msgs.count(fd); }
+
+void Proxy::close_queue(int fd) {
+  if (!held_msgs.is_open(fd)) {
+    return;
+  }
+  if (engine == PE_URING) {
+    for (size_t i = 0; i < held_msgs.num_bufs(fd); i++) {
+      recycle_buf(held_msgs.buf_at(fd, i).buf);
+    }
+  }
+  held_msgs.close(fd);
+}
+
+ssize_t Proxy::hold_msg(int conn_fd, int to_fd) {
+  if (held_msgs.full(to_fd)) {
+    if (held_msgs.count(to_fd) > 0) {
+      errno = EAGAIN;
+      return -1;
+    }
+    // the pipe is all one message, so nothing can be released to make room
+    if (!held_msgs.grow(to_fd)) {
+      fprintf(stderr,
+              "[PROXY] message for %d is bigger than the %lu bytes a link "
+              "can hold\n",
+              to_fd, held_msgs.byte_limit(to_fd));
+      too_big = true;
+      errno = EMSGSIZE;
+      return -1;
+    }
+    printf("[PROXY] grew the pipe for %d to %lu bytes\n", to_fd,
+           held_msgs.byte_limit(to_fd));
+  }
+  size_t max_bytes = MAX_SPLICE;
+  if (!peek_buf.empty()) {
+    // the bytes have to be seen to be framed, but once spliced they're out of
+    // reach. so frame a copy first, on the side, to find how much of it fits
+    ssize_t n_peeked = recv(conn_fd, peek_buf.data(), peek_buf.size(),
+                            MSG_PEEK | MSG_DONTWAIT);
+    if (n_peeked <= 0) {
+      return n_peeked;
+    }
+    FrameState state = *held_msgs.frame_state(to_fd);
+    size_t room = held_msgs.room(to_fd);
+    max_bytes = 0;
+    while (max_bytes < (size_t)n_peeked && room > 0) {
+      bool done;
+      max_bytes += framing->scan(&state, peek_buf.data() + max_bytes,
+                                 n_peeked - max_bytes, &done);
+      if (done) {
+        room--;
+      }
+    }
+  }
+  ssize_t n_bytes =
+      splice(conn_fd, nullptr, held_msgs.pipe_in(to_fd), nullptr, max_bytes,
+             SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (n_bytes > 0) {
+    held_msgs.add(to_fd, n_bytes, -1);
+    frame(to_fd, peek_buf.data(), n_bytes);
+  }
+  return n_bytes;
+}
+
+size_t Proxy::frame(int fd, const char *data, size_t len) {
+  size_t pos = 0;
+  while (pos < len && held_msgs.room(fd) > 0) {
+    bool done;
+    size_t n = framing->scan(held_msgs.frame_state(fd), data + pos, len - pos,
+                             &done);
+    held_msgs.scan(fd, n, done, step);
+    pos += n;
+  }
+  return pos;
+}
+
+void Proxy::frame_bufs(int fd) {
+  uint64_t pos = held_msgs.scanned(fd);
+  for (size_t i = 0; i < held_msgs.num_bufs(fd) && held_msgs.room(fd) > 0;
+       i++) {
+    const HeldBuf &held = held_msgs.buf_at(fd, i);
+    if (held.off + held.len <= pos) {
+      continue;
+    }
+    size_t from = pos - held.off;
+    pos += frame(fd, ring->buf(held.buf) + from, held.len - from);
   }
 }
 
 bool Proxy::allow_next_msg(int fd) {
   printf("[PROXY] sending next message for fd: %d\n", fd);
-  auto got = waiting_msgs.find(fd);
   if (fdmap.is_linked(fd)) {
-    if (got == waiting_msgs.end()) {
-      fprintf(stderr, "[PROXY] could not find fd %d in waiting_msgs\n", fd);
+    if (held_msgs.count(fd) == 0) {
+      fprintf(stderr, "[PROXY] no messages held for fd %d\n", fd);
       exit(1);
     } else {
-      std::vector<char> mesg = got->second.front();
-      got->second.pop_front();
-      size_t msg_len = mesg.size();
-      // TODO - think about partial sends
-      ssize_t ret = sendto(got->first, &mesg[0], msg_len, 0, nullptr, 0);
-      if (ret < 0) {
-        fprintf(stderr, "[PROXY] send to %d through %d failed due to: %s\n",
-                fd_to_node.at(fd), fd, strerror(errno));
-        exit(1);
-      } else if ((size_t)ret < msg_len) {
-        fprintf(stderr,
-                "[PROXY] couldn't send everything at once (%ld vs. %lu)\n", ret,
-                msg_len);
-        exit(1);
+      HeldMsg msg = held_msgs.front(fd);
+      held_msgs.pop(fd);
+      if (engine == PE_URING) {
+        // goes out with everything else released before the next wait, as a
+        // send for each buffer it's (partly) in
+        bool idle = sending.count(fd) == 0;
+        uint64_t pos = msg.off, end = msg.off + msg.len;
+        while (pos < end) {
+          HeldBuf held = held_msgs.buf_at(fd, 0);
+          size_t from = pos - held.off;
+          size_t to = std::min(end - held.off, (uint64_t)held.len);
+          buf_refs[held.buf]++;
+          sending[fd].push_back({held.buf, from, to});
+          num_sending++;
+          pos = held.off + to;
+          if (to == held.len) {
+            held_msgs.pop_buf(fd);
+            recycle_buf(held.buf);
+          }
+        }
+        if (idle) {
+          uring_send(fd);
+        }
+        // there's room for another message now, if framing had to stop
+        frame_bufs(fd);
+        if (conns.peer(fd) < 0) {
+          // the sender closed while fd was full, so its tail couldn't be
+          // flushed then
+          flush_partial(fd);
+        }
+      } else {
+        epoll_send(fd, msg.len);
+        // there's room for another message now, and what didn't fit may be
+        // all that's left of a closed connection, which epoll won't report
+        // again
+        int from_fd = conns.peer(fd);
+        while (from_fd >= 0 && conns.is_open(from_fd) && epoll_recv(from_fd))
+          ;
       }
-      if (got->second.empty() && related_fd[fd] < 0) {
+      if (held_msgs.count(fd) == 0 && conns.peer(fd) < 0) {
         // if the client has closed, then we should close the connection with
-        // the node
+        // the node. the fd is gone after this, so make sure the node has
+        // everything first
+        if (engine == PE_URING) {
+          uring_wait_sent(fd);
+        } else if (unsent.count(fd) > 0) {
+          // the node may be stopped, so it can't be waited on here.
+          // epoll_poll closes fd once the rest has gone out
+          return true;
+        }
+        if (transport == TR_TCP) {
+          // as in wait_delivered, a unix send has already arrived
+          wait_acked(fd);
+        }
         unregister_fd(fd);
         return true;
       }
+      unacked_fds.insert(fd);
     }
   }
   return false;
 }
 
-void Proxy::register_fd(int fd) {
+void Proxy::epoll_send(int fd, size_t len) {
+  // the pipe is in stream order, so new bytes go out behind the unsent ones
+  auto got = unsent.find(fd);
+  bool watching = got != unsent.end();
+  size_t left = len + (watching ? got->second : 0);
+  while (left > 0) {
+    ssize_t ret = splice(held_msgs.pipe_out(fd), nullptr, fd, nullptr, left,
+                         SPLICE_F_MOVE);
+    if (ret < 0 && errno == EAGAIN) {
+      break;
+    } else if (ret <= 0) {
+      fprintf(stderr, "[PROXY] send to %d through %d failed due to: %s\n",
+              conns.node(fd), fd, strerror(errno));
+      exit(1);
+    }
+    left -= ret;
+  }
+  if (left > 0) {
+    // the node isn't reading yet. the rest stays in the pipe until it does
+    printf("[PROXY] %d is full, %lu bytes left to send\n", fd, left);
+    unsent[fd] = left;
+  } else if (watching) {
+    unsent.erase(got);
+  }
+  if ((left > 0) != watching) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    if (left > 0) {
+      ev.events |= EPOLLOUT;
+    }
+    ev.data.u32 = fd;
+    if (epoll_ctl(efd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+      fprintf(stderr, "[PROXY] epoll_ctl_mod failed: %s\n", strerror(errno));
+      exit(1);
+    }
+  }
+}
+
+void Proxy::wait_delivered() {
+  if (engine == PE_URING) {
+    uring_wait_sent(-1);
+    // buffers freed by the sends rearm any starved recv, and nothing else
+    // may poll before the next release. take in what's arrived, as epoll
+    // does in allow_next_msg
+    uring_poll(false);
+  } else if (!unsent.empty()) {
+    // a node can only take the rest of a send while it runs, so don't wait
+    // for it. push out whatever fits now
+    epoll_poll(false);
+  }
+  // a unix send is in the destination's receive queue as soon as it returns
+  // (and SIOCOUTQ counts what the destination hasn't read yet)
+  if (transport == TR_TCP) {
+    for (int fd : unacked_fds) {
+      wait_acked(fd);
+    }
+  }
+  unacked_fds.clear();
+}
+
+bool Proxy::wait_acked(int fd) {
+  auto start = std::chrono::steady_clock::now();
+  int unacked;
+  while (true) {
+    // SIOCOUTQ counts bytes sent but not yet acked by the peer
+    if (ioctl(fd, SIOCOUTQ, &unacked) < 0) {
+      fprintf(stderr, "[PROXY] SIOCOUTQ on %d failed: %s\n", fd,
+              strerror(errno));
+      return false;
+    }
+    if (unacked == 0) {
+      return true;
+    }
+    if (std::chrono::steady_clock::now() - start > ACK_TIMEOUT) {
+      printf("[PROXY] %d still has %d unacked bytes, moving on\n", fd,
+             unacked);
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+}
+
+void Proxy::register_fd(int fd, ConnRole role, int node, Status status) {
   printf("[PROXY] registering %d\n", fd);
+  conns.add(fd, role, node);
+  conns.set_status(fd, status);
+  if (engine == PE_URING) {
+    if (status == CONNECTED) {
+      uring_arm(fd, role == CR_LISTENER);
+    }
+    return;
+  }
   struct epoll_event ev;
   ev.events = EPOLLIN | EPOLLRDHUP;
+  if (status == CONNECTING) {
+    ev.events |= EPOLLOUT;
+  }
   ev.data.u32 = fd;
   if (epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev) < 0) {
     fprintf(stderr, "[PROXY] epoll_ctl_add failed: %s\n", strerror(errno));
@@ -188,33 +452,56 @@ void Proxy::register_fd(int fd) {
 
 void Proxy::link_fds(int fd1, int fd2) {
   printf("[PROXY] linking %d and %d\n", fd1, fd2);
-  related_fd[fd1] = fd2;
-  related_fd[fd2] = fd1;
+  conns.set_peer(fd1, fd2);
+  conns.set_peer(fd2, fd1);
 }
 
 void Proxy::unregister_fd(int fd,
                           std::vector<std::pair<int, int>> *related_nodes) {
   printf("[PROXY] unregistering %d\n", fd);
   fdmap.unregister_proxyfd(fd);
-  epoll_ctl(efd, EPOLL_CTL_DEL, fd, nullptr);
-  close(fd);
-  auto it = fd_to_node.find(fd);
-  if (it != fd_to_node.end()) {
-    int idx = it->second;
-    if (inbound_fds[idx].find(fd) != inbound_fds[idx].end()) {
-      inbound_fds[idx].erase(fd);
+  bool was_open = conns.is_open(fd);
+  int other_fd = conns.peer(fd);
+  if (engine == PE_URING) {
+    // the ring holds its own reference to the socket, so closing fd alone
+    // wouldn't stop its recv (or close the connection). the cancel looks fd
+    // up, so it has to go in before the close
+    if (was_open) {
+      struct io_uring_sqe *sqe = ring->get_sqe();
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->fd = fd;
+      sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+      sqe->user_data = _tag(OP_CANCEL, fd, conns.gen(fd));
+      ring->submit(false);
+    }
+    // the front one is still in flight, and gets its buffer back when it
+    // completes
+    auto got = sending.find(fd);
+    if (got != sending.end()) {
+      for (size_t i = 1; i < got->second.size(); i++) {
+        recycle_buf(got->second[i].buf);
+      }
+      num_sending -= got->second.size() - 1;
+      sending.erase(got);
     }
-    fd_to_node.erase(fd);
+    starved_fds.erase(fd);
+  } else {
+    epoll_ctl(efd, EPOLL_CTL_DEL, fd, nullptr);
+    unsent.erase(fd);
   }
-  waiting_msgs.erase(fd);
+  close(fd);
+  unacked_fds.erase(fd);
+  // also bumps fd's generation, so its stale completions are dropped
+  conns.remove(fd);
+  close_queue(fd);
   // unlink related fds
-  if (related_fd.find(fd) != related_fd.end()) {
-    printf("[PROXY] relatedfd[%d]=%d\n", fd, related_fd[fd]);
-    if (related_fd[fd] >= 0) {
-      int other_fd = related_fd[fd];
-      related_fd[other_fd] = -1;
+  if (was_open) {
+    printf("[PROXY] relatedfd[%d]=%d\n", fd, other_fd);
+    if (other_fd >= 0) {
+      conns.set_peer(other_fd, -1);
 
-      if (waiting_msgs[other_fd].empty()) {
+      // with unsent bytes, it's closed once they're out (see epoll_poll)
+      if (held_msgs.count(other_fd) == 0 && unsent.count(other_fd) == 0) {
         if (related_nodes != nullptr) {
           if (fdmap.is_linked(other_fd)) {
             auto tup = fdmap.get_related_nodefd(other_fd);
@@ -226,151 +513,222 @@ void Proxy::unregister_fd(int fd,
         unregister_fd(other_fd);
       }
     }
-    related_fd.erase(fd);
+  }
+}
+
+bool Proxy::accept_conn(int my_idx, int fromfd, sockaddr_in addr) {
+  int idx = fdmap.proxy_accept_fd(fromfd, addr);
+  if (idx < 0) {
+    // set up once the node is seen connecting
+    unclaimed.push_back({fromfd, my_idx, addr});
+    return false;
+  }
+  return open_conn(my_idx, fromfd, idx);
+}
+
+bool Proxy::claim_unclaimed() {
+  bool claimed = false;
+  auto it = unclaimed.begin();
+  while (it != unclaimed.end()) {
+    int idx = fdmap.proxy_accept_fd(it->fd, it->addr);
+    if (idx < 0) {
+      it++;
+      continue;
+    }
+    Unclaimed conn = *it;
+    it = unclaimed.erase(it);
+    if (open_conn(conn.listener, conn.fd, idx)) {
+      claimed = true;
+    }
+  }
+  return claimed;
+}
+
+bool Proxy::open_conn(int my_idx, int fromfd, int idx) {
+  int peerfd;
+  bool found;
+  sockaddr_in my_addr;
+  {
+    // register new node if peer
+    if (!node_alive[my_idx] || sockfds[my_idx] == -1) {
+      // fromfd is linked to the node's fd already, so this kills that too
+      unregister_fd(fromfd);
+      return false;
+    }
+
+    found = idx < ClientFilter::CLIENT_OFFS;
+    _set_nonblocking(fromfd);
+    _set_reuseaddr(fromfd);
+    register_fd(fromfd, CR_INBOUND, idx);
+    held_msgs.open(fromfd, engine == PE_EPOLL);
+  }
+
+  {
+    // create connection with node as proxy
+    peerfd = transport_socket(transport, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+    if (found) {
+      my_addr = proxy_node_map[idx];
+      my_addr.sin_port = htons(0);
+      printf("[PROXY] binding to proxy_node_map[%d]: %s:%d\n", idx,
+             inet_ntoa(my_addr.sin_addr), ntohs(my_addr.sin_port));
+    } else {
+      my_addr.sin_family = AF_INET;
+      my_addr.sin_port = htons(0);
+      if (inet_aton("127.0.0.1", &(my_addr.sin_addr)) <= 0) {
+        fprintf(stderr, "[PROXY] localhost inet_aton failed: %s\n",
+                strerror(errno));
+        exit(1);
+      }
+    }
+    transport_bind(transport, peerfd, UR_PEER, my_addr);
+    _set_reuseaddr(peerfd);
+    register_fd(peerfd, CR_OUTBOUND, my_idx, CONNECTING);
+    held_msgs.open(peerfd, engine == PE_EPOLL);
+  }
+
+  link_fds(peerfd, fromfd);
+
+  // bind picked the port, so the node can be told who to expect before the
+  // connect has even started
+  sockaddr_storage bound;
+  socklen_t addrlen = sizeof(bound);
+  getsockname(peerfd, (sockaddr *)&bound, &addrlen);
+  fdmap.proxy_connect_fd(my_idx, peerfd, as_inet(bound, addrlen));
+  start_connect(peerfd, my_idx);
+  return true;
+}
+
+void Proxy::start_connect(int fd, int node) {
+  const sockaddr_storage &addr = node_connect_addrs[node];
+  socklen_t addrlen = node_connect_lens[node];
+  if (engine == PE_URING) {
+    // addr lives in node_connect_addrs, so it's still there when this is
+    // submitted
+    struct io_uring_sqe *sqe = ring->get_sqe();
+    sqe->opcode = IORING_OP_CONNECT;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)&addr;
+    sqe->off = addrlen;
+    sqe->user_data = _tag(OP_CONNECT, fd, conns.gen(fd));
+    return;
+  }
+  if (connect(fd, (const sockaddr *)&addr, addrlen) == 0) {
+    finish_connect(fd, 0);
+  } else if (errno != EINPROGRESS) {
+    finish_connect(fd, errno);
+  }
+  // otherwise EPOLLOUT says when it's done
+}
+
+void Proxy::finish_connect(int fd, int err) {
+  if (err != 0) {
+    int node = conns.node(fd);
+    fprintf(stderr, "[PROXY] connect to %s failed: %s\n",
+            inet_ntoa(actual_node_map[node].sin_addr), strerror(err));
+    // takes the accepted side (and so the node's fd) with it
+    fdmap.proxy_clear_connecting(fd);
+    unregister_fd(fd);
+    return;
+  }
+  printf("[PROXY] %d connected\n", fd);
+  conns.set_status(fd, CONNECTED);
+  if (engine == PE_URING) {
+    uring_arm(fd, false);
+    return;
+  }
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLRDHUP;
+  ev.data.u32 = fd;
+  if (epoll_ctl(efd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+    fprintf(stderr, "[PROXY] epoll_ctl_mod failed: %s\n", strerror(errno));
+    exit(1);
   }
 }
 
 bool Proxy::poll_for_events(bool blocking) {
+  if (engine == PE_URING) {
+    return uring_poll(blocking);
+  }
+  return epoll_poll(blocking);
+}
+
+bool Proxy::epoll_poll(bool blocking) {
   const size_t NUM_EVENTS = 100;
-  const size_t MAX_BUF = 2000;
   struct epoll_event evs[NUM_EVENTS];
   bool something_occurred = false;
 
+  int num_events, num_connected, num_sent;
+
   fflush(stdout); // make sure we have most up-to-date log if this blocks
   do {
-    int num_events =
-        epoll_wait(efd, (epoll_event *)&evs, NUM_EVENTS, blocking ? -1 : 0);
+    if (claim_unclaimed()) {
+      something_occurred = true;
+    }
+    // a node that has connected is sure to show up at its listener
+    bool wait = (blocking && !something_occurred) || fdmap.has_unaccepted();
+    num_events =
+        epoll_wait(efd, (epoll_event *)&evs, NUM_EVENTS, wait ? -1 : 0);
+    num_connected = 0;
+    num_sent = 0;
     printf("[PROXY] found %d events\n", num_events);
     for (int i = 0; i < num_events; i++) {
+      int ev_fd = (int)evs[i].data.u32;
+      if (conns.status(ev_fd) == CONNECTING &&
+          (evs[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+        int err = 0;
+        socklen_t len = sizeof(int);
+        if (getsockopt(ev_fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+          err = errno;
+        }
+        finish_connect(ev_fd, err);
+        num_connected++;
+      } else if ((evs[i].events & EPOLLOUT) && unsent.count(ev_fd) > 0) {
+        epoll_send(ev_fd, 0);
+        if (evs[i].events == EPOLLOUT) {
+          num_sent++;
+        }
+        if (unsent.count(ev_fd) == 0 && held_msgs.count(ev_fd) == 0 &&
+            conns.peer(ev_fd) < 0) {
+          // its sender has closed, and this was the last of what it sent
+          if (transport == TR_TCP) {
+            wait_acked(ev_fd);
+          }
+          unregister_fd(ev_fd);
+          continue;
+        }
+      }
       if (evs[i].events & EPOLLIN) {
         printf("[PROXY] input event\n");
-        const auto &it =
-            std::find(sockfds.begin(), sockfds.end(), (int)evs[i].data.u32);
-        if (it != sockfds.end()) {
+        if (conns.role(ev_fd) == CR_LISTENER) {
           printf("[PROXY] new node connection\n");
-          int my_idx = std::distance(sockfds.begin(), it);
-          int sockfd = *it;
-          int idx = 0, fromfd, peerfd;
-          bool found;
-          sockaddr_in my_addr;
-          {
-            // can accept new connection
-            sockaddr_in new_conn;
-            socklen_t len = sizeof(sockaddr_in);
-            fromfd = accept4(sockfd, (struct sockaddr *)&new_conn, &len,
-                             SOCK_CLOEXEC);
-            if (fromfd < 0) {
-              fprintf(stderr, "[PROXY] accept failed: %s\n", strerror(errno));
-              exit(1);
-            }
-            // register new node if peer
-            printf("[PROXY] accepted connection for %d from: %s:%d\n", my_idx,
-                   inet_ntoa(new_conn.sin_addr), ntohs(new_conn.sin_port));
-
-            if (!node_alive[my_idx] || *it == -1) {
-              unregister_fd(fromfd);
-              fdmap.trash_last_node();
-              continue;
-            }
-
-            idx = fdmap.get_last_node();
-            if (idx == -1) {
-              fprintf(stderr, "[PROXY] idx of last node invalid\n");
-              exit(1);
-            }
-            found = idx < ClientFilter::CLIENT_OFFS;
-            fd_to_node[fromfd] = idx;
-            inbound_fds[idx].insert(fromfd);
-            _set_nonblocking(fromfd);
-            _set_reuseaddr(fromfd);
-            register_fd(fromfd);
-            waiting_msgs[fromfd] = std::deque<std::vector<char>>();
+          int my_idx = conns.node(ev_fd);
+          // can accept new connection
+          sockaddr_storage from;
+          socklen_t len = sizeof(from);
+          int fromfd =
+              accept4(ev_fd, (struct sockaddr *)&from, &len, SOCK_CLOEXEC);
+          if (fromfd < 0) {
+            fprintf(stderr, "[PROXY] accept failed: %s\n", strerror(errno));
+            exit(1);
           }
-
-          {
-            // create connection with node as proxy
-            peerfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
-
-            if (found) {
-              my_addr = proxy_node_map[idx];
-              my_addr.sin_port = htons(0);
-              printf("[PROXY] binding to proxy_node_map[%d]: %s:%d\n", idx,
-                     inet_ntoa(my_addr.sin_addr), ntohs(my_addr.sin_port));
-              if (bind(peerfd, (const sockaddr *)&my_addr,
-                       sizeof(sockaddr_in)) < 0) {
-                fprintf(stderr, "[PROXY] bind failed: %s\n", strerror(errno));
-                exit(1);
-              }
-            } else {
-              my_addr.sin_family = AF_INET;
-              my_addr.sin_port = htons(0);
-              if (inet_aton("127.0.0.1", &(my_addr.sin_addr)) <= 0) {
-                fprintf(stderr, "[PROXY] localhost inet_aton failed: %s\n",
-                        strerror(errno));
-                exit(1);
-              }
-              if (bind(peerfd, (const sockaddr *)&my_addr,
-                       sizeof(sockaddr_in)) < 0) {
-                fprintf(stderr, "[PROXY] bind failed: %s\n", strerror(errno));
-                exit(1);
-              }
-            }
-            if (connect(peerfd, (const sockaddr *)&actual_node_map[my_idx],
-                        sizeof(sockaddr_in)) < 0) {
-              fprintf(stderr, "[PROXY] connect to %s failed: %s\n",
-                      inet_ntoa(actual_node_map[my_idx].sin_addr),
-                      strerror(errno));
-              unregister_fd(fromfd);
-              fdmap.trash_last_node();
-              continue;
-            }
-            _set_nonblocking(peerfd);
-            _set_reuseaddr(peerfd);
-            register_fd(peerfd);
-            waiting_msgs[peerfd] = std::deque<std::vector<char>>();
-            fd_to_node[peerfd] = my_idx;
-            inbound_fds[my_idx].insert(peerfd);
+          sockaddr_in new_conn = as_inet(from, len);
+          printf("[PROXY] accepted connection for %d from: %s:%d\n", my_idx,
+                 inet_ntoa(new_conn.sin_addr), ntohs(new_conn.sin_port));
+          if (!accept_conn(my_idx, fromfd, new_conn)) {
+            continue;
           }
-
-          link_fds(peerfd, fromfd);
-
-          socklen_t addrlen = sizeof(sockaddr_in);
-          getsockname(peerfd, (sockaddr *)&my_addr, &addrlen);
-          fdmap.proxy_accept_fd(fromfd);
-          fdmap.proxy_connect_fd(my_idx, peerfd, my_addr);
-
           something_occurred = true;
         } else {
           printf("[PROXY] receiving message\n");
           int conn_fd = (int)evs[i].data.u32;
-          if (related_fd.find(conn_fd) == related_fd.end()) {
+          if (!conns.is_open(conn_fd)) {
             // unregistered already, so just ignore it
             printf("[PROXY] message received from unregistered fd\n");
             continue;
           }
-          char buf[MAX_BUF];
-          ssize_t n_bytes =
-              recvfrom(conn_fd, &buf, MAX_BUF - 1, 0, nullptr, nullptr);
-          if (n_bytes < 0) {
-            fprintf(stderr, "[PROXY] recv failed: %s\n", strerror(errno));
-            unregister_fd(conn_fd);
-          } else if (n_bytes == 0) {
-            printf("[PROXY] nothing read, closing %d\n", conn_fd);
-            // assume later than Linux 2.6.9
-            unregister_fd(conn_fd);
-          } else {
-            buf[n_bytes] = 0;
-            std::vector<char> mesg(buf, buf + n_bytes);
-            printf("[PROXY] read: %s\n", buf);
-
-            if (related_fd[conn_fd] >= 0) {
-              printf("[PROXY] adding to waiting_msgs\n");
-              waiting_msgs[related_fd[conn_fd]].push_back(mesg);
-              printf("[PROXY] new queue len: %lu\n",
-                     waiting_msgs[related_fd[conn_fd]].size());
-            } else {
-              printf("[PROXY] no related fd, not adding to waiting msgs\n");
-            }
+          if (!epoll_recv(conn_fd)) {
+            continue;
           }
           something_occurred = true;
         }
@@ -378,25 +736,317 @@ bool Proxy::poll_for_events(bool blocking) {
       if (evs[i].events & (EPOLLHUP | EPOLLRDHUP)) {
         int conn_fd = (int)evs[i].data.u32;
         // unregistered already, so just ignore it
-        if (related_fd.find(conn_fd) == related_fd.end())
+        if (!conns.is_open(conn_fd))
           continue;
-        // assume later than Linux 2.6.9
-        unregister_fd(conn_fd);
+        // the last of what was sent can still be waiting. take in all that
+        // fits. reading the end closes conn_fd, with any partial message
+        // flushed. if its link fills first, the rest is read as messages
+        // are released (see allow_next_msg)
+        while (conns.is_open(conn_fd) && epoll_recv(conn_fd)) {
+          something_occurred = true;
+        }
+        if (conns.is_open(conn_fd) && conns.peer(conn_fd) < 0) {
+          // assume later than Linux 2.6.9
+          unregister_fd(conn_fd);
+        }
       }
     }
-  } while (fdmap.get_last_node() >= 0);
+    // a connect finishing or a send going out doesn't count, same as with
+    // PE_URING
+  } while (fdmap.has_unaccepted() ||
+           (blocking && num_events > 0 &&
+            num_connected + num_sent == num_events));
   return something_occurred;
 }
 
+bool Proxy::epoll_recv(int conn_fd) {
+  int to_fd = conns.peer(conn_fd);
+  ssize_t n_bytes;
+  if (to_fd >= 0) {
+    n_bytes = hold_msg(conn_fd, to_fd);
+  } else {
+    // nowhere for it to go, but it still has to be read
+    char buf[MAX_DISCARD];
+    n_bytes =
+        recvfrom(conn_fd, &buf, MAX_DISCARD, MSG_DONTWAIT, nullptr, nullptr);
+  }
+  if (n_bytes < 0 && errno == EAGAIN) {
+    // to_fd's queue is full (or nothing's waiting). leave it in the socket
+    // for now
+    printf("[PROXY] queue for %d is full\n", to_fd);
+    return false;
+  } else if (n_bytes < 0 && errno == EMSGSIZE) {
+    // never fits, see msg_too_big
+    return false;
+  } else if (n_bytes < 0) {
+    fprintf(stderr, "[PROXY] recv failed: %s\n", strerror(errno));
+    unregister_fd(conn_fd);
+  } else if (n_bytes == 0) {
+    printf("[PROXY] nothing read, closing %d\n", conn_fd);
+    flush_partial(to_fd);
+    // assume later than Linux 2.6.9
+    unregister_fd(conn_fd);
+  } else if (to_fd >= 0) {
+    printf("[PROXY] read %ld bytes, new queue len: %lu\n", n_bytes,
+           held_msgs.count(to_fd));
+  } else {
+    printf("[PROXY] no related fd, not adding to waiting msgs\n");
+  }
+  return true;
+}
+
+bool Proxy::uring_poll(bool blocking) {
+  bool something_occurred = false;
+
+  fflush(stdout); // make sure we have most up-to-date log if this blocks
+  do {
+    if (claim_unclaimed()) {
+      something_occurred = true;
+    }
+    // anything put off by uring_wait_sent counts as having arrived already,
+    // and so does what a starved fd has waiting (epoll would keep reporting
+    // it). a node that has connected is sure to show up at its listener
+    ring->submit(((blocking && !something_occurred) ||
+                  fdmap.has_unaccepted()) &&
+                 deferred.empty() && starved_fds.empty());
+    std::deque<struct io_uring_cqe> cqes;
+    cqes.swap(deferred);
+    for (auto *cqe = ring->peek(); cqe != nullptr; cqe = ring->peek()) {
+      cqes.push_back(*cqe);
+      ring->seen();
+    }
+    printf("[PROXY] found %lu completions\n", cqes.size());
+    for (auto &cqe : cqes) {
+      if (uring_complete(cqe)) {
+        something_occurred = true;
+      }
+    }
+    // a send, cancel or connect completing doesn't count, since epoll
+    // wouldn't have woken up for it
+  } while (fdmap.has_unaccepted() ||
+           (blocking && !something_occurred && starved_fds.empty()));
+  return something_occurred;
+}
+
+void Proxy::uring_arm(int fd, bool listener) {
+  struct io_uring_sqe *sqe = ring->get_sqe();
+  sqe->fd = fd;
+  if (listener) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = _tag(OP_ACCEPT, fd, conns.gen(fd));
+  } else {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->user_data = _tag(OP_RECV, fd, conns.gen(fd));
+  }
+}
+
+void Proxy::uring_send(int fd) {
+  const Sending &next = sending[fd].front();
+  struct io_uring_sqe *sqe = ring->get_sqe();
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(ring->buf(next.buf) + next.off);
+  sqe->len = next.len - next.off;
+  sqe->user_data = _tag(OP_SEND, fd, conns.gen(fd), next.buf);
+}
+
+bool Proxy::uring_complete(const struct io_uring_cqe &cqe) {
+  int fd = _tag_fd(cqe.user_data);
+  bool stale = conns.gen(fd) != _tag_gen(cqe.user_data);
+  bool more = cqe.flags & IORING_CQE_F_MORE;
+  switch (_tag_op(cqe.user_data)) {
+  case OP_ACCEPT: {
+    if (stale) {
+      if (cqe.res >= 0) {
+        close(cqe.res);
+      }
+      return false;
+    }
+    if (cqe.res < 0) {
+      fprintf(stderr, "[PROXY] accept failed: %s\n", strerror(-cqe.res));
+      exit(1);
+    }
+    if (!more) {
+      uring_arm(fd, true);
+    }
+    int my_idx = conns.node(fd);
+    sockaddr_storage peer;
+    socklen_t len = sizeof(peer);
+    if (getpeername(cqe.res, (struct sockaddr *)&peer, &len) < 0) {
+      fprintf(stderr, "[PROXY] getpeername failed: %s\n", strerror(errno));
+      exit(1);
+    }
+    sockaddr_in from = as_inet(peer, len);
+    printf("[PROXY] accepted connection for %d from: %s:%d\n", my_idx,
+           inet_ntoa(from.sin_addr), ntohs(from.sin_port));
+    // true even if it's dropped, since it's still what a blocking poll was
+    // waiting for
+    accept_conn(my_idx, cqe.res, from);
+    return true;
+  }
+  case OP_RECV: {
+    int buf = -1;
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+      buf = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+      // dropped by whatever ends up holding it
+      buf_refs[buf] = 1;
+    }
+    if (stale || !conns.is_open(fd)) {
+      // unregistered already, so just ignore it
+      if (buf >= 0) {
+        recycle_buf(buf);
+      }
+      return false;
+    }
+    if (cqe.res == -ENOBUFS) {
+      if (!can_free_bufs()) {
+        fprintf(stderr,
+                "[PROXY] out of buffers with no whole message to release, a "
+                "message is bigger than the %lu bytes they hold\n",
+                URING_BUFS * URING_BUF_SIZE);
+        // counts, so a blocking poll returns and the run can be stopped
+        too_big = true;
+        return true;
+      }
+      printf("[PROXY] out of buffers, %d waits for one\n", fd);
+      starved_fds.insert(fd);
+      return false;
+    } else if (cqe.res < 0) {
+      fprintf(stderr, "[PROXY] recv failed: %s\n", strerror(-cqe.res));
+      unregister_fd(fd);
+    } else if (cqe.res == 0) {
+      printf("[PROXY] nothing read, closing %d\n", fd);
+      flush_partial(conns.peer(fd));
+      unregister_fd(fd);
+    } else {
+      int to_fd = conns.peer(fd);
+      if (to_fd >= 0) {
+        // can't fill up: there are fewer buffers than a link can hold
+        held_msgs.add(to_fd, cqe.res, buf);
+        frame_bufs(to_fd);
+        printf("[PROXY] read %d bytes, new queue len: %lu\n", cqe.res,
+               held_msgs.count(to_fd));
+      } else {
+        printf("[PROXY] no related fd, not adding to waiting msgs\n");
+        recycle_buf(buf);
+      }
+      if (!more) {
+        uring_arm(fd, false);
+      }
+    }
+    return true;
+  }
+  case OP_SEND: {
+    uint16_t buf = _tag_buf(cqe.user_data);
+    if (stale) {
+      recycle_buf(buf);
+      num_sending--;
+      return false;
+    }
+    if (cqe.res < 0) {
+      fprintf(stderr, "[PROXY] send to %d through %d failed due to: %s\n",
+              conns.node(fd), fd, strerror(-cqe.res));
+      exit(1);
+    }
+    Sending &front = sending[fd].front();
+    front.off += cqe.res;
+    if (front.off < front.len) {
+      // partial send, so the rest goes again
+      printf("[PROXY] sent %lu of %lu to %d, requeueing the rest\n",
+             front.off, front.len, fd);
+    } else {
+      recycle_buf(buf);
+      num_sending--;
+      sending[fd].pop_front();
+      if (sending[fd].empty()) {
+        sending.erase(fd);
+        return false;
+      }
+    }
+    uring_send(fd);
+    return false;
+  }
+  case OP_CONNECT:
+    if (!stale) {
+      finish_connect(fd, -cqe.res);
+    }
+    return false;
+  case OP_CANCEL:
+    return false;
+  }
+  return false;
+}
+
+void Proxy::uring_wait_sent(int fd) {
+  while (fd < 0 ? num_sending > 0 : sending.count(fd) > 0) {
+    ring->submit(true);
+    for (auto *cqe = ring->peek(); cqe != nullptr; cqe = ring->peek()) {
+      if (_tag_op(cqe->user_data) == OP_SEND) {
+        uring_complete(*cqe);
+      } else {
+        // so nothing but sends happens in here, same as with epoll
+        deferred.push_back(*cqe);
+      }
+      ring->seen();
+    }
+  }
+}
+
+void Proxy::flush_partial(int fd) {
+  // the rest of it is never coming, so it goes as it is
+  if (fd >= 0 && held_msgs.room(fd) > 0 && held_msgs.flush(fd, step)) {
+    printf("[PROXY] holding partial message for %d, new queue len: %lu\n", fd,
+           held_msgs.count(fd));
+  }
+}
+
+bool Proxy::can_free_bufs() const {
+  if (num_sending > 0 || !deferred.empty()) {
+    return true;
+  }
+  for (int fd : held_msgs.fds()) {
+    if (held_msgs.count(fd) > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void Proxy::recycle_buf(uint16_t buf) {
+  // a buffer can be part of several messages, and of a send for each
+  if (--buf_refs[buf] > 0) {
+    return;
+  }
+  ring->recycle_buf(buf);
+  for (int fd : starved_fds) {
+    uring_arm(fd, false);
+  }
+  starved_fds.clear();
+}
+
 void Proxy::print_state() {
-  printf("[PROXY STATE] waiting_msgs:\n");
-  for (auto &x : waiting_msgs) {
-    int node =
-        fd_to_node.find(x.first) == fd_to_node.end() ? -1 : fd_to_node[x.first];
-    printf("[PROXY STATE] fd %2d --> %4d: [", x.first, node);
-    for (auto &v : x.second) {
-      printf("(%c%c, %lu), ", v[0], v[1], v.size());
+  printf("[PROXY STATE] held_msgs:\n");
+  for (int fd : held_msgs.fds()) {
+    size_t count = held_msgs.count(fd);
+    if (count == 0) {
+      continue;
+    }
+    int node = conns.node(fd);
+    printf("[PROXY STATE] fd %2d --> %4d: %lu bytes", fd, node,
+           held_msgs.bytes(fd));
+    if (held_msgs.byte_limit(fd) > 0) {
+      printf(" (of %lu)", held_msgs.byte_limit(fd));
+    }
+    printf(" [");
+    for (size_t i = 0; i < count; i++) {
+      const HeldMsg &msg = held_msgs.at(fd, i);
+      printf("(%lu+%u, step %lu), ", msg.off, msg.len, msg.step);
     }
     printf("]\n");
   }
-}
\ No newline at end of file
+}
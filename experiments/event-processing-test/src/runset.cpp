@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "runset.h"
+
+RunSet::RunSet(int base, size_t capacity)
+    : base(base), capacity(capacity), count(0),
+      words((capacity + 63) / 64, 0) {}
+
+size_t RunSet::_bit(int idx) const {
+  if (idx < base || (size_t)(idx - base) >= capacity) {
+    fprintf(stderr, "[RUNSET] %d out of range [%d, %lu)\n", idx, base,
+            base + capacity);
+    exit(1);
+  }
+  return idx - base;
+}
+
+void RunSet::insert(int idx) {
+  size_t bit = _bit(idx);
+  uint64_t mask = 1ULL << (bit % 64);
+  if (!(words[bit / 64] & mask)) {
+    words[bit / 64] |= mask;
+    count++;
+  }
+}
+
+void RunSet::erase(int idx) {
+  size_t bit = _bit(idx);
+  uint64_t mask = 1ULL << (bit % 64);
+  if (words[bit / 64] & mask) {
+    words[bit / 64] &= ~mask;
+    count--;
+  }
+}
+
+bool RunSet::contains(int idx) const {
+  if (idx < base || (size_t)(idx - base) >= capacity) {
+    return false;
+  }
+  size_t bit = idx - base;
+  return words[bit / 64] & (1ULL << (bit % 64));
+}
+
+int RunSet::nth(size_t k) const {
+  size_t want = k;
+  for (size_t w = 0; w < words.size(); w++) {
+    size_t in_word = __builtin_popcountll(words[w]);
+    if (k >= in_word) {
+      k -= in_word;
+      continue;
+    }
+    // drop the k lowest members of this word, and the lowest left is it
+    uint64_t word = words[w];
+    for (; k > 0; k--) {
+      word &= word - 1;
+    }
+    return base + w * 64 + __builtin_ctzll(word);
+  }
+  fprintf(stderr, "[RUNSET] no member %lu of %lu\n", want, count);
+  exit(1);
+}
+
+void RunSet::members(std::vector<int> *out) const {
+  out->clear();
+  for (size_t w = 0; w < words.size(); w++) {
+    for (uint64_t word = words[w]; word; word &= word - 1) {
+      out->push_back(base + w * 64 + __builtin_ctzll(word));
+    }
+  }
+}
@@ -0,0 +1,118 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/reg.h>
+#include <sys/types.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+
+#include "sysstop.h"
+
+namespace {
+// register holding each syscall argument, as a word offset into
+// user_regs_struct
+const size_t ARG_REGS[] = {RDI, RSI, RDX, R10, R8, R9};
+
+const size_t NUM_WORDS = sizeof(struct user_regs_struct) / sizeof(long);
+static_assert(NUM_WORDS <= 32, "dirty mask too small for user_regs_struct");
+
+} // namespace
+
+SyscallStop::SyscallStop() : pid(-1), loaded(false), dirty(0), cached() {}
+
+void SyscallStop::attach(pid_t new_pid) {
+  pid = new_pid;
+  next_stop();
+}
+
+void SyscallStop::detach() {
+  pid = -1;
+  next_stop();
+}
+
+void SyscallStop::next_stop() {
+  loaded = false;
+  dirty = 0;
+}
+
+void SyscallStop::load() {
+  if (loaded) {
+    return;
+  }
+  if (ptrace(PTRACE_GETREGS, pid, 0, &cached) < 0) {
+    fprintf(stderr, "[SYSSTOP] failed to get registers of %d: %s\n", pid,
+            strerror(errno));
+    exit(1);
+  }
+  loaded = true;
+}
+
+long SyscallStop::nr() { return regs().orig_rax; }
+
+uint64_t SyscallStop::arg(int i) {
+  if (i < 0 || i >= 6) {
+    fprintf(stderr, "[SYSSTOP] no syscall argument %d\n", i);
+    exit(1);
+  }
+  load();
+  return ((unsigned long long *)&cached)[ARG_REGS[i]];
+}
+
+long SyscallStop::ret() { return regs().rax; }
+
+void SyscallStop::set_nr(long nr) { set_word(ORIG_RAX, nr); }
+
+void SyscallStop::set_arg(int i, uint64_t val) {
+  if (i < 0 || i >= 6) {
+    fprintf(stderr, "[SYSSTOP] no syscall argument %d\n", i);
+    exit(1);
+  }
+  set_word(ARG_REGS[i], val);
+}
+
+void SyscallStop::set_ret(long ret) { set_word(RAX, ret); }
+
+const struct user_regs_struct &SyscallStop::regs() {
+  load();
+  return cached;
+}
+
+void SyscallStop::set_regs(const struct user_regs_struct &new_regs) {
+  for (size_t word = 0; word < NUM_WORDS; word++) {
+    set_word(word, ((const unsigned long long *)&new_regs)[word]);
+  }
+}
+
+void SyscallStop::set_word(size_t word, uint64_t val) {
+  load();
+  unsigned long long *words = (unsigned long long *)&cached;
+  if (words[word] != val) {
+    words[word] = val;
+    dirty |= 1u << word;
+  }
+}
+
+void SyscallStop::flush() {
+  if (dirty == 0) {
+    return;
+  }
+  if ((dirty & (dirty - 1)) == 0) {
+    // just the one register
+    size_t word = __builtin_ctz(dirty);
+    ptrace(PTRACE_POKEUSER, pid, sizeof(long) * word,
+           ((unsigned long long *)&cached)[word]);
+  } else {
+    ptrace(PTRACE_SETREGS, pid, 0, &cached);
+  }
+  dirty = 0;
+}
+
+bool SyscallStop::to_exit(int *status) {
+  flush();
+  ptrace(PTRACE_SYSCALL, pid, 0, 0);
+  waitpid(pid, status, 0);
+  next_stop();
+  return WIFSTOPPED(*status) && WSTOPSIG(*status) & 0x80;
+}
@@ -0,0 +1,29 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "timerq.h"
+
+TimerQueue::TimerQueue(size_t num_nodes)
+    : queue(), deadlines(num_nodes, UNARMED) {}
+
+void TimerQueue::arm(int node, uint64_t deadline) {
+  if (deadline == UNARMED) {
+    // vtime starts well past 0, so this can't come from a node
+    fprintf(stderr, "[TIMERQ] node %d armed at 0\n", node);
+    exit(1);
+  }
+  disarm(node);
+  deadlines[node] = deadline;
+  queue.insert({deadline, node});
+}
+
+void TimerQueue::disarm(int node) {
+  if (deadlines[node] != UNARMED) {
+    queue.erase({deadlines[node], node});
+    deadlines[node] = UNARMED;
+  }
+}
+
+int TimerQueue::earliest() const {
+  return queue.empty() ? -1 : queue.begin()->second;
+}
@@ -0,0 +1,199 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "traceemem.h"
+
+namespace {
+const size_t PAGE_SIZE_GUESS = 4096;
+
+// bytes from addr until the end of its page
+size_t _to_page_end(uint64_t addr) {
+  return PAGE_SIZE_GUESS - (addr & (PAGE_SIZE_GUESS - 1));
+}
+
+} // namespace
+
+TraceeMemory::TraceeMemory() : pid(-1), mem_fd(-1), str_cache() {}
+
+TraceeMemory::~TraceeMemory() { detach(); }
+
+TraceeMemory::TraceeMemory(const TraceeMemory &other)
+    : pid(other.pid), mem_fd(-1), str_cache() {}
+
+TraceeMemory &TraceeMemory::operator=(const TraceeMemory &other) {
+  if (this != &other) {
+    detach();
+    pid = other.pid;
+  }
+  return *this;
+}
+
+void TraceeMemory::attach(pid_t new_pid) {
+  detach();
+  pid = new_pid;
+}
+
+void TraceeMemory::detach() {
+  if (mem_fd >= 0) {
+    close(mem_fd);
+  }
+  mem_fd = -1;
+  pid = -1;
+  str_cache.clear();
+}
+
+void TraceeMemory::next_stop() { str_cache.clear(); }
+
+int TraceeMemory::get_mem_fd() {
+  if (mem_fd < 0) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/mem", pid);
+    mem_fd = open(path, O_RDWR | O_CLOEXEC);
+    if (mem_fd < 0) {
+      fprintf(stderr, "[TRACEEMEM] failed to open %s: %s\n", path,
+              strerror(errno));
+      exit(1);
+    }
+  }
+  return mem_fd;
+}
+
+void TraceeMemory::fallback_read(char *out, uint64_t addr, size_t len) {
+  int fd = get_mem_fd();
+  while (len > 0) {
+    ssize_t ret = pread(fd, out, len, (off_t)addr);
+    if (ret <= 0) {
+      fprintf(stderr, "[TRACEEMEM] failed to read %lu bytes at %lx: %s\n", len,
+              addr, ret == 0 ? "EOF" : strerror(errno));
+      exit(1);
+    }
+    out += ret;
+    addr += ret;
+    len -= ret;
+  }
+}
+
+void TraceeMemory::fallback_write(const char *in, uint64_t addr, size_t len) {
+  int fd = get_mem_fd();
+  while (len > 0) {
+    ssize_t ret = pwrite(fd, in, len, (off_t)addr);
+    if (ret <= 0) {
+      fprintf(stderr, "[TRACEEMEM] failed to write %lu bytes at %lx: %s\n",
+              len, addr, ret == 0 ? "EOF" : strerror(errno));
+      exit(1);
+    }
+    in += ret;
+    addr += ret;
+    len -= ret;
+  }
+}
+
+void TraceeMemory::read(void *out, uint64_t addr, size_t len) {
+  if (len == 0) {
+    return;
+  }
+  struct iovec local = {out, len};
+  struct iovec remote = {(void *)addr, len};
+  transfer(false, &local, &remote, 1);
+}
+
+void TraceeMemory::write(const void *in, uint64_t addr, size_t len) {
+  if (len == 0) {
+    return;
+  }
+  struct iovec local = {(void *)in, len};
+  struct iovec remote = {(void *)addr, len};
+  transfer(true, &local, &remote, 1);
+}
+
+void TraceeMemory::readv(const std::vector<struct iovec> &local,
+                         const std::vector<struct iovec> &remote) {
+  if (local.size() != remote.size()) {
+    fprintf(stderr, "[TRACEEMEM] mismatched iovecs for readv\n");
+    exit(1);
+  }
+  for (size_t start = 0; start < local.size(); start += IOV_MAX) {
+    size_t n = std::min(local.size() - start, (size_t)IOV_MAX);
+    transfer(false, &local[start], &remote[start], n);
+  }
+}
+
+void TraceeMemory::writev(const std::vector<struct iovec> &local,
+                          const std::vector<struct iovec> &remote) {
+  if (local.size() != remote.size()) {
+    fprintf(stderr, "[TRACEEMEM] mismatched iovecs for writev\n");
+    exit(1);
+  }
+  for (size_t start = 0; start < local.size(); start += IOV_MAX) {
+    size_t n = std::min(local.size() - start, (size_t)IOV_MAX);
+    transfer(true, &local[start], &remote[start], n);
+  }
+}
+
+void TraceeMemory::transfer(bool is_write, const struct iovec *local,
+                            const struct iovec *remote, size_t n) {
+  ssize_t ret;
+  if (is_write) {
+    // whatever we write may overlap with a cached string
+    str_cache.clear();
+    ret = process_vm_writev(pid, local, n, remote, n, 0);
+  } else {
+    ret = process_vm_readv(pid, local, n, remote, n, 0);
+  }
+  size_t done = ret < 0 ? 0 : (size_t)ret;
+
+  // finish anything process_vm_{read,write}v couldn't get to through
+  // /proc/pid/mem. this is mainly pages that are read-only in the tracee
+  for (size_t i = 0; i < n; i++) {
+    size_t skip = std::min(done, local[i].iov_len);
+    done -= skip;
+    if (skip == local[i].iov_len) {
+      continue;
+    }
+    char *local_addr = (char *)local[i].iov_base + skip;
+    uint64_t remote_addr = (uint64_t)remote[i].iov_base + skip;
+    if (is_write) {
+      fallback_write(local_addr, remote_addr, local[i].iov_len - skip);
+    } else {
+      fallback_read(local_addr, remote_addr, local[i].iov_len - skip);
+    }
+  }
+}
+
+const std::string &TraceeMemory::read_string(uint64_t addr, size_t max_len) {
+  auto got = str_cache.find(addr);
+  if (got != str_cache.end()) {
+    return got->second;
+  }
+
+  std::string str;
+  char buf[PAGE_SIZE_GUESS];
+  uint64_t curr = addr;
+  while (str.size() + 1 < max_len) {
+    // never read across a page boundary in one go, since the next page may be
+    // unmapped even though the string ends before it
+    size_t to_read = std::min(_to_page_end(curr), max_len - 1 - str.size());
+    read(buf, curr, to_read);
+    char *end = (char *)memchr(buf, '\0', to_read);
+    if (end != nullptr) {
+      str.append(buf, end - buf);
+      return str_cache[addr] = str;
+    }
+    str.append(buf, to_read);
+    curr += to_read;
+  }
+  printf("[TRACEEMEM] string at %lx truncated to %lu bytes\n", addr,
+         str.size());
+  return str_cache[addr] = str;
+}
@@ -0,0 +1,51 @@
+#include "tracer.h"
+
+Tracer::Tracer()
+    : has_job(false), stopping(false), thread(&Tracer::loop, this) {}
+
+Tracer::~Tracer() {
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    changed.wait(guard, [this] { return !has_job; });
+    stopping = true;
+  }
+  changed.notify_all();
+  thread.join();
+}
+
+void Tracer::run(std::function<void()> job) {
+  post(job);
+  wait();
+}
+
+void Tracer::post(std::function<void()> new_job) {
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    changed.wait(guard, [this] { return !has_job; });
+    job = new_job;
+    has_job = true;
+  }
+  changed.notify_all();
+}
+
+void Tracer::wait() {
+  std::unique_lock<std::mutex> guard(lock);
+  changed.wait(guard, [this] { return !has_job; });
+}
+
+void Tracer::loop() {
+  std::unique_lock<std::mutex> guard(lock);
+  while (true) {
+    changed.wait(guard, [this] { return has_job || stopping; });
+    if (!has_job) {
+      return;
+    }
+    // run without the lock, so whoever posted can carry on
+    guard.unlock();
+    job();
+    guard.lock();
+    job = nullptr;
+    has_job = false;
+    changed.notify_all();
+  }
+}
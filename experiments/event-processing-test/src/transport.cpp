@@ -0,0 +1,304 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "transport.h"
+
+namespace {
+// how many ports unix_ephemeral_port hands out before coming round again
+const int NUM_EPHEMERAL_PORTS = 65535;
+
+// every name starts with this, so orchs on the same host never share one
+const std::string &_prefix() {
+  static const std::string prefix =
+      std::string(1, '\0') + "rafted." + std::to_string(getpid()) + ".";
+  return prefix;
+}
+
+struct sockaddr_in _tracee_addr(pid_t pid, int fd, bool peer) {
+  const char *what = peer ? "getpeername" : "getsockname";
+  int localfd = tracee_fd(pid, fd);
+  if (localfd < 0) {
+    fprintf(stderr, "[TRANSPORT] pidfd_getfd of %d's fd %d failed: %s\n", pid,
+            fd, strerror(errno));
+    exit(1);
+  }
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+  int ret = peer ? getpeername(localfd, (struct sockaddr *)&addr, &len)
+                 : getsockname(localfd, (struct sockaddr *)&addr, &len);
+  if (ret < 0) {
+    fprintf(stderr, "[TRANSPORT] %s of %d's fd %d failed: %s\n", what, pid, fd,
+            strerror(errno));
+    exit(1);
+  }
+  close(localfd);
+  return as_inet(addr, len);
+}
+
+// AF_UNIX for the sockets unix_socket made, or -1 if fd isn't a socket
+int _tracee_domain(pid_t pid, int fd) {
+  int localfd = tracee_fd(pid, fd);
+  if (localfd < 0) {
+    return -1;
+  }
+  int domain;
+  socklen_t len = sizeof(domain);
+  if (getsockopt(localfd, SOL_SOCKET, SO_DOMAIN, &domain, &len) < 0) {
+    domain = -1;
+  }
+  close(localfd);
+  return domain;
+}
+
+} // namespace
+
+socklen_t unix_name(UnixRole role, const struct sockaddr_in &addr,
+                    struct sockaddr_un *name) {
+  char ip[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+  std::string path = _prefix();
+  path += (char)role;
+  path += '.';
+  path += ip;
+  path += ':';
+  path += std::to_string(ntohs(addr.sin_port));
+
+  memset(name, 0, sizeof(*name));
+  name->sun_family = AF_UNIX;
+  memcpy(name->sun_path, path.data(), path.size());
+  return offsetof(struct sockaddr_un, sun_path) + path.size();
+}
+
+struct sockaddr_in as_inet(const struct sockaddr_storage &addr,
+                           socklen_t len) {
+  struct sockaddr_in inet;
+  memset(&inet, 0, sizeof(inet));
+  inet.sin_family = AF_INET;
+  if (addr.ss_family == AF_INET && len >= sizeof(inet)) {
+    memcpy(&inet, &addr, sizeof(inet));
+    return inet;
+  }
+  if (addr.ss_family != AF_UNIX) {
+    return inet;
+  }
+
+  // <prefix><role>.<ip>:<port>
+  const struct sockaddr_un &name = (const struct sockaddr_un &)addr;
+  const std::string &prefix = _prefix();
+  size_t path_len = len - offsetof(struct sockaddr_un, sun_path);
+  if (len <= offsetof(struct sockaddr_un, sun_path) ||
+      path_len < prefix.size() + 2 ||
+      memcmp(name.sun_path, prefix.data(), prefix.size()) != 0) {
+    return inet;
+  }
+  std::string rest(name.sun_path + prefix.size() + 2,
+                   path_len - prefix.size() - 2);
+  size_t colon = rest.rfind(':');
+  if (colon == rest.npos ||
+      inet_aton(rest.substr(0, colon).c_str(), &inet.sin_addr) == 0) {
+    inet.sin_addr.s_addr = 0;
+    return inet;
+  }
+  inet.sin_port = htons(atoi(rest.c_str() + colon + 1));
+  return inet;
+}
+
+in_port_t unix_ephemeral_port() {
+  static std::atomic<uint32_t> next(0);
+  return next.fetch_add(1) % NUM_EPHEMERAL_PORTS + 1;
+}
+
+int transport_socket(Transport tr, int flags) {
+  int fd = tr == TR_UNIX ? socket(AF_UNIX, SOCK_STREAM | flags, 0)
+                         : socket(AF_INET, SOCK_STREAM | flags, IPPROTO_TCP);
+  if (fd < 0) {
+    fprintf(stderr, "[TRANSPORT] socket failed: %s\n", strerror(errno));
+    exit(1);
+  }
+  return fd;
+}
+
+void transport_bind(Transport tr, int fd, UnixRole role,
+                    const struct sockaddr_in &addr) {
+  struct sockaddr_storage to;
+  struct sockaddr_in named = addr;
+  // nothing picks a port for us
+  bool ephemeral = tr == TR_UNIX && role == UR_PEER && named.sin_port == 0;
+  for (int tries = 1;; tries++) {
+    if (ephemeral) {
+      named.sin_port = htons(unix_ephemeral_port());
+    }
+    socklen_t len = transport_addr(tr, role, named, &to);
+    if (bind(fd, (const struct sockaddr *)&to, len) == 0) {
+      return;
+    }
+    if (!ephemeral || errno != EADDRINUSE || tries == NUM_EPHEMERAL_PORTS) {
+      fprintf(stderr, "[TRANSPORT] bind to %s:%d failed: %s\n",
+              inet_ntoa(named.sin_addr), ntohs(named.sin_port),
+              strerror(errno));
+      exit(1);
+    }
+  }
+}
+
+socklen_t transport_addr(Transport tr, UnixRole role,
+                         const struct sockaddr_in &addr,
+                         struct sockaddr_storage *out) {
+  if (tr == TR_UNIX) {
+    return unix_name(role, addr, (struct sockaddr_un *)out);
+  }
+  memcpy(out, &addr, sizeof(addr));
+  return sizeof(addr);
+}
+
+int tracee_fd(pid_t pid, int fd) {
+  int pidfd = syscall(SYS_pidfd_open, pid, 0);
+  if (pidfd < 0) {
+    fprintf(stderr, "[TRANSPORT] pidfd_open of %d failed: %s\n", pid,
+            strerror(errno));
+    exit(1);
+  }
+  int localfd = syscall(SYS_pidfd_getfd, pidfd, fd, 0);
+  int err = errno;
+  close(pidfd);
+  errno = err;
+  return localfd;
+}
+
+struct sockaddr_in tracee_sockname(pid_t pid, int fd) {
+  return _tracee_addr(pid, fd, false);
+}
+
+struct sockaddr_in tracee_peername(pid_t pid, int fd) {
+  return _tracee_addr(pid, fd, true);
+}
+
+int tracee_bind(pid_t pid, int fd, UnixRole role,
+                const struct sockaddr_in &addr) {
+  int localfd = tracee_fd(pid, fd);
+  if (localfd < 0) {
+    return -errno;
+  }
+  // it's the same socket, so binding our copy binds the tracee's
+  struct sockaddr_un name;
+  socklen_t len = unix_name(role, addr, &name);
+  int ret = bind(localfd, (const struct sockaddr *)&name, len);
+  int err = errno;
+  close(localfd);
+  return ret < 0 ? -err : 0;
+}
+
+int tracee_bind_ephemeral(pid_t pid, int fd, struct sockaddr_in *addr) {
+  // the ports come round again, and a name from last time round may still be
+  // bound
+  for (int i = 0; i < NUM_EPHEMERAL_PORTS; i++) {
+    addr->sin_port = htons(unix_ephemeral_port());
+    int ret = tracee_bind(pid, fd, UR_PEER, *addr);
+    if (ret != -EADDRINUSE) {
+      return ret;
+    }
+  }
+  // what TCP says when it's out of ephemeral ports
+  return -EADDRNOTAVAIL;
+}
+
+bool unix_socket(SyscallStop &stop, int *status) {
+  uint64_t domain = stop.arg(0);
+  uint64_t protocol = stop.arg(2);
+  stop.set_arg(0, AF_UNIX);
+  // IPPROTO_TCP means nothing to a unix socket
+  stop.set_arg(2, 0);
+  bool at_exit = stop.to_exit(status);
+  if (at_exit) {
+    stop.set_arg(0, domain);
+    stop.set_arg(2, protocol);
+  }
+  return at_exit;
+}
+
+bool unix_connect(pid_t pid, SyscallStop &stop, TraceeMemory &mem,
+                  struct in_addr from, int *status) {
+  int fd = (int)stop.arg(0);
+  uint64_t addr_ptr = stop.arg(1);
+  uint64_t addrlen = stop.arg(2);
+  struct sockaddr_in to;
+  if (addrlen < sizeof(to)) {
+    return stop.to_exit(status);
+  }
+  mem.read(&to, addr_ptr, sizeof(to));
+  if (to.sin_family != AF_INET) {
+    return stop.to_exit(status);
+  }
+
+  if (_tracee_domain(pid, fd) != AF_UNIX) {
+    // not one of ours (or not a socket, which the connect will say)
+    printf("[TRANSPORT] connect on %d left alone\n", fd);
+    return stop.to_exit(status);
+  }
+
+  struct sockaddr_in self;
+  memset(&self, 0, sizeof(self));
+  self.sin_family = AF_INET;
+  self.sin_addr = from;
+  int ret = tracee_bind_ephemeral(pid, fd, &self);
+  if (ret < 0 && ret != -EINVAL) {
+    // the connect fails the way naming it did (EINVAL is a retried connect,
+    // already named)
+    printf("[TRANSPORT] naming %d for connect failed: %s\n", fd,
+           strerror(-ret));
+    stop.set_nr(-1);
+    stop.set_ret(ret);
+    return stop.to_exit(status);
+  }
+
+  struct sockaddr_un name;
+  socklen_t len = unix_name(UR_PROXY, to, &name);
+  uint64_t scratch = (stop.regs().rsp - 128 - sizeof(name)) & ~15ULL;
+  mem.write(&name, scratch, len);
+  stop.set_arg(1, scratch);
+  stop.set_arg(2, len);
+  bool at_exit = stop.to_exit(status);
+  if (at_exit) {
+    stop.set_arg(1, addr_ptr);
+    stop.set_arg(2, addrlen);
+  }
+  return at_exit;
+}
+
+bool unix_sockopt(SyscallStop &stop, TraceeMemory &mem) {
+  if ((int)stop.arg(1) != IPPROTO_TCP) {
+    return false;
+  }
+  if (stop.nr() == SYS_getsockopt) {
+    uint64_t optval = stop.arg(3);
+    uint64_t optlen_ptr = stop.arg(4);
+    socklen_t optlen;
+    mem.read(&optlen, optlen_ptr, sizeof(optlen));
+    // an int for the flags, or all of TCP_INFO at most
+    optlen = std::min(optlen, (socklen_t)sizeof(struct tcp_info));
+    std::vector<char> zeros(optlen, 0);
+    if (optlen > 0) {
+      mem.write(zeros.data(), optval, optlen);
+    }
+    mem.write(&optlen, optlen_ptr, sizeof(optlen));
+  }
+  printf("[TRANSPORT] skipping %s of tcp option %d\n",
+         stop.nr() == SYS_getsockopt ? "getsockopt" : "setsockopt",
+         (int)stop.arg(2));
+  stop.set_nr(-1);
+  stop.set_ret(0);
+  return true;
+}
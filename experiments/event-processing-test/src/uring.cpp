@@ -0,0 +1,175 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+namespace {
+// there's no liburing here, so the two syscalls are made directly
+int _setup(unsigned entries, struct io_uring_params *p) {
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+int _enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                 nullptr, 0);
+}
+
+int _register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+void *_map(int fd, size_t len, off_t offset) {
+  void *ptr = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, offset);
+  if (ptr == MAP_FAILED) {
+    fprintf(stderr, "[URING] mmap failed: %s\n", strerror(errno));
+    exit(1);
+  }
+  return ptr;
+}
+
+} // namespace
+
+Uring::Uring(unsigned entries)
+    : to_submit(0), buf_ring(nullptr), buf_ring_len(0), bufs(nullptr),
+      bufs_size(0), bufs_num(0) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  ring_fd = _setup(entries, &p);
+  if (ring_fd < 0) {
+    fprintf(stderr, "[URING] io_uring_setup failed: %s\n", strerror(errno));
+    exit(1);
+  }
+  // 5.4 and later. keeps this to one mapping for both rings
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+    fprintf(stderr, "[URING] kernel too old (no IORING_FEAT_SINGLE_MMAP)\n");
+    exit(1);
+  }
+
+  sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (cq_len > sq_len) {
+    sq_len = cq_len;
+  }
+  sq_ptr = _map(ring_fd, sq_len, IORING_OFF_SQ_RING);
+  char *base = (char *)sq_ptr;
+  sq_head = (unsigned *)(base + p.sq_off.head);
+  sq_tail = (unsigned *)(base + p.sq_off.tail);
+  sq_mask = (unsigned *)(base + p.sq_off.ring_mask);
+  sq_array = (unsigned *)(base + p.sq_off.array);
+  sq_entries = p.sq_entries;
+  cq_head = (unsigned *)(base + p.cq_off.head);
+  cq_tail = (unsigned *)(base + p.cq_off.tail);
+  cq_mask = (unsigned *)(base + p.cq_off.ring_mask);
+  cqes = (struct io_uring_cqe *)(base + p.cq_off.cqes);
+
+  sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  sqes = (struct io_uring_sqe *)_map(ring_fd, sqes_len, IORING_OFF_SQES);
+}
+
+Uring::~Uring() {
+  if (buf_ring != nullptr) {
+    munmap(buf_ring, buf_ring_len);
+    free(bufs);
+  }
+  munmap(sqes, sqes_len);
+  munmap(sq_ptr, sq_len);
+  close(ring_fd);
+}
+
+struct io_uring_sqe *Uring::get_sqe() {
+  unsigned tail = *sq_tail;
+  if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) == sq_entries) {
+    submit(false);
+    tail = *sq_tail;
+  }
+  unsigned idx = tail & *sq_mask;
+  struct io_uring_sqe *sqe = &sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sq_array[idx] = idx;
+  // the kernel only reads it once it's submitted, so publishing the tail
+  // before the entry is filled in is fine
+  __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+  to_submit++;
+  return sqe;
+}
+
+void Uring::submit(bool wait) {
+  // GETEVENTS even when not waiting, so completions that are ready get posted
+  while (_enter(ring_fd, to_submit, wait ? 1 : 0, IORING_ENTER_GETEVENTS) <
+         0) {
+    if (errno != EINTR) {
+      fprintf(stderr, "[URING] io_uring_enter failed: %s\n", strerror(errno));
+      exit(1);
+    }
+  }
+  to_submit = 0;
+}
+
+struct io_uring_cqe *Uring::peek() {
+  unsigned head = *cq_head;
+  if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+    return nullptr;
+  }
+  return &cqes[head & *cq_mask];
+}
+
+void Uring::seen() {
+  __atomic_store_n(cq_head, *cq_head + 1, __ATOMIC_RELEASE);
+}
+
+void Uring::setup_bufs(uint16_t group, unsigned num, size_t size) {
+  if (buf_ring != nullptr || num == 0 || (num & (num - 1)) != 0) {
+    fprintf(stderr, "[URING] bad buffer setup (%u buffers)\n", num);
+    exit(1);
+  }
+  buf_ring_len = num * sizeof(struct io_uring_buf);
+  buf_ring = (struct io_uring_buf_ring *)mmap(
+      nullptr, buf_ring_len, PROT_READ | PROT_WRITE,
+      MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (buf_ring == MAP_FAILED) {
+    fprintf(stderr, "[URING] mmap failed: %s\n", strerror(errno));
+    exit(1);
+  }
+  bufs = (char *)malloc(num * size);
+  if (bufs == nullptr) {
+    fprintf(stderr, "[URING] couldn't allocate %u buffers\n", num);
+    exit(1);
+  }
+  bufs_size = size;
+  bufs_num = num;
+
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)buf_ring;
+  reg.ring_entries = num;
+  reg.bgid = group;
+  if (_register(ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    fprintf(stderr, "[URING] registering buffer ring failed: %s\n",
+            strerror(errno));
+    exit(1);
+  }
+  for (unsigned bid = 0; bid < num; bid++) {
+    recycle_buf(bid);
+  }
+}
+
+char *Uring::buf(uint16_t bid) { return bufs + bid * bufs_size; }
+
+void Uring::recycle_buf(uint16_t bid) {
+  // only we move the tail, so no need for an atomic load
+  uint16_t tail = buf_ring->tail;
+  // not buf_ring->bufs: in C++ the header's flex array sits behind an empty
+  // struct, which puts it 8 bytes past where the kernel expects
+  struct io_uring_buf *entry =
+      (struct io_uring_buf *)buf_ring + (tail & (bufs_num - 1));
+  entry->addr = (uint64_t)buf(bid);
+  entry->len = bufs_size;
+  entry->bid = bid;
+  __atomic_store_n(&buf_ring->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+}
@@ -0,0 +1,65 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "vclock.h"
+
+namespace {
+const long long i1e9 = 1000 * 1000 * 1000;
+} // namespace
+
+namespace VClock {
+
+int create(VClockPage **page) {
+  int fd = memfd_create("vclock", MFD_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "[VCLOCK] memfd_create failed: %s\n", strerror(errno));
+    exit(1);
+  }
+  if (ftruncate(fd, sysconf(_SC_PAGESIZE)) < 0) {
+    fprintf(stderr, "[VCLOCK] ftruncate failed: %s\n", strerror(errno));
+    exit(1);
+  }
+  void *addr = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    fprintf(stderr, "[VCLOCK] mmap failed: %s\n", strerror(errno));
+    exit(1);
+  }
+  *page = (VClockPage *)addr;
+  return fd;
+}
+
+void prepare_node(int fd, const std::string &shim) {
+  // dup2 clears O_CLOEXEC on the new fd
+  if (dup2(fd, NODE_FD) < 0) {
+    perror("when moving vclock fd");
+    exit(1);
+  }
+  std::string preload = shim;
+  const char *old_preload = getenv("LD_PRELOAD");
+  if (old_preload != nullptr && old_preload[0] != '\0') {
+    preload.append(":");
+    preload.append(old_preload);
+  }
+  setenv("LD_PRELOAD", preload.c_str(), 1);
+  setenv(FD_ENV, std::to_string(NODE_FD).c_str(), 1);
+}
+
+uint64_t to_ns(const struct timespec &ts) {
+  return (uint64_t)ts.tv_sec * i1e9 + ts.tv_nsec;
+}
+
+struct timespec from_ns(uint64_t ns) {
+  struct timespec ts;
+  ts.tv_sec = ns / i1e9;
+  ts.tv_nsec = ns % i1e9;
+  return ts;
+}
+
+} // namespace VClock
@@ -0,0 +1,64 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vclock.h"
+
+// Preloaded into nodes (as libvclock.so) when using a shared virtual clock.
+// Answers clock_gettime and gettimeofday from the page the orchestrator
+// handed over, without entering the kernel. Anything it can't answer, or
+// every call if there's no page, goes to the real syscall, which the
+// orchestrator still traps.
+
+namespace {
+VClockPage *_page = nullptr;
+
+__attribute__((constructor)) void _map_page() {
+  const char *fd_str = getenv(VClock::FD_ENV);
+  if (fd_str == nullptr) {
+    return;
+  }
+  // the page is only the node's, so processes it starts neither inherit the
+  // fd nor look for it, and fall back to traps
+  int fd = atoi(fd_str);
+  unsetenv(VClock::FD_ENV);
+  void *addr = mmap(nullptr, sizeof(VClockPage), PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  if (addr != MAP_FAILED) {
+    _page = (VClockPage *)addr;
+  }
+}
+
+// moves the clock forward, like a trap would, and returns the new time
+struct timespec _tick() {
+  return VClock::from_ns(__atomic_add_fetch(&_page->now_ns, _page->step_ns,
+                                            __ATOMIC_SEQ_CST));
+}
+
+} // namespace
+
+// the orchestrator answers every clock id with vtime, so do the same here
+extern "C" int clock_gettime(clockid_t clock_id, struct timespec *tp) __THROW {
+  if (_page == nullptr) {
+    return syscall(SYS_clock_gettime, clock_id, tp);
+  }
+  *tp = _tick();
+  return 0;
+}
+
+extern "C" int gettimeofday(struct timeval *__restrict tv,
+                            void *__restrict tz) __THROW {
+  // a timezone makes the orchestrator bail, so let it
+  if (_page == nullptr || tz != nullptr) {
+    return syscall(SYS_gettimeofday, tv, tz);
+  }
+  struct timespec now = _tick();
+  tv->tv_sec = now.tv_sec;
+  tv->tv_usec = now.tv_nsec / 1000;
+  return 0;
+}
@@ -0,0 +1,104 @@
+#include <algorithm>
+
+#include "versions.h"
+
+VersionGraph::VersionGraph()
+    : ids(), paths(), dirs(), dir_last_op(), pending(), ops_done(0),
+      op_count(0), links(), moves() {}
+
+int VersionGraph::intern(const std::string &path) {
+  auto it = ids.find(path);
+  if (it != ids.end()) {
+    return it->second;
+  }
+  size_t slash = path.rfind('/');
+  int dir = (slash == std::string::npos || slash == 0)
+                ? -1
+                : intern(path.substr(0, slash));
+  int file = paths.size();
+  ids[path] = file;
+  paths.push_back(path);
+  dirs.push_back(dir);
+  dir_last_op.push_back(0);
+  return file;
+}
+
+int VersionGraph::find(const std::string &path) const {
+  auto it = ids.find(path);
+  return it == ids.end() ? -1 : it->second;
+}
+
+size_t VersionGraph::add(FileVersion src, FileVersion dst) {
+  size_t idx = ++op_count;
+  pending.push_back({idx, src, dst});
+  if (!(src == dst)) {
+    // a file renamed over itself doesn't move its data anywhere
+    links[_key(dst)] = {_key(src), idx, _key(src), idx};
+    moves[_key(src)]++;
+  }
+  for (int file : {src.file, dst.file}) {
+    if (dirs[file] >= 0) {
+      dir_last_op[dirs[file]] = idx;
+    }
+  }
+  return idx;
+}
+
+void VersionGraph::pop_front() {
+  const RenameOp &op = pending.front();
+  auto it = links.find(_key(op.dst));
+  if (it != links.end() && it->second.op == op.idx) {
+    links.erase(it);
+  }
+  if (!(op.src == op.dst)) {
+    auto m = moves.find(_key(op.src));
+    if (--m->second == 0) {
+      moves.erase(m);
+    }
+  }
+  ops_done = op.idx;
+  pending.pop_front();
+}
+
+FileVersion VersionGraph::root(FileVersion fv) {
+  uint64_t start = _key(fv);
+  uint64_t key = start;
+  // the oldest op on the way back, so everything passed can jump straight to
+  // where it ends for as long as that op is pending
+  size_t oldest = 0;
+  while (true) {
+    auto it = links.find(key);
+    if (it == links.end()) {
+      break;
+    }
+    const Link &link = it->second;
+    if (link.jump_op > ops_done) {
+      oldest = link.jump_op;
+      key = link.jump;
+    } else {
+      oldest = link.op;
+      key = link.src;
+    }
+  }
+  // compress the path just taken
+  for (uint64_t at = start; at != key;) {
+    Link &link = links.at(at);
+    at = link.jump_op > ops_done ? link.jump : link.src;
+    link.jump = key;
+    link.jump_op = oldest;
+  }
+  return _version(key);
+}
+
+size_t VersionGraph::last_op_in(int dir) const {
+  return dir >= 0 && (size_t)dir < dir_last_op.size() ? dir_last_op[dir] : 0;
+}
+
+void VersionGraph::clear() {
+  pending.clear();
+  links.clear();
+  moves.clear();
+  ops_done = 0;
+  op_count = 0;
+  std::fill(dir_last_op.begin(), dir_last_op.end(), 0);
+}
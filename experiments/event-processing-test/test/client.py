@@ -33,7 +33,7 @@ while True:
       s.connect((curr_addr, port))
     except OSError as msg:
       print("failed to connect: {}".format(msg))
-      curr_addr = all_addrs[it % 3]
+      curr_addr = all_addrs[it % len(all_addrs)]
       s.close()
       continue
 
@@ -44,7 +44,7 @@ while True:
     except OSError as msg:
       print("couldn't maintain connection: {}".format(msg))
       err_count += 1
-      curr_addr = all_addrs[it % 3]
+      curr_addr = all_addrs[it % len(all_addrs)]
       s.close()
       if err_count > ERR_LIMIT:
         sys.exit(1)